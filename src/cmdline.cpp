@@ -4,6 +4,7 @@
 #include "stats.h"
 #include "config.h"
 #include "flows.h"
+#include "tracker.h"
 
 #include <cmdline.h>
 #include <cmdline_parse.h>
@@ -29,6 +30,9 @@
 #define BIN_SEARCH_WARMUP_DURATION_S 5
 #define BIN_SEARCH_LOSS_THRESHOLD 0.001 /* 0.1% */
 
+// Leaves the TX workers time to notice the update before the shared time base starts.
+#define START_DELAY_US 1000
+
 struct runtime_config_t runtime_config;
 
 #define CMDLINE_PARSE_INT_NTOKENS(NTOKENS)                                                                                                 \
@@ -66,15 +70,19 @@ INIT_PARAMETERLESS_COMMAND(cmd_stats_reset_token_cmd, cmd, "reset");
 INIT_PARAMETERLESS_COMMAND(cmd_bench_token_cmd, cmd, "bench");
 INIT_PARAMETERLESS_COMMAND(cmd_flows_token_cmd, cmd, "flows");
 INIT_PARAMETERLESS_COMMAND(cmd_dist_token_cmd, cmd, "dist");
+INIT_PARAMETERLESS_COMMAND(cmd_loss_token_cmd, cmd, "loss");
 
 /* Commands taking just an int */
 INIT_INT_COMMAND(cmd_rate_token_cmd, cmd, "rate")
+INIT_INT_COMMAND(cmd_pps_token_cmd, cmd, "pps")
 INIT_INT_COMMAND(cmd_churn_token_cmd, cmd, "churn")
 INIT_INT_COMMAND(cmd_run_token_cmd, cmd, "run")
+INIT_INT_COMMAND(cmd_probe_token_cmd, cmd, "probe")
 
 cmdline_parse_token_num_t cmd_int_token_param = TOKEN_NUM_INITIALIZER(struct cmd_int_params, param, RTE_UINT32);
 
 static inline void signal_new_config() {
+  runtime_config.start_tick = now() + START_DELAY_US * clock_scale();
   rte_smp_mb();
   rte_atomic64_inc((rte_atomic64_t *)&runtime_config.update_cnt);
 }
@@ -90,12 +98,25 @@ void cmd_stop() {
 }
 
 void cmd_rate(rate_gbps_t rate) {
-  config.rate                  = rate;
-  runtime_config.rate_per_core = config.rate / config.tx.num_cores;
+  config.rate         = rate;
+  runtime_config.rate = config.rate;
+  runtime_config.mpps = 0;
+  signal_new_config();
+}
+
+void cmd_pps(rate_mpps_t rate) {
+  runtime_config.rate = 0;
+  runtime_config.mpps = rate;
   signal_new_config();
 }
 
 void cmd_churn(churn_fpm_t churn) {
+  // Churned flows change RX queues, and two RX workers would then update the same tracker entry.
+  if (churn > 0 && config.track_flows) {
+    WARNING("Churn is disabled while tracking flows (--track-flows).");
+    return;
+  }
+
   if (churn == 0) {
     runtime_config.flow_ttl = 0;
     signal_new_config();
@@ -105,7 +126,7 @@ void cmd_churn(churn_fpm_t churn) {
   double churn_fps = (double)churn / 60;
   assert(churn_fps != 0);
 
-  time_ns_t flow_ttl = (1e9 * flows.size()) / churn_fps;
+  time_ns_t flow_ttl = (1e9 * get_num_flows()) / churn_fps;
 
   LOG_DEBUG("Flow TTL = %" PRIu64 "ns", flow_ttl);
 
@@ -113,6 +134,16 @@ void cmd_churn(churn_fpm_t churn) {
   signal_new_config();
 }
 
+void cmd_probe(uint32_t interval) {
+  if (!config.latency) {
+    WARNING("Latency probes are disabled (run with --latency).");
+    return;
+  }
+
+  runtime_config.probe_interval = interval;
+  signal_new_config();
+}
+
 void cmd_run(time_s_t duration) {
   signal_new_config();
 
@@ -129,10 +160,13 @@ void cmd_bench() {
   rate_mbps_t high     = BIN_SEARCH_MAX_RATE_Mbps;
   rate_mbps_t rate     = high;
   stats_t stable_stats = {
-      .rx_pkts  = 0,
-      .rx_bytes = 0,
-      .tx_pkts  = 0,
-      .tx_bytes = 0,
+      .rx_pkts    = 0,
+      .rx_bytes   = 0,
+      .tx_pkts    = 0,
+      .tx_bytes   = 0,
+      .tx_backlog = 0,
+      .tx_nombuf  = 0,
+      .tx_conns   = 0,
   };
 
   LOG("Warming up with rate %u Mbps for %u seconds...", BIN_SEARCH_WARMUP_RATE_Mbps, BIN_SEARCH_WARMUP_DURATION_S);
@@ -205,6 +239,10 @@ static void cmd_dist_callback(__rte_unused void *ptr_params, __rte_unused struct
   cmd_dist_display();
 }
 
+static void cmd_loss_callback(__rte_unused void *ptr_params, __rte_unused struct cmdline *ctx, __rte_unused void *ptr_data) {
+  cmd_loss_display();
+}
+
 static void cmd_stats_reset_callback(__rte_unused void *ptr_params, __rte_unused struct cmdline *ctx, __rte_unused void *ptr_data) {
   cmd_stats_reset();
 }
@@ -219,6 +257,12 @@ static void cmd_rate_callback(__rte_unused void *ptr_params, __rte_unused struct
   cmd_rate(rate);
 }
 
+static void cmd_pps_callback(__rte_unused void *ptr_params, __rte_unused struct cmdline *ctx, __rte_unused void *ptr_data) {
+  struct cmd_int_params *params = (struct cmd_int_params *)ptr_params;
+  rate_mpps_t rate              = (double)params->param / 1e6;
+  cmd_pps(rate);
+}
+
 static void cmd_churn_callback(__rte_unused void *ptr_params, __rte_unused struct cmdline *ctx, __rte_unused void *ptr_data) {
   struct cmd_int_params *params = (struct cmd_int_params *)ptr_params;
   churn_fpm_t churn             = (double)params->param;
@@ -231,6 +275,11 @@ static void cmd_run_callback(__rte_unused void *ptr_params, __rte_unused struct
   cmd_run(time);
 }
 
+static void cmd_probe_callback(__rte_unused void *ptr_params, __rte_unused struct cmdline *ctx, __rte_unused void *ptr_data) {
+  struct cmd_int_params *params = (struct cmd_int_params *)ptr_params;
+  cmd_probe(params->param);
+}
+
 CMDLINE_PARSE_INT_NTOKENS(1)
 cmd_quit_cmd = {
     .f        = cmd_quit_callback,
@@ -279,6 +328,14 @@ cmd_dist_cmd = {
     .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_dist_token_cmd, NULL},
 };
 
+CMDLINE_PARSE_INT_NTOKENS(1)
+cmd_loss_cmd = {
+    .f        = cmd_loss_callback,
+    .data     = NULL,
+    .help_str = "loss\n     Show per-flow loss, reordering and duplicates",
+    .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_loss_token_cmd, NULL},
+};
+
 CMDLINE_PARSE_INT_NTOKENS(1)
 cmd_stats_reset_cmd = {
     .f        = cmd_stats_reset_callback,
@@ -303,6 +360,14 @@ cmd_rate_cmd = {
     .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_rate_token_cmd, (cmdline_parse_token_hdr_t *)&cmd_int_token_param, NULL},
 };
 
+CMDLINE_PARSE_INT_NTOKENS(2)
+cmd_pps_cmd = {
+    .f        = cmd_pps_callback,
+    .data     = NULL,
+    .help_str = "pps <rate>\n     Set rate in packets per second",
+    .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_pps_token_cmd, (cmdline_parse_token_hdr_t *)&cmd_int_token_param, NULL},
+};
+
 CMDLINE_PARSE_INT_NTOKENS(2)
 cmd_churn_cmd = {
     .f        = cmd_churn_callback,
@@ -319,11 +384,20 @@ cmd_run_cmd = {
     .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_run_token_cmd, (cmdline_parse_token_hdr_t *)&cmd_int_token_param, NULL},
 };
 
+CMDLINE_PARSE_INT_NTOKENS(2)
+cmd_probe_cmd = {
+    .f        = cmd_probe_callback,
+    .data     = NULL,
+    .help_str = "probe <interval>\n     Send a latency probe every <interval> packets (0 to disable)",
+    .tokens   = {(cmdline_parse_token_hdr_t *)&cmd_probe_token_cmd, (cmdline_parse_token_hdr_t *)&cmd_int_token_param, NULL},
+};
+
 cmdline_parse_ctx_t list_prompt_commands[] = {
     (cmdline_parse_inst_t *)&cmd_quit_cmd,  (cmdline_parse_inst_t *)&cmd_start_cmd,       (cmdline_parse_inst_t *)&cmd_stop_cmd,
     (cmdline_parse_inst_t *)&cmd_stats_cmd, (cmdline_parse_inst_t *)&cmd_stats_reset_cmd, (cmdline_parse_inst_t *)&cmd_flows_cmd,
     (cmdline_parse_inst_t *)&cmd_dist_cmd,  (cmdline_parse_inst_t *)&cmd_rate_cmd,        (cmdline_parse_inst_t *)&cmd_churn_cmd,
-    (cmdline_parse_inst_t *)&cmd_run_cmd,   (cmdline_parse_inst_t *)&cmd_bench_cmd,       NULL,
+    (cmdline_parse_inst_t *)&cmd_run_cmd,   (cmdline_parse_inst_t *)&cmd_bench_cmd,       (cmdline_parse_inst_t *)&cmd_probe_cmd,
+    (cmdline_parse_inst_t *)&cmd_loss_cmd,  (cmdline_parse_inst_t *)&cmd_pps_cmd,         NULL,
 };
 
 void cmdline_start() {
@@ -1,14 +1,20 @@
 #pragma once
 
 #include "types.h"
+#include "clock.h"
 
 struct runtime_config_t {
   bool running;
   uint64_t update_cnt;
+  // Time base shared by all TX workers, set on every update.
+  ticks_t start_tick;
 
-  // Information for each TX worker
-  rate_gbps_t rate_per_core;
+  // Total rate, split among the TX workers by config.tx.core_rate_shares. Either rate or mpps is set, whichever target was given last.
+  rate_gbps_t rate;
+  rate_mpps_t mpps;
   time_ns_t flow_ttl;
+  // One in every probe_interval packets is a latency probe (0 disables them).
+  uint32_t probe_interval;
 };
 
 void cmdline_start();
@@ -16,7 +22,9 @@ void cmd_binsearch();
 void cmd_start();
 void cmd_stop();
 void cmd_rate(rate_gbps_t rate);
+void cmd_pps(rate_mpps_t rate);
 void cmd_churn(churn_fpm_t churn);
 void cmd_timer(time_s_t time);
+void cmd_probe(uint32_t interval);
 
 extern struct runtime_config_t runtime_config;
@@ -6,9 +6,18 @@
 #include <stdlib.h>
 #include <time.h>
 
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 #include "config.h"
 #include "log.h"
 #include "cmdline.h"
+#include "packet.h"
+#include "workload.h"
+#include "sync.h"
 
 struct config_t config;
 
@@ -18,28 +27,122 @@ struct config_t config;
 #define DEFAULT_PKT_SIZE MIN_PKT_SIZE
 #define DEFAULT_TOTAL_FLOWS 10000
 #define DEFAULT_ZIPF_PARAM 1.26
+#define DEFAULT_ZIPF_SEQ_LEN_PER_FLOW 10
 #define DEFAULT_KVS_GET_RATIO 0.0
 
+// Comma separated flag names (e.g. "psh,ack"), as in tcpdump.
+static uint8_t parse_tcp_flags(const std::string &flags_str) {
+  const std::pair<const char *, uint8_t> names[] = {
+      {"fin", RTE_TCP_FIN_FLAG}, {"syn", RTE_TCP_SYN_FLAG}, {"rst", RTE_TCP_RST_FLAG}, {"psh", RTE_TCP_PSH_FLAG},
+      {"ack", RTE_TCP_ACK_FLAG}, {"urg", RTE_TCP_URG_FLAG}, {"ece", RTE_TCP_ECE_FLAG}, {"cwr", RTE_TCP_CWR_FLAG},
+  };
+
+  uint8_t flags = 0;
+  std::stringstream ss(flags_str);
+  std::string name;
+  while (std::getline(ss, name, ',')) {
+    bool found = false;
+    for (const auto &[flag_name, flag] : names) {
+      if (name == flag_name) {
+        flags |= flag;
+        found = true;
+      }
+    }
+    if (!found) {
+      rte_exit(EXIT_FAILURE, "Unknown TCP flag \"%s\" (expected fin, syn, rst, psh, ack, urg, ece or cwr).\n", name.c_str());
+    }
+  }
+
+  return flags;
+}
+
+struct tx_map_entry_t {
+  uint32_t lcore;
+  uint32_t port;
+  uint32_t queue;
+};
+
+// Comma separated <lcore>:<port>:<queue> entries, one per TX core.
+static std::vector<tx_map_entry_t> parse_tx_map(const std::string &map_str) {
+  std::vector<tx_map_entry_t> entries;
+  std::stringstream ss(map_str);
+  std::string entry_str;
+  while (std::getline(ss, entry_str, ',')) {
+    tx_map_entry_t entry;
+    char trailing;
+    if (sscanf(entry_str.c_str(), "%u:%u:%u%c", &entry.lcore, &entry.port, &entry.queue, &trailing) != 3) {
+      rte_exit(EXIT_FAILURE, "Invalid TX map entry \"%s\" (expected <lcore>:<port>:<queue>).\n", entry_str.c_str());
+    }
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+// Every lcore must be a worker one, and every port must have its queues numbered from 0, without gaps.
+static void check_tx_map(const std::vector<tx_map_entry_t> &tx_map, unsigned nb_devices) {
+  for (size_t i = 0; i < tx_map.size(); i++) {
+    const tx_map_entry_t &entry = tx_map[i];
+    if (entry.lcore >= RTE_MAX_LCORE || !rte_lcore_is_enabled(entry.lcore) || entry.lcore == rte_get_main_lcore()) {
+      rte_exit(EXIT_FAILURE, "TX map entry %u:%u:%u is not on a worker lcore of the EAL.\n", entry.lcore, entry.port, entry.queue);
+    }
+    if (entry.port >= nb_devices) {
+      rte_exit(EXIT_FAILURE, "Invalid TX device in TX map: requested %u but only %u available.\n", entry.port, nb_devices);
+    }
+
+    uint32_t port_queues = 0;
+    for (size_t j = 0; j < tx_map.size(); j++) {
+      const tx_map_entry_t &other = tx_map[j];
+      port_queues += (other.port == entry.port);
+      if (j != i && (other.lcore == entry.lcore || (other.port == entry.port && other.queue == entry.queue))) {
+        rte_exit(EXIT_FAILURE, "TX map entries %u:%u:%u and %u:%u:%u share an lcore or a queue.\n", entry.lcore, entry.port, entry.queue,
+                 other.lcore, other.port, other.queue);
+      }
+    }
+    if (entry.queue >= port_queues) {
+      rte_exit(EXIT_FAILURE, "TX map entry %u:%u:%u leaves a gap: port %u has %u cores, so its queues go from 0 to %u.\n", entry.lcore,
+               entry.port, entry.queue, entry.port, port_queues, port_queues - 1);
+    }
+  }
+}
+
 void config_init(int argc, char **argv) {
   config.seed               = (uint64_t)time(NULL);
   config.test_and_exit      = false;
   config.num_flows          = DEFAULT_TOTAL_FLOWS;
   config.dist               = UNIFORM;
   config.zipf_param         = DEFAULT_ZIPF_PARAM;
+  config.zipf_seq_len       = 0;
+  config.zipf_cover         = false;
+  config.stream_dist        = false;
+  config.pack_seq           = false;
   config.force_unique_flows = false;
+  config.ipv6               = false;
+  config.proto              = IPPROTO_UDP;
+  config.tcp_flags          = RTE_TCP_ACK_FLAG;
+  config.tcp_conn_pkts      = std::nullopt;
+  config.tcp_close_rst      = false;
   config.pkt_size           = DEFAULT_PKT_SIZE;
   config.sync_cores         = false;
+  config.sync_tolerance     = 0;
   config.dump_flows_to_file = false;
   config.kvs_mode           = false;
   config.kvs_get_ratio      = DEFAULT_KVS_GET_RATIO;
+  config.latency            = false;
+  config.track_flows        = false;
+  config.workload_threads   = MAX(std::thread::hardware_concurrency(), 1u);
   config.rx.port            = 0;
-  config.tx.port            = 1;
+  config.rx.num_cores       = 0;
+  config.tx.num_ports       = 1;
+  config.tx.ports[0]        = 1;
   config.tx.num_cores       = 1;
 
-  runtime_config.running       = false;
-  runtime_config.update_cnt    = 0;
-  runtime_config.rate_per_core = 0;
-  runtime_config.flow_ttl      = 0;
+  runtime_config.running        = false;
+  runtime_config.update_cnt     = 0;
+  runtime_config.start_tick     = 0;
+  runtime_config.rate           = 0;
+  runtime_config.mpps           = 0;
+  runtime_config.flow_ttl       = 0;
+  runtime_config.probe_interval = DEFAULT_PROBE_INTERVAL;
 
   unsigned nb_devices = rte_eth_dev_count_avail();
   unsigned nb_cores   = rte_lcore_count();
@@ -54,10 +157,12 @@ void config_init(int argc, char **argv) {
   CLI::App app{"pktgen"};
 
   bytes_t pkt_size      = DEFAULT_PKT_SIZE;
-  uint32_t tx_port      = config.tx.port;
+  std::vector<uint32_t> tx_ports = {config.tx.ports[0]};
   uint32_t rx_port      = config.rx.port;
   uint32_t num_tx_cores = config.tx.num_cores;
+  uint32_t num_rx_cores = config.rx.num_cores;
   std::string dist_str  = "uniform";
+  std::string proto_str = "udp";
 
   app.add_flag("--test", config.test_and_exit, "Run test and exit");
   const CLI::Option *total_flows_opt =
@@ -67,12 +172,58 @@ void config_init(int argc, char **argv) {
                                         ->default_val(DEFAULT_PKT_SIZE)
                                         ->check(CLI::Range(MIN_PKT_SIZE, MAX_PKT_SIZE));
 
-  app.add_option("--tx", tx_port, "TX port")->default_val(config.tx.port);
+  const CLI::Option *tx_ports_opt =
+      app.add_option("--tx", tx_ports, "TX ports, comma separated")->delimiter(',')->default_str(std::to_string(config.tx.ports[0]));
   app.add_option("--rx", rx_port, "RX port")->default_val(config.rx.port);
-  app.add_option("--tx-cores", num_tx_cores, "Number of TX cores")->default_val(config.tx.num_cores)->check(CLI::PositiveNumber);
+  const CLI::Option *tx_cores_opt = app.add_option("--tx-cores", num_tx_cores, "Number of TX cores, dealt round robin to the TX ports")
+                                        ->default_val(config.tx.num_cores)
+                                        ->check(CLI::PositiveNumber);
+  std::string tx_map_str;
+  app.add_option("--tx-map", tx_map_str,
+                 "TX core of every TX port queue, as <lcore>:<port>:<queue>, comma separated (instead of --tx and --tx-cores)");
+  std::vector<double> tx_rate_shares;
+  app.add_option("--tx-rate-shares", tx_rate_shares,
+                 "Share of the rate each TX port sends, in the order they are first given, comma separated (default: that of its cores)")
+      ->delimiter(',')
+      ->check(CLI::PositiveNumber);
+  std::vector<double> tx_flow_shares;
+  app.add_option("--tx-flow-shares", tx_flow_shares,
+                 "Share of the flows each TX port sends, a range of its own, in the order they are first given, comma separated (default: "
+                 "every port sends all of them)")
+      ->delimiter(',')
+      ->check(CLI::PositiveNumber);
+  app.add_option("--rx-cores", num_rx_cores, "Number of RX cores (0 to rely on the NIC counters)")
+      ->default_val(config.rx.num_cores)
+      ->check(CLI::NonNegativeNumber);
   app.add_flag("--unique-flows", config.force_unique_flows, "Flows are unique");
+  app.add_flag("--ipv6", config.ipv6, "Generate IPv6 flows (and only replay the IPv6 packets of a pcap)");
+  const CLI::Option *proto_opt =
+      app.add_option("--proto", proto_str, "L4 protocol (udp, tcp)")->default_val("udp")->check(CLI::IsMember({"udp", "tcp"}));
+  std::string tcp_flags_str = "ack";
+  app.add_option("--tcp-flags", tcp_flags_str, "TCP flags, comma separated (of the data packets, with --tcp-conn-pkts)")
+      ->default_val("ack");
+  uint16_t tcp_conn_pkts = 0;
+  CLI::Option *tcp_conn_pkts_opt =
+      app.add_option("--tcp-conn-pkts", tcp_conn_pkts, "Stateful TCP: SYN, this many data packets and FIN/RST per connection")
+          ->check(CLI::Range(0, UINT16_MAX - 2));
+  std::string tcp_close_str = "fin";
+  app.add_option("--tcp-close", tcp_close_str, "How stateful TCP connections end (fin, rst)")
+      ->default_val("fin")
+      ->check(CLI::IsMember({"fin", "rst"}));
+  std::string encap_str;
+  std::string tunnel_src_str = ENCAP_DEFAULT_SRC_IP;
+  std::string tunnel_dst_str = ENCAP_DEFAULT_DST_IP;
+  app.add_option("--encap", encap_str,
+                 "Headers in front of every packet, outermost first (vlan:<vid>, qinq:<s-vid>:<c-vid>, vxlan:<vni>[/<count>], "
+                 "gre[:<key>[/<count>]], gtpu:<teid>[/<count>]), comma separated");
+  app.add_option("--tunnel-src", tunnel_src_str, "Outer source IPv4 address of tunnels")->default_val(ENCAP_DEFAULT_SRC_IP);
+  app.add_option("--tunnel-dst", tunnel_dst_str, "Outer destination IPv4 address of tunnels")->default_val(ENCAP_DEFAULT_DST_IP);
   app.add_option("--seed", config.seed, "Random seed");
-  app.add_flag("--sync-cores", config.sync_cores, "Synchronize cores to replay the pcap in order across all cores");
+  app.add_flag("--sync-cores", config.sync_cores, "Synchronize cores to replay the pcap in order across all cores (at equal rates)");
+  const CLI::Option *sync_tolerance_opt =
+      app.add_option("--sync-tolerance", config.sync_tolerance,
+                     "Entries synced cores may get ahead of the slowest one (default: 4 chunks of 32 entries per TX core)")
+          ->check(CLI::PositiveNumber);
   app.add_flag("--dump-flows-to-file", config.dump_flows_to_file, "Dump flows to pcap file");
   app.add_flag("--kvs-mode", config.kvs_mode, "Enable KVS mode");
   app.add_option("--kvs-get-ratio", config.kvs_get_ratio, "KVS get ratio")->default_val(DEFAULT_KVS_GET_RATIO)->check(CLI::Range(0.0, 1.0));
@@ -81,33 +232,194 @@ void config_init(int argc, char **argv) {
       ->check(CLI::IsMember({"uniform", "zipf"}));
   app.add_option("--zipf-param", config.zipf_param, "Zipf parameter")->default_val(DEFAULT_ZIPF_PARAM)->check(CLI::NonNegativeNumber);
   app.add_option("--pcap", config.pcap_fname, "Pcap file to replay");
+  const CLI::Option *zipf_seq_len_opt =
+      app.add_option("--zipf-seq-len", config.zipf_seq_len, "Entries of the Zipf flow index sequence (default: 10 per flow)")
+          ->check(CLI::PositiveNumber);
+  app.add_flag("--zipf-cover", config.zipf_cover, "Every flow shows up in the Zipf sequence, with exact counts instead of random draws");
+  app.add_flag("--stream-dist", config.stream_dist,
+               "Draw flow indexes on the fly in every TX core, instead of generating the whole sequence beforehand");
+  app.add_option("--workload-threads,--pcap-threads", config.workload_threads, "Threads used to load the pcap or generate the workload")
+      ->default_val(config.workload_threads)
+      ->check(CLI::Range(1, UINT16_MAX));
+
+  double replay_speed = 1.0;
+  CLI::Option *replay_speed_opt =
+      app.add_option("--replay-speed", replay_speed, "Replay the pcap with its own timing, sped up by this factor (0 for max speed)")
+          ->check(CLI::NonNegativeNumber);
+  app.add_flag("--latency", config.latency, "Measure latency with probes embedded in the payload (requires RX cores)");
+  app.add_flag("--track-flows", config.track_flows, "Track per-flow loss, reordering and duplicates (requires RX cores)");
 
   uint32_t logical_batch_size = 0;
   CLI::Option *logical_batch_size_opt =
       app.add_option("--logical-batch-size", logical_batch_size, "Sort flow index sequence in batches of this size")
           ->check(CLI::PositiveNumber);
 
+  app.add_flag("--pack-seq", config.pack_seq, "Keep flow index sequences block-compressed in memory, unpacked by the TX cores");
+
+  app.add_option("--load-workload", config.load_workload_fname, "Start from a precompiled workload instead of generating one");
+  app.add_option("--save-workload", config.save_workload_fname, "Save the workload, to be loaded back with --load-workload");
+
   try {
     app.parse(argc, argv);
   } catch (const CLI::ParseError &e) {
     exit(app.exit(e));
   }
 
+  // An explicit map brings its own ports, in the order they first show up in it, and cores.
+  std::vector<tx_map_entry_t> tx_map;
+  if (!tx_map_str.empty()) {
+    if (tx_ports_opt->count() > 0 || tx_cores_opt->count() > 0) {
+      rte_exit(EXIT_FAILURE, "The TX map (--tx-map) already gives the TX ports and cores, drop --tx and --tx-cores.\n");
+    }
+    tx_map = parse_tx_map(tx_map_str);
+    check_tx_map(tx_map, nb_devices);
+    tx_ports.clear();
+    for (const tx_map_entry_t &entry : tx_map) {
+      if (std::find(tx_ports.begin(), tx_ports.end(), entry.port) == tx_ports.end()) {
+        tx_ports.push_back(entry.port);
+      }
+    }
+    num_tx_cores = tx_map.size();
+  }
+
+  for (size_t i = 0; i < tx_ports.size(); i++) {
+    if (tx_ports[i] >= nb_devices) {
+      rte_exit(EXIT_FAILURE, "Invalid TX device: requested %u but only %u available.\n", tx_ports[i], nb_devices);
+    }
+    if (std::find(tx_ports.begin(), tx_ports.begin() + i, tx_ports[i]) != tx_ports.begin() + i) {
+      rte_exit(EXIT_FAILURE, "TX port %u is given twice.\n", tx_ports[i]);
+    }
+  }
+  if (num_tx_cores < tx_ports.size()) {
+    rte_exit(EXIT_FAILURE, "Every TX port needs a TX core of its own (%zu ports, but %u TX cores).\n", tx_ports.size(), num_tx_cores);
+  }
+  if (!tx_rate_shares.empty() && tx_rate_shares.size() != tx_ports.size()) {
+    rte_exit(EXIT_FAILURE, "There are %zu TX rate shares (--tx-rate-shares), but %zu TX ports.\n", tx_rate_shares.size(),
+             tx_ports.size());
+  }
+  if (!tx_flow_shares.empty() && tx_flow_shares.size() != tx_ports.size()) {
+    rte_exit(EXIT_FAILURE, "There are %zu TX flow shares (--tx-flow-shares), but %zu TX ports.\n", tx_flow_shares.size(),
+             tx_ports.size());
+  }
+
   config.pkt_size           = pkt_size;
-  config.tx.port            = (uint16_t)tx_port;
+  config.tx.num_ports       = (uint16_t)tx_ports.size();
   config.rx.port            = (uint16_t)rx_port;
   config.tx.num_cores       = (uint16_t)num_tx_cores;
+  config.rx.num_cores       = (uint16_t)num_rx_cores;
   config.dist               = (dist_str == "zipf") ? ZIPF : UNIFORM;
+  config.proto              = (proto_str == "tcp") ? IPPROTO_TCP : IPPROTO_UDP;
+  config.tcp_flags          = parse_tcp_flags(tcp_flags_str);
+  config.tcp_conn_pkts      = tcp_conn_pkts_opt->count() > 0 ? std::optional<uint16_t>{tcp_conn_pkts} : std::nullopt;
+  config.tcp_close_rst      = (tcp_close_str == "rst");
+  config.encap              = parse_encap(encap_str, tunnel_src_str, tunnel_dst_str);
   config.logical_batch_size = logical_batch_size_opt->count() > 0 ? std::optional<uint32_t>{logical_batch_size} : std::nullopt;
+  config.replay_speed       = replay_speed_opt->count() > 0 ? std::optional<double>{replay_speed} : std::nullopt;
 
-  if (tx_port >= nb_devices) {
-    rte_exit(EXIT_FAILURE, "Invalid TX device: requested %u but only %u available.\n", tx_port, nb_devices);
+  // The workload brings along the parameters it was generated with, and they take the place of those given here.
+  if (!config.load_workload_fname.empty()) {
+    const workload_params_t params = read_workload_params(config.load_workload_fname);
+
+    const char *workload_opts[] = {"--seed",         "--total-flows", "--dist", "--zipf-param", "--zipf-seq-len",      "--zipf-cover",
+                                   "--unique-flows", "--pcap",        "--ipv6", "--kvs-mode",   "--logical-batch-size"};
+    for (const char *opt : workload_opts) {
+      if (app.count(opt) > 0) {
+        WARNING("*************************************************************************");
+        WARNING("%s is given, but so is --load-workload. Using the value the workload was generated with.", opt);
+        WARNING("*************************************************************************");
+      }
+    }
+
+    config.seed               = params.seed;
+    config.num_flows          = params.num_flows;
+    config.dist               = (traffic_dist_t)params.dist;
+    config.zipf_param         = params.zipf_param;
+    config.zipf_seq_len       = params.zipf_seq_len;
+    config.zipf_cover         = params.zipf_cover;
+    config.force_unique_flows = params.force_unique_flows;
+    config.kvs_mode           = params.kvs_mode;
+    config.ipv6               = params.ipv6;
+    config.pcap_fname         = params.pcap_fname;
+    config.logical_batch_size = params.logical_batch_size > 0 ? std::optional<uint32_t>{params.logical_batch_size} : std::nullopt;
   }
+
   if (rx_port >= nb_devices) {
     rte_exit(EXIT_FAILURE, "Invalid RX device: requested %u but only %u available.\n", rx_port, nb_devices);
   }
-  if (num_tx_cores >= nb_cores) {
-    rte_exit(EXIT_FAILURE, "Insufficient number of cores (main=1, tx=%u, available=%u).\n", num_tx_cores, nb_cores);
+  if (num_tx_cores + num_rx_cores >= nb_cores) {
+    rte_exit(EXIT_FAILURE, "Insufficient number of cores (main=1, tx=%u, rx=%u, available=%u).\n", num_tx_cores, num_rx_cores,
+             nb_cores);
+  }
+
+  if (config.latency && num_rx_cores == 0) {
+    rte_exit(EXIT_FAILURE, "Latency measurement requires at least one RX core (--rx-cores).\n");
+  }
+  if (config.replay_speed.has_value() && config.pcap_fname.empty()) {
+    rte_exit(EXIT_FAILURE, "Replaying with the trace timing (--replay-speed) requires a pcap file (--pcap).\n");
+  }
+  if (config.replay_speed.has_value() && config.sync_cores) {
+    rte_exit(EXIT_FAILURE, "Replaying with the trace timing (--replay-speed) already keeps cores in sync, drop --sync-cores.\n");
+  }
+  if (config.track_flows && num_rx_cores == 0) {
+    rte_exit(EXIT_FAILURE, "Flow tracking requires at least one RX core (--rx-cores).\n");
+  }
+  if (config.load_workload_fname.empty() && zipf_seq_len_opt->count() == 0) {
+    config.zipf_seq_len = (uint32_t)MIN((uint64_t)config.num_flows * DEFAULT_ZIPF_SEQ_LEN_PER_FLOW, (uint64_t)UINT32_MAX);
+  }
+  if (config.zipf_cover && config.zipf_seq_len < config.num_flows) {
+    rte_exit(EXIT_FAILURE, "A Zipf sequence covering every flow (--zipf-cover) needs at least as many entries as flows (%" PRIu32
+                           "), but --zipf-seq-len is %" PRIu32 ".\n",
+             config.num_flows, config.zipf_seq_len);
+  }
+  if (config.stream_dist) {
+    if (!config.pcap_fname.empty()) {
+      rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) is only for generated traffic, drop --pcap.\n");
+    }
+    if (!config.load_workload_fname.empty() || !config.save_workload_fname.empty()) {
+      rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) leaves no sequence to load or save, drop --load-workload "
+                             "and --save-workload.\n");
+    }
+    if (config.sync_cores) {
+      rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) leaves no shared sequence to sync cores on, drop "
+                             "--sync-cores.\n");
+    }
+    if (config.zipf_cover || config.logical_batch_size.has_value()) {
+      rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) only takes independent draws, drop --zipf-cover and "
+                             "--logical-batch-size.\n");
+    }
+  }
+  if (sync_tolerance_opt->count() > 0 && !config.sync_cores) {
+    rte_exit(EXIT_FAILURE, "The tolerance of synced cores (--sync-tolerance) requires --sync-cores.\n");
+  }
+  if (sync_tolerance_opt->count() == 0) {
+    config.sync_tolerance = (uint64_t)SYNC_DEFAULT_TOLERANCE_CHUNKS * SYNC_CHUNK_SIZE * num_tx_cores;
+  }
+  if (!tx_flow_shares.empty() && config.sync_cores) {
+    rte_exit(EXIT_FAILURE, "Synced cores (--sync-cores) walk the whole sequence together, drop --tx-flow-shares.\n");
+  }
+  if (!tx_flow_shares.empty() && config.stream_dist) {
+    rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) draws from all flows, drop --tx-flow-shares.\n");
+  }
+  if (config.pack_seq && config.sync_cores) {
+    rte_exit(EXIT_FAILURE, "Packed sequences (--pack-seq) are only walked in order, by one worker each, drop --sync-cores.\n");
+  }
+  if (config.pack_seq && config.stream_dist) {
+    rte_exit(EXIT_FAILURE, "Drawing flow indexes on the fly (--stream-dist) leaves no sequence to pack, drop --pack-seq.\n");
+  }
+  if (config.kvs_mode && config.ipv6) {
+    rte_exit(EXIT_FAILURE, "KVS mode only sends IPv4 packets, drop --ipv6.\n");
+  }
+  if (config.kvs_mode && config.proto == IPPROTO_TCP) {
+    rte_exit(EXIT_FAILURE, "KVS mode only sends UDP packets, drop --proto tcp.\n");
+  }
+  if (config.kvs_mode && encap_has_tunnel(config.encap)) {
+    rte_exit(EXIT_FAILURE, "KVS mode does not send its packets through tunnels, drop the tunnel from --encap.\n");
+  }
+  if (tcp_conns_enabled() && config.proto != IPPROTO_TCP) {
+    rte_exit(EXIT_FAILURE, "Stateful TCP (--tcp-conn-pkts) requires --proto tcp.\n");
+  }
+  if (tcp_conns_enabled() && !config.pcap_fname.empty()) {
+    rte_exit(EXIT_FAILURE, "Stateful TCP (--tcp-conn-pkts) generates its own connections, drop --pcap.\n");
   }
 
   rte_srand(config.seed);
@@ -123,15 +435,111 @@ void config_init(int argc, char **argv) {
     config.pkt_size = MAX(KVS_PKT_SIZE_BYTES, MIN_PKT_SIZE);
   }
 
-  if (!config.pcap_fname.empty() && total_flows_opt->count() > 0) {
+  // IPv6 headers, and encapsulated ones, do not fit in the smallest Ethernet frames.
+  const bytes_t min_hdrs_pkt_size = get_probe_offset(config.kvs_mode, config.proto, config.ipv6) + RTE_ETHER_CRC_LEN;
+  if (config.pkt_size < min_hdrs_pkt_size) {
+    WARNING("*************************************************************************");
+    WARNING("Packet size is set to %" PRIu64 " bytes, but its headers require at least %" PRIu64 " bytes.", config.pkt_size,
+            min_hdrs_pkt_size);
+    WARNING("Overriding packet size to %" PRIu64 " bytes.", min_hdrs_pkt_size);
+    WARNING("*************************************************************************");
+    config.pkt_size = min_hdrs_pkt_size;
+  }
+
+  // The probe header has to fit in the payload.
+  const bytes_t min_probe_pkt_size = get_probe_offset(config.kvs_mode, config.proto, config.ipv6) + sizeof(probe_hdr_t) + RTE_ETHER_CRC_LEN;
+  if (probe_hdr_enabled() && config.pkt_size < min_probe_pkt_size) {
+    WARNING("*************************************************************************");
+    WARNING("Packet size is set to %" PRIu64 " bytes, but probe headers require at least %" PRIu64 " bytes.", config.pkt_size,
+            min_probe_pkt_size);
+    WARNING("Overriding packet size to %" PRIu64 " bytes.", min_probe_pkt_size);
+    WARNING("*************************************************************************");
+    config.pkt_size = min_probe_pkt_size;
+  }
+
+  if (pcap_templates_enabled() && pkt_size_opt->count() > 0) {
+    WARNING("*************************************************************************");
+    WARNING("Packet size is set to %" PRIu64 " bytes, but packets from the pcap keep their own sizes. Ignoring the packet size option.",
+            config.pkt_size);
+    WARNING("*************************************************************************");
+  }
+
+  if (!config.pcap_fname.empty() && proto_opt->count() > 0) {
+    WARNING("*************************************************************************");
+    WARNING("Protocol is set to %s, but packets from the pcap keep their own. Ignoring the protocol option.", proto_str.c_str());
+    WARNING("*************************************************************************");
+  }
+
+  if (!config.pcap_fname.empty() && config.load_workload_fname.empty() && total_flows_opt->count() > 0) {
     WARNING("*************************************************************************");
     WARNING("Total flows is set to %" PRIu32 ", but --pcap option is given. Ignoring the total flows option.", config.num_flows);
     WARNING("*************************************************************************");
   }
 
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    config.tx.ports[i] = (uint16_t)tx_ports[i];
+  }
+
+  // TX cores come first, dealt round robin to the TX ports, and RX cores take the following ones. With a TX map, RX cores take the
+  // first ones it leaves out.
   unsigned idx = 0;
   unsigned lcore_id;
-  RTE_LCORE_FOREACH_WORKER(lcore_id) { config.tx.cores[idx++] = lcore_id; }
+  if (tx_map.empty()) {
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+      if (idx < config.tx.num_cores) {
+        config.tx.cores[idx]       = lcore_id;
+        config.tx.core_ports[idx]  = config.tx.ports[idx % config.tx.num_ports];
+        config.tx.core_queues[idx] = idx / config.tx.num_ports;
+      } else if (idx < config.tx.num_cores + config.rx.num_cores) {
+        config.rx.cores[idx - config.tx.num_cores] = lcore_id;
+      }
+      idx++;
+    }
+  } else {
+    for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+      config.tx.cores[i]       = tx_map[i].lcore;
+      config.tx.core_ports[i]  = tx_map[i].port;
+      config.tx.core_queues[i] = tx_map[i].queue;
+    }
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+      const bool tx_core =
+          std::any_of(tx_map.begin(), tx_map.end(), [lcore_id](const tx_map_entry_t &entry) { return entry.lcore == lcore_id; });
+      if (!tx_core && idx < config.rx.num_cores) {
+        config.rx.cores[idx++] = lcore_id;
+      }
+    }
+  }
+
+  // Ports get as much of the rate as they have cores, unless told otherwise.
+  double total_share = 0;
+  for (double share : tx_rate_shares) {
+    total_share += share;
+  }
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    const uint16_t port_idx       = std::find(tx_ports.begin(), tx_ports.end(), config.tx.core_ports[i]) - tx_ports.begin();
+    const uint16_t port_queues    = get_tx_port_num_queues(config.tx.core_ports[i]);
+    const double port_share       = tx_rate_shares.empty() ? (double)port_queues / config.tx.num_cores
+                                                           : tx_rate_shares[port_idx] / total_share;
+    config.tx.core_rate_shares[i] = port_share / port_queues;
+  }
+
+  // Synced cores stride through the sequence at the same pace, so any of them sending slower holds back all the others.
+  for (uint16_t i = 0; i < config.tx.num_cores && config.sync_cores; i++) {
+    if (std::fabs(config.tx.core_rate_shares[i] * config.tx.num_cores - 1) > 1e-9) {
+      rte_exit(EXIT_FAILURE, "Synced cores (--sync-cores) send at equal rates, but --tx-rate-shares gives cores of port %" PRIu16
+                             " %.1f%% of the rate instead of %.1f%%.\n",
+               config.tx.core_ports[i], 100 * config.tx.core_rate_shares[i], 100.0 / config.tx.num_cores);
+    }
+  }
+
+  double total_flow_share = 0;
+  for (double share : tx_flow_shares) {
+    total_flow_share += share;
+  }
+  config.tx.split_flows = !tx_flow_shares.empty();
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    config.tx.port_flow_shares[i] = config.tx.split_flows ? tx_flow_shares[i] / total_flow_share : 1;
+  }
 }
 
 void config_print() {
@@ -139,27 +547,82 @@ void config_print() {
 
   LOG("\n----- Config -----");
   LOG("RX port:          %" PRIu16, config.rx.port);
-  LOG("TX port:          %" PRIu16, config.tx.port);
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    const uint16_t port = config.tx.ports[i];
+    double port_share   = 0;
+    for (uint16_t j = 0; j < config.tx.num_cores; j++) {
+      port_share += (config.tx.core_ports[j] == port) ? config.tx.core_rate_shares[j] : 0;
+    }
+    if (config.tx.split_flows) {
+      LOG("TX port:          %" PRIu16 " (%" PRIu16 " queues, %.1f%% of the rate, %.1f%% of the flows)", port, get_tx_port_num_queues(port),
+          100 * port_share, 100 * config.tx.port_flow_shares[i]);
+    } else {
+      LOG("TX port:          %" PRIu16 " (%" PRIu16 " queues, %.1f%% of the rate)", port, get_tx_port_num_queues(port), 100 * port_share);
+    }
+  }
   LOG("TX cores:         %" PRIu16, config.tx.num_cores);
+  LOG("RX cores:         %" PRIu16, config.rx.num_cores);
   LOG("Random seed:      %" PRIu64, config.seed);
-  LOG("Packet size:      %" PRIu64 " bytes", config.pkt_size);
+  if (pcap_templates_enabled()) {
+    LOG("Packet size:      from pcap");
+  } else {
+    LOG("Packet size:      %" PRIu64 " bytes", config.pkt_size);
+  }
+  if (config.pcap_fname.empty()) {
+    LOG("Protocol:         %s", config.proto == IPPROTO_TCP ? "tcp" : "udp");
+  }
+  if (config.proto == IPPROTO_TCP) {
+    LOG("TCP flags:        0x%02" PRIx8, config.tcp_flags);
+    if (tcp_conns_enabled()) {
+      LOG("TCP connections:  SYN, %" PRIu16 " data packets, %s", config.tcp_conn_pkts.value(), config.tcp_close_rst ? "RST" : "FIN");
+    } else {
+      LOG("TCP connections:  disabled");
+    }
+  }
   LOG("Dump flows:       %s", config.dump_flows_to_file ? "true" : "false");
-  LOG("Sync cores:       %s", config.sync_cores ? "true" : "false");
+  if (config.sync_cores) {
+    LOG("Sync cores:       true (tolerance %" PRIu64 " entries)", config.sync_tolerance);
+  } else {
+    LOG("Sync cores:       false");
+  }
+  LOG("Latency probes:   %s", config.latency ? "true" : "false");
+  LOG("Track flows:      %s", config.track_flows ? "true" : "false");
   if (config.logical_batch_size.has_value()) {
     LOG("Logical batch:    %" PRIu32, config.logical_batch_size.value());
   } else {
     LOG("Logical batch:    disabled");
   }
+  LOG("Packed sequence:  %s", config.pack_seq ? "true" : "false");
 
+  if (!config.load_workload_fname.empty()) {
+    LOG("Workload:         %s", config.load_workload_fname.c_str());
+  }
+  if (!config.save_workload_fname.empty()) {
+    LOG("Save workload:    %s", config.save_workload_fname.c_str());
+  }
+
+  LOG("Workload threads: %" PRIu16, config.workload_threads);
+  LOG("IPv6:             %s", config.ipv6 ? "true" : "false");
+  LOG("Encapsulation:    %s", encap_to_string(config.encap).c_str());
   if (config.pcap_fname.empty()) {
     LOG("Flows:            %" PRIu32, config.num_flows);
     LOG("Traffic dist:     %s", traffic_dist_str);
     LOG("Zipf param:       %lf", config.zipf_param);
+    if (config.stream_dist) {
+      LOG("Flow indexes:     drawn on the fly by every TX core");
+    } else {
+      LOG("Zipf sequence:    %" PRIu32 " entries%s", config.zipf_seq_len, config.zipf_cover ? ", covering every flow" : "");
+    }
     LOG("Unique flows:     %s", config.force_unique_flows ? "true" : "false");
     LOG("KVS mode:         %s", config.kvs_mode ? "true" : "false");
     LOG("KVS get ratio:    %lf", config.kvs_get_ratio);
   } else {
     LOG("Pcap file:        %s", config.pcap_fname.c_str());
+    if (config.replay_speed.has_value()) {
+      LOG("Replay speed:     %lfx", config.replay_speed.value());
+    } else {
+      LOG("Replay speed:     disabled");
+    }
   }
 
   LOG("------------------\n");
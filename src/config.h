@@ -1,6 +1,7 @@
 #pragma once
 
 #include "types.h"
+#include "encap.h"
 
 #include <optional>
 #include <string>
@@ -16,29 +17,95 @@ struct config_t {
   enum traffic_dist_t dist;
   double zipf_param;
   bool force_unique_flows;
+  // Entries of Zipf flow index sequences, which cover every flow at least once if zipf_cover (and may miss some otherwise).
+  uint32_t zipf_seq_len;
+  bool zipf_cover;
+  // Every TX worker draws flow indexes on the fly from its own stream, instead of walking a sequence generated beforehand.
+  bool stream_dist;
+  // Flows are IPv6 instead of IPv4. Pcaps are then replayed from their IPv6 packets only.
+  bool ipv6;
   bytes_t pkt_size;
+  // L4 protocol of generated packets (IPPROTO_UDP/IPPROTO_TCP). Packets from pcaps keep their own.
+  uint8_t proto;
+  // Flags of TCP packets, or of the data packets of stateful connections.
+  uint8_t tcp_flags;
+  // Stateful TCP: flows carry connections of a SYN, this many data packets and a FIN (or RST if tcp_close_rst), one after the other.
+  std::optional<uint16_t> tcp_conn_pkts;
+  bool tcp_close_rst;
+  // Headers stacked in front of every packet (VLAN tags, tunnels). Frame sizes include them.
+  encap_t encap;
   std::string pcap_fname;
+  // Threads used to build the workload (loading the pcap, or generating the flow index sequence), before any worker starts.
+  uint16_t workload_threads;
+  // Replay the pcap with its own timing, sped up by this factor (0 for as fast as possible) instead of at a set rate.
+  std::optional<double> replay_speed;
   std::optional<uint32_t> logical_batch_size;
+  // TX workers keep their flow index sequences block-compressed (see packed_seq.h), and unpack them as they go.
+  bool pack_seq;
+  // Precompiled workload (flows and flow index sequence) to start from instead of generating one, and where to save it to.
+  std::string load_workload_fname;
+  std::string save_workload_fname;
 
   bool sync_cores;
+  // How many entries of the shared sequence synced workers may get ahead of the slowest of them (see sync.h).
+  uint64_t sync_tolerance;
   bool kvs_mode;
   double kvs_get_ratio;
 
+  // Latency probes, sent by the TX workers and timed by the RX workers.
+  bool latency;
+  // Per-flow sequence numbers, checked by the RX workers for loss, reordering and duplicates.
+  bool track_flows;
+
   rate_gbps_t rate;
 
+  // TX workers all send the same workload (or their port's flows of it, if split_flows), each on its own queue of one of the TX ports.
   struct {
-    uint16_t port;
+    uint16_t num_ports;
+    uint16_t ports[RTE_MAX_ETHPORTS];
     uint16_t num_cores;
     uint16_t cores[RTE_MAX_LCORE];
+    // Port and queue each of the cores sends on. Every port has queues 0 to however many cores it has, minus one.
+    uint16_t core_ports[RTE_MAX_LCORE];
+    uint16_t core_queues[RTE_MAX_LCORE];
+    // Share of the total rate each of the cores sends: that of its port, split evenly among the port's cores. They add up to 1.
+    double core_rate_shares[RTE_MAX_LCORE];
+    // Ports send flows of their own instead of all of them: a contiguous range each, this share of the flows (in the order of ports,
+    // adding up to 1). See get_tx_port_flows().
+    bool split_flows;
+    double port_flow_shares[RTE_MAX_ETHPORTS];
   } tx;
 
   struct {
     uint16_t port;
+    // Without RX cores, RX accounting falls back to the NIC counters.
+    uint16_t num_cores;
+    uint16_t cores[RTE_MAX_LCORE];
   } rx;
 };
 
 extern struct config_t config;
 
+// How many TX cores send on the port (and so how many TX queues it has).
+static inline uint16_t get_tx_port_num_queues(uint16_t port) {
+  uint16_t num_queues = 0;
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    num_queues += (config.tx.core_ports[i] == port);
+  }
+  return num_queues;
+}
+
+static inline bool is_tx_port(uint16_t port) { return get_tx_port_num_queues(port) > 0; }
+
+// Whether packets carry a probe header at all.
+static inline bool probe_hdr_enabled() { return config.latency || config.track_flows; }
+
+// Whether packets keep the size and L4 protocol they had in the pcap, instead of all being built from a single template. KVS packets
+// have a fixed format of their own.
+static inline bool pcap_templates_enabled() { return !config.pcap_fname.empty() && !config.kvs_mode; }
+
+static inline bool tcp_conns_enabled() { return config.tcp_conn_pkts.has_value(); }
+
 void config_init(int argc, char **argv);
 void config_print();
 void config_print_usage(char **argv);
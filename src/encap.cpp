@@ -0,0 +1,160 @@
+#include "encap.h"
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+
+#include <rte_common.h>
+
+#include <sstream>
+#include <vector>
+
+// Splits on sep, keeping empty fields (so that "gre:" is told apart from "gre").
+static std::vector<std::string> split(const std::string &str, char sep) {
+  std::vector<std::string> fields;
+  std::stringstream ss(str);
+  std::string field;
+  while (std::getline(ss, field, sep)) {
+    fields.push_back(field);
+  }
+  if (!str.empty() && str.back() == sep) {
+    fields.push_back("");
+  }
+  return fields;
+}
+
+static uint32_t parse_encap_num(const std::string &layer, const std::string &num_str, uint64_t min, uint64_t max) {
+  char *end    = nullptr;
+  uint64_t num = num_str.empty() ? 0 : strtoull(num_str.c_str(), &end, 0);
+  if (num_str.empty() || *end != '\0' || num < min || num > max) {
+    rte_exit(EXIT_FAILURE, "Invalid value \"%s\" in encapsulation layer \"%s\" (expected %" PRIu64 " to %" PRIu64 ").\n",
+             num_str.c_str(), layer.c_str(), min, max);
+  }
+  return (uint32_t)num;
+}
+
+// <id>[/<count>], where the count is how many consecutive ids (from id on) flows are spread over.
+static void parse_tunnel_id(encap_t &encap, const std::string &layer, const std::string &id_str, uint64_t max_id) {
+  const std::vector<std::string> id_count = split(id_str, '/');
+  if (id_count.empty() || id_count.size() > 2) {
+    rte_exit(EXIT_FAILURE, "Invalid tunnel id in encapsulation layer \"%s\" (expected <id>[/<count>]).\n", layer.c_str());
+  }
+
+  encap.tunnel_has_id = true;
+  encap.tunnel_id     = parse_encap_num(layer, id_count[0], 0, max_id);
+
+  // Counts are 32 bits. That takes every id of a 32-bit space but one, which is still more than there can ever be flows.
+  const uint64_t max_count = RTE_MIN(max_id - encap.tunnel_id + 1, (uint64_t)UINT32_MAX);
+  encap.tunnel_id_count    = (id_count.size() == 2) ? parse_encap_num(layer, id_count[1], 1, max_count) : 1;
+}
+
+static rte_be32_t parse_outer_ip(const std::string &ip_str) {
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip_str.c_str(), &addr) != 1) {
+    rte_exit(EXIT_FAILURE, "Invalid tunnel endpoint \"%s\" (expected an IPv4 address).\n", ip_str.c_str());
+  }
+  return addr.s_addr;
+}
+
+encap_t parse_encap(const std::string &stack, const std::string &outer_src_ip, const std::string &outer_dst_ip) {
+  encap_t encap         = {};
+  encap.tunnel          = ENCAP_TUNNEL_NONE;
+  encap.tunnel_id_count = 1;
+  encap.outer_src_ip    = parse_outer_ip(outer_src_ip);
+  encap.outer_dst_ip    = parse_outer_ip(outer_dst_ip);
+
+  if (stack.empty()) {
+    return encap;
+  }
+
+  for (const std::string &layer : split(stack, ',')) {
+    const std::vector<std::string> fields = split(layer, ':');
+    const std::string name                = fields.empty() ? "" : fields[0];
+
+    // Tags only go on the outer Ethernet header, so nothing can come after the tunnel.
+    if (encap_has_tunnel(encap)) {
+      rte_exit(EXIT_FAILURE, "Encapsulation layer \"%s\" comes after the tunnel, but there can only be one, and it goes last.\n",
+               layer.c_str());
+    }
+
+    if (name == "vlan" && fields.size() == 2) {
+      if (encap.num_vlans == ENCAP_MAX_VLANS) {
+        rte_exit(EXIT_FAILURE, "Too many VLAN tags (at most %d).\n", ENCAP_MAX_VLANS);
+      }
+      // A single tag is a plain 802.1Q one, the outer of two an 802.1ad S-tag.
+      encap.vlan_tpids[encap.num_vlans] = RTE_ETHER_TYPE_VLAN;
+      encap.vlan_ids[encap.num_vlans]   = parse_encap_num(layer, fields[1], 0, 4095);
+      encap.num_vlans++;
+      if (encap.num_vlans == 2) {
+        encap.vlan_tpids[0] = RTE_ETHER_TYPE_QINQ;
+      }
+    } else if (name == "qinq" && fields.size() == 3) {
+      if (encap.num_vlans > 0) {
+        rte_exit(EXIT_FAILURE, "Too many VLAN tags (at most %d).\n", ENCAP_MAX_VLANS);
+      }
+      encap.num_vlans     = 2;
+      encap.vlan_tpids[0] = RTE_ETHER_TYPE_QINQ;
+      encap.vlan_ids[0]   = parse_encap_num(layer, fields[1], 0, 4095);
+      encap.vlan_tpids[1] = RTE_ETHER_TYPE_VLAN;
+      encap.vlan_ids[1]   = parse_encap_num(layer, fields[2], 0, 4095);
+    } else if (name == "vxlan" && fields.size() == 2) {
+      encap.tunnel = ENCAP_TUNNEL_VXLAN;
+      parse_tunnel_id(encap, layer, fields[1], (1 << 24) - 1);
+    } else if (name == "gre" && fields.size() <= 2) {
+      encap.tunnel = ENCAP_TUNNEL_GRE;
+      if (fields.size() == 2) {
+        parse_tunnel_id(encap, layer, fields[1], UINT32_MAX);
+      }
+    } else if (name == "gtpu" && fields.size() == 2) {
+      encap.tunnel = ENCAP_TUNNEL_GTPU;
+      parse_tunnel_id(encap, layer, fields[1], UINT32_MAX);
+    } else {
+      rte_exit(EXIT_FAILURE,
+               "Invalid encapsulation layer \"%s\" (expected vlan:<vid>, qinq:<s-vid>:<c-vid>, vxlan:<vni>[/<count>], "
+               "gre[:<key>[/<count>]] or gtpu:<teid>[/<count>]).\n",
+               layer.c_str());
+    }
+  }
+
+  return encap;
+}
+
+std::string encap_to_string(const encap_t &encap) {
+  std::stringstream ss;
+
+  for (int i = 0; i < encap.num_vlans; i++) {
+    ss << (encap.vlan_tpids[i] == RTE_ETHER_TYPE_QINQ ? "802.1ad " : "802.1Q ") << encap.vlan_ids[i] << ", ";
+  }
+
+  switch (encap.tunnel) {
+  case ENCAP_TUNNEL_NONE:
+    break;
+  case ENCAP_TUNNEL_VXLAN:
+    ss << "VXLAN vni ";
+    break;
+  case ENCAP_TUNNEL_GRE:
+    ss << (encap.tunnel_has_id ? "GRE key " : "GRE");
+    break;
+  case ENCAP_TUNNEL_GTPU:
+    ss << "GTP-U teid ";
+    break;
+  }
+  if (encap.tunnel_has_id) {
+    ss << encap.tunnel_id;
+    if (encap.tunnel_id_count > 1) {
+      ss << "-" << (uint64_t)encap.tunnel_id + encap.tunnel_id_count - 1;
+    }
+  }
+  if (encap_has_tunnel(encap)) {
+    char src_ip[INET_ADDRSTRLEN];
+    char dst_ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &encap.outer_src_ip, src_ip, sizeof(src_ip));
+    inet_ntop(AF_INET, &encap.outer_dst_ip, dst_ip, sizeof(dst_ip));
+    ss << " (" << src_ip << " -> " << dst_ip << ")";
+  }
+
+  std::string str = ss.str();
+  if (str.size() >= 2 && str.compare(str.size() - 2, 2, ", ") == 0) {
+    str.resize(str.size() - 2);
+  }
+  return str.empty() ? "none" : str;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_gre.h>
+#include <rte_gtp.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_vxlan.h>
+
+#include "types.h"
+
+// Headers stacked in front of the generated (inner) packet, outermost first: up to two VLAN tags on the outer Ethernet header, then
+// at most one tunnel over IPv4. Without a tunnel the tags go straight in front of the inner IP header.
+//
+// Every field of the stack is constant, except for the tunnel id and the source port of VXLAN, which vary per flow (the port carries
+// the flow entropy ECMP and RSS hash on, as RFC 7348 recommends). The inner flow is the one generated or replayed as usual.
+
+#define ENCAP_MAX_VLANS 2
+
+// Source ports of VXLAN, in the dynamic range.
+#define ENCAP_SPORT_MIN 49152
+#define ENCAP_SPORT_BITS 14
+
+#define ENCAP_DEFAULT_SRC_IP "10.0.0.1"
+#define ENCAP_DEFAULT_DST_IP "10.0.0.2"
+
+#define GTPU_FLAGS 0x30 // Version 1, GTP (not GTP')
+#define GTPU_MSG_TPDU 0xff
+#define GRE_FLAG_KEY 0x2000
+#define VXLAN_FLAG_VNI 0x08000000
+
+// Longest stack there is: QinQ tags, outer IPv4 and UDP, VXLAN and the inner Ethernet header.
+#define ENCAP_MAX_LEN                                                                                                                      \
+  (ENCAP_MAX_VLANS * sizeof(rte_vlan_hdr) + sizeof(rte_ipv4_hdr) + sizeof(rte_udp_hdr) + sizeof(rte_vxlan_hdr) + sizeof(rte_ether_hdr))
+
+enum encap_tunnel_t {
+  ENCAP_TUNNEL_NONE,
+  ENCAP_TUNNEL_VXLAN,
+  ENCAP_TUNNEL_GRE,
+  ENCAP_TUNNEL_GTPU,
+};
+
+struct encap_t {
+  // TPID and VLAN id of each tag, outermost first (an 802.1ad S-tag, then an 802.1Q C-tag for QinQ).
+  uint8_t num_vlans;
+  uint16_t vlan_tpids[ENCAP_MAX_VLANS];
+  uint16_t vlan_ids[ENCAP_MAX_VLANS];
+
+  encap_tunnel_t tunnel;
+  // VNI, GRE key or TEID of flow i: tunnel_id + i % tunnel_id_count. GRE goes without a key unless one is given.
+  bool tunnel_has_id;
+  uint32_t tunnel_id;
+  uint32_t tunnel_id_count;
+
+  rte_be32_t outer_src_ip;
+  rte_be32_t outer_dst_ip;
+};
+
+// Parses a comma separated stack, outermost first, e.g. "vlan:100,vxlan:5000/64". Layers are vlan:<vid>, qinq:<s-vid>:<c-vid>,
+// vxlan:<vni>[/<count>], gre[:<key>[/<count>]] and gtpu:<teid>[/<count>], where a count spreads flows over that many consecutive ids.
+// An empty string is no encapsulation at all. Exits on anything else.
+encap_t parse_encap(const std::string &stack, const std::string &outer_src_ip, const std::string &outer_dst_ip);
+
+std::string encap_to_string(const encap_t &encap);
+
+static inline bool encap_has_tunnel(const encap_t &encap) { return encap.tunnel != ENCAP_TUNNEL_NONE; }
+
+// Whether any field of the stack changes from flow to flow.
+static inline bool encap_per_flow(const encap_t &encap) { return encap.tunnel == ENCAP_TUNNEL_VXLAN || encap.tunnel_id_count > 1; }
+
+// Bytes of the stack: everything between the outer Ethernet header and the inner IP header.
+static inline bytes_t get_encap_len(const encap_t &encap) {
+  bytes_t len = encap.num_vlans * sizeof(rte_vlan_hdr);
+  switch (encap.tunnel) {
+  case ENCAP_TUNNEL_NONE:
+    break;
+  case ENCAP_TUNNEL_VXLAN:
+    len += sizeof(rte_ipv4_hdr) + sizeof(rte_udp_hdr) + sizeof(rte_vxlan_hdr) + sizeof(rte_ether_hdr);
+    break;
+  case ENCAP_TUNNEL_GRE:
+    len += sizeof(rte_ipv4_hdr) + sizeof(rte_gre_hdr) + (encap.tunnel_has_id ? sizeof(rte_be32_t) : 0);
+    break;
+  case ENCAP_TUNNEL_GTPU:
+    len += sizeof(rte_ipv4_hdr) + sizeof(rte_udp_hdr) + sizeof(rte_gtp_hdr);
+    break;
+  }
+  return len;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Hash index over keys stored elsewhere (a vector of flows, usually), for telling whether a key is already among them. Slots only
+// hold where the key is in that vector, and 32 bits of its hash, so they take 8 bytes each, in a single flat array: a fraction of the
+// memory of a node-based std::unordered_map, without the pointer chasing. Open addressing with linear probing, kept at most half
+// full. Keys are never removed.
+//
+// The slot of a key comes from the tag bits of its hash alone, so the index grows without hashing its keys again. Hashes are expected
+// to be well mixed (see flow_hash_t).
+template <typename key_type, typename eq_type> class flat_index_t {
+  static constexpr uint32_t EMPTY = UINT32_MAX;
+
+  struct slot_t {
+    uint32_t tag;
+    uint32_t pos;
+  };
+
+  std::vector<slot_t> slots;
+  uint32_t mask;
+  uint32_t num_keys;
+
+  void rehash(size_t capacity) {
+    std::vector<slot_t> old_slots(capacity, slot_t{0, EMPTY});
+    old_slots.swap(slots);
+    mask = capacity - 1;
+
+    for (const slot_t &slot : old_slots) {
+      if (slot.pos != EMPTY) {
+        uint32_t i = slot.tag & mask;
+        while (slots[i].pos != EMPTY) {
+          i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+      }
+    }
+  }
+
+public:
+  // Sized up front for this many keys, if known. It grows as needed otherwise.
+  explicit flat_index_t(size_t expected_keys = 0) : mask(0), num_keys(0) {
+    size_t capacity = 16;
+    while (capacity < 2 * expected_keys) {
+      capacity *= 2;
+    }
+    rehash(capacity);
+  }
+
+  size_t size() const { return num_keys; }
+
+  // Position of the key in keys, if it is there. Otherwise the key is recorded at pos, where the caller is to put it, and pos is
+  // returned instead.
+  uint32_t find_or_insert(const std::vector<key_type> &keys, const key_type &key, uint64_t hash, uint32_t pos) {
+    if (2 * (num_keys + 1) > slots.size()) {
+      rehash(2 * slots.size());
+    }
+
+    const uint32_t tag = hash >> 32;
+    uint32_t i         = tag & mask;
+    while (slots[i].pos != EMPTY) {
+      if (slots[i].tag == tag && eq_type()(keys[slots[i].pos], key)) {
+        return slots[i].pos;
+      }
+      i = (i + 1) & mask;
+    }
+
+    slots[i] = {tag, pos};
+    num_keys++;
+    return pos;
+  }
+};
@@ -1,11 +1,13 @@
 #include "flows.h"
 
+#include <arpa/inet.h>
+
 #include <rte_common.h>
+#include <rte_malloc.h>
 #include <rte_random.h>
 
 #include <iostream>
 #include <sstream>
-#include <unordered_set>
 #include <vector>
 #include <iomanip>
 #include <cmath>
@@ -14,12 +16,136 @@
 
 #include "log.h"
 #include "random.h"
+#include "flat_index.h"
+#include "parallel.h"
 #include "config.h"
-#include "pcap_reader.h"
+#include "pcap_loader.h"
+#include "packet.h"
+#include "workload.h"
 
 std::vector<flow_t> flows;
-std::unordered_map<flow_t, uint64_t, flow_hash_t, flow_comp_t> flow_to_idx;
-std::vector<uint64_t> flow_idx_seq;
+std::vector<flow6_t> flows6;
+std::vector<kvs_flow_t> kvs_flows;
+std::vector<uint32_t> flow_idx_seq;
+std::vector<uint32_t> flow_idx_gaps;
+std::vector<uint16_t> flow_idx_tmpls;
+std::vector<pkt_template_key_t> pkt_template_keys;
+std::unique_ptr<socket_replica_t> socket_replicas[RTE_MAX_NUMA_NODES];
+size_t num_published_flows = 0;
+std::vector<std::vector<uint32_t>> loaded_flow_idx_seq_per_worker;
+std::vector<packed_seq_t> packed_flow_idx_seq_per_worker;
+
+// What config.stream_dist draws from, if config.dist is ZIPF. Only its replicas are ever sampled.
+static alias_table_t flow_sampler_table;
+
+// Sockets with a replica, so that churning does not go through all of socket_replicas.
+static std::vector<socket_replica_t *> replicas;
+
+// Template id of a pcap packet, registering a new template the first time a (protocol, size) pair shows up. Sizes are clamped to
+// what we can send (and fit a probe header in).
+static uint16_t get_pkt_template_id(std::unordered_map<uint32_t, uint16_t> &tmpl_to_id, uint8_t proto, bytes_t size) {
+  size = std::clamp(size, get_min_pkt_size(proto), MAX_PKT_SIZE);
+
+  const uint32_t key = ((uint32_t)proto << 16) | size;
+  auto found         = tmpl_to_id.find(key);
+  if (found != tmpl_to_id.end()) {
+    return found->second;
+  }
+
+  const uint16_t id = pkt_template_keys.size();
+  pkt_template_keys.push_back({proto, size});
+  tmpl_to_id[key] = id;
+  return id;
+}
+
+// Flows a TX port sends, by its index in config.tx.ports: all of them, unless ports send flows of their own (config.tx.split_flows).
+flow_shard_t get_tx_port_flows(uint16_t port_idx) {
+  const uint64_t num_flows = get_num_flows();
+  if (!config.tx.split_flows) {
+    return {0, num_flows};
+  }
+
+  double shares_before = 0;
+  for (uint16_t i = 0; i < port_idx; i++) {
+    shares_before += config.tx.port_flow_shares[i];
+  }
+
+  // Rounded the same way on both sides, so that ranges meet. The last one takes whatever is left.
+  flow_shard_t port_flows;
+  port_flows.start = RTE_MIN((uint64_t)(num_flows * shares_before), num_flows);
+  port_flows.end   = (port_idx == config.tx.num_ports - 1)
+                         ? num_flows
+                         : RTE_MIN((uint64_t)(num_flows * (shares_before + config.tx.port_flow_shares[port_idx])), num_flows);
+  return port_flows;
+}
+
+// TX worker each entry of flow_idx_seq goes to: round robin, repeating the sequence if there are fewer entries than workers to ensure
+// every worker gets at least one entry. If ports send flows of their own, entries only go round robin among the workers of the port
+// their flow is on, and the sequence is repeated until every worker of every port gets one.
+static std::vector<uint16_t> route_flow_idx_seq() {
+  const size_t num_entries = flow_idx_seq.size();
+  std::vector<uint16_t> routes;
+
+  if (!config.tx.split_flows) {
+    routes.resize(std::max(num_entries, (size_t)config.tx.num_cores));
+    for (size_t i = 0; i < routes.size(); i++) {
+      routes[i] = i % config.tx.num_cores;
+    }
+    return routes;
+  }
+
+  const uint16_t num_ports = config.tx.num_ports;
+  std::vector<uint64_t> port_ends(num_ports);
+  std::vector<std::vector<uint16_t>> port_workers(num_ports);
+  for (uint16_t port_idx = 0; port_idx < num_ports; port_idx++) {
+    port_ends[port_idx] = get_tx_port_flows(port_idx).end;
+    for (uint16_t worker_id = 0; worker_id < config.tx.num_cores; worker_id++) {
+      if (config.tx.core_ports[worker_id] == config.tx.ports[port_idx]) {
+        port_workers[port_idx].push_back(worker_id);
+      }
+    }
+  }
+  auto get_port_idx = [&port_ends](uint32_t flow_idx) {
+    return (size_t)(std::upper_bound(port_ends.begin(), port_ends.end(), (uint64_t)flow_idx) - port_ends.begin());
+  };
+
+  std::vector<size_t> port_entries(num_ports, 0);
+  for (uint32_t flow_idx : flow_idx_seq) {
+    port_entries[get_port_idx(flow_idx)]++;
+  }
+
+  size_t num_laps = 1;
+  for (uint16_t port_idx = 0; port_idx < num_ports; port_idx++) {
+    if (port_entries[port_idx] == 0) {
+      const flow_shard_t port_flows = get_tx_port_flows(port_idx);
+      panic("TX port %" PRIu16 " sends flows %" PRIu64 " to %" PRIu64 " (of %zu), but none of them are in the flow index sequence",
+            config.tx.ports[port_idx], port_flows.start, port_flows.end, get_num_flows());
+    }
+    num_laps = std::max(num_laps, (port_workers[port_idx].size() + port_entries[port_idx] - 1) / port_entries[port_idx]);
+  }
+
+  routes.resize(num_laps * num_entries);
+  std::vector<size_t> next_worker(num_ports, 0);
+  for (size_t i = 0; i < routes.size(); i++) {
+    const size_t port_idx = get_port_idx(flow_idx_seq[i % num_entries]);
+    routes[i]             = port_workers[port_idx][next_worker[port_idx]];
+    next_worker[port_idx] = (next_worker[port_idx] + 1) % port_workers[port_idx].size();
+  }
+
+  return routes;
+}
+
+// Distribution of a per-entry array of the sequence, as given by route_flow_idx_seq().
+template <typename T> static std::vector<std::vector<T>> distribute_per_worker(const std::vector<T> &entries) {
+  std::vector<std::vector<T>> entries_per_worker(config.tx.num_cores);
+
+  const std::vector<uint16_t> routes = route_flow_idx_seq();
+  for (size_t i = 0; i < routes.size(); i++) {
+    entries_per_worker[routes[i]].push_back(entries[i % entries.size()]);
+  }
+
+  return entries_per_worker;
+}
 
 static flow_t generate_random_flow() {
   flow_t flow;
@@ -29,82 +155,299 @@ static flow_t generate_random_flow() {
   flow.src_port = (rte_be16_t)(rte_rand() & 0xffff);
   flow.dst_port = (rte_be16_t)(rte_rand() & 0xffff);
 
+  return flow;
+}
+
+static flow6_t generate_random_flow6() {
+  flow6_t flow;
+
+  for (size_t i = 0; i < sizeof(flow.src_ip); i += sizeof(uint64_t)) {
+    const uint64_t src_bits = rte_rand();
+    const uint64_t dst_bits = rte_rand();
+    memcpy(flow.src_ip + i, &src_bits, sizeof(src_bits));
+    memcpy(flow.dst_ip + i, &dst_bits, sizeof(dst_bits));
+  }
+  flow.src_port = (rte_be16_t)(rte_rand() & 0xffff);
+  flow.dst_port = (rte_be16_t)(rte_rand() & 0xffff);
+
+  return flow;
+}
+
+static kvs_flow_t generate_random_kvs_flow() {
+  kvs_flow_t kvs_flow;
+
   for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
-    flow.kvs_key[i] = (uint8_t)(rte_rand() & 0xff);
+    kvs_flow.key[i] = (uint8_t)(rte_rand() & 0xff);
   }
   for (size_t i = 0; i < MAX_VALUE_SIZE_BYTES; i++) {
-    flow.kvs_value[i] = (uint8_t)(rte_rand() & 0xff);
+    kvs_flow.value[i] = (uint8_t)(rte_rand() & 0xff);
   }
 
-  return flow;
+  return kvs_flow;
+}
+
+// Reads the flows of the pcap into pcap_flows (IPv4 or IPv6 ones), along with the flow index sequence, its gaps and templates.
+template <typename flow_type> static void load_pcap_flows(std::vector<flow_type> &pcap_flows) {
+  time_ns_t last_ts = 0;
+  std::unordered_map<uint32_t, uint16_t> tmpl_to_id;
+  pcap_trace_t<flow_type> trace = load_pcap<flow_type>(config.pcap_fname, config.workload_threads, [&](const pcap_pkt_meta_t &packet) {
+    // Packets without a flow still take up time, so gaps are measured between timestamps. Traces are not always sorted.
+    const time_ns_t gap = (flow_idx_gaps.empty() || packet.ts < last_ts) ? 0 : packet.ts - last_ts;
+    flow_idx_gaps.push_back((uint32_t)std::min(gap, (time_ns_t)UINT32_MAX));
+    last_ts = packet.ts;
+
+    if (pcap_templates_enabled()) {
+      flow_idx_tmpls.push_back(get_pkt_template_id(tmpl_to_id, packet.proto, packet.total_len));
+    }
+  });
+
+  pcap_flows   = std::move(trace.flows);
+  flow_idx_seq = std::move(trace.flow_idx_seq);
+
+  LOG("Finished reading pcap file: %lu packets, %zu unique flows, %zu index entries.", trace.num_pkts, pcap_flows.size(),
+      flow_idx_seq.size());
+
+  // Packets of the other IP version are skipped (see config.ipv6), and there would be nothing left to send.
+  if (pcap_flows.empty() || flow_idx_seq.empty()) {
+    panic("No TCP/UDP flows of the requested IP version (%s) in the pcap %s", config.ipv6 ? "IPv6" : "IPv4", config.pcap_fname.c_str());
+  }
+}
+
+// Same as generate_flows(), for IPv6 flows. These never come with a KVS entry.
+static void generate_flows6() {
+  flows6.resize(config.num_flows);
+
+  LOG("Generating %u IPv6 flows...", config.num_flows);
+
+  if (!config.force_unique_flows) {
+    for (size_t i = 0; i < flows6.size(); i++) {
+      flows6[i] = generate_random_flow6();
+    }
+    return;
+  }
+
+  flat_index_t<flow6_t, flow_comp_t> flows_index(config.num_flows);
+  while (flows_index.size() != config.num_flows) {
+    const flow6_t flow = generate_random_flow6();
+    const uint32_t idx = flows_index.size();
+
+    // Unless already generated. Unlikely, but we still check...
+    if (flows_index.find_or_insert(flows6, flow, flow_hash_t()(flow), idx) == idx) {
+      flows6[idx] = flow;
+    }
+  }
 }
 
 void generate_flows() {
-  std::unordered_set<flow_t, flow_hash_t, flow_comp_t> flows_set;
+  // The flow index sequence comes along with the flows.
+  if (!config.load_workload_fname.empty()) {
+    load_workload(config.load_workload_fname);
+    return;
+  }
 
   if (!config.pcap_fname.empty()) {
     LOG("PCAP file specified, reading from pcap");
 
-    uint64_t pkt_counter = 0;
-    pcap_reader_t reader(config.pcap_fname);
-    packet_t packet;
-    while (reader.read_next_packet(packet)) {
-      pkt_counter++;
-      if (pkt_counter % 10000 == 0) {
-        LOG_REWRITE("Reading pcap file: %lu packets, %zu unique flows", pkt_counter, flows.size());
-      }
+    if (config.ipv6) {
+      load_pcap_flows(flows6);
+    } else {
+      load_pcap_flows(flows);
+    }
+    if (pcap_templates_enabled()) {
+      LOG("Packets rebuilt from %zu templates (protocol and size).", pkt_template_keys.size());
+    }
 
-      if (packet.flow.has_value()) {
-        const flow_t &flow = packet.flow.value();
-        if (flows_set.find(flow) == flows_set.end()) {
-          flow_to_idx[flow] = flows.size();
-          flows.push_back(flow);
-          flows_set.insert(flow);
-        }
-        flow_idx_seq.push_back(flow_to_idx[flow]);
-      }
+    // Traces carry no KVS payload.
+    if (config.kvs_mode) {
+      kvs_flows.resize(flows.size(), kvs_flow_t{});
     }
-    LOG("Finished reading pcap file: %lu packets, %zu unique flows, %zu index entries.", pkt_counter, flows.size(), flow_idx_seq.size());
 
     return;
   }
 
+  if (config.ipv6) {
+    generate_flows6();
+    return;
+  }
+
   flows.resize(config.num_flows);
+  if (config.kvs_mode) {
+    kvs_flows.resize(config.num_flows);
+  }
 
   LOG("Generating %u flows...", config.num_flows);
 
   // Super fast
   if (!config.force_unique_flows) {
     for (size_t i = 0; i < flows.size(); i++) {
-      flows[i]              = generate_random_flow();
-      flow_to_idx[flows[i]] = i;
+      flows[i] = generate_random_flow();
+    }
+    for (size_t i = 0; i < kvs_flows.size(); i++) {
+      kvs_flows[i] = generate_random_kvs_flow();
     }
     return;
   }
 
-  while (flows_set.size() != config.num_flows) {
-    const flow_t flow = generate_random_flow();
+  // In KVS mode flows are told apart by their key, not by their 5-tuple.
+  if (config.kvs_mode) {
+    flat_index_t<kvs_flow_t, kvs_flow_comp_t> kvs_flows_index(config.num_flows);
+    while (kvs_flows_index.size() != config.num_flows) {
+      const kvs_flow_t kvs_flow = generate_random_kvs_flow();
+      const uint32_t idx        = kvs_flows_index.size();
+
+      // Unless already generated. Unlikely, but we still check...
+      if (kvs_flows_index.find_or_insert(kvs_flows, kvs_flow, kvs_flow_hash_t()(kvs_flow), idx) == idx) {
+        flows[idx]     = generate_random_flow();
+        kvs_flows[idx] = kvs_flow;
+      }
+    }
+
+    return;
+  }
+
+  flat_index_t<flow_t, flow_comp_t> flows_index(config.num_flows);
+  while (flows_index.size() != config.num_flows) {
+    const flow_t flow  = generate_random_flow();
+    const uint32_t idx = flows_index.size();
+
+    // Unless already generated. Unlikely, but we still check...
+    if (flows_index.find_or_insert(flows, flow, flow_hash_t()(flow), idx) == idx) {
+      flows[idx] = flow;
+    }
+  }
+}
+
+void publish_flows() {
+  replicas.clear();
+  for (std::unique_ptr<socket_replica_t> &replica : socket_replicas) {
+    replica.reset();
+  }
+
+  const std::vector<int> sockets = get_tx_sockets();
+  if (sockets.size() > 1) {
+    LOG("Replicating flows on %zu sockets...", sockets.size());
+  }
+
+  for (int socket_id : sockets) {
+    socket_replicas[socket_id] = std::make_unique<socket_replica_t>(socket_id);
+    socket_replica_t &replica  = *socket_replicas[socket_id];
+    replicas.push_back(&replica);
 
-    // Already generated. Unlikely, but we still check...
-    if (flows_set.find(flow) != flows_set.end()) {
+    if (config.ipv6) {
+      replica.flow6_slots.resize(flows6.size());
+      for (size_t i = 0; i < flows6.size(); i++) {
+        replica.flow6_slots[i].flow    = flows6[i];
+        replica.flow6_slots[i].version = 0;
+      }
       continue;
     }
 
-    const size_t idx  = flows_set.size();
-    flows[idx]        = flow;
-    flow_to_idx[flow] = idx;
-    flows_set.insert(flow);
+    replica.flow_slots.resize(flows.size());
+    for (size_t i = 0; i < flows.size(); i++) {
+      replica.flow_slots[i].flow    = flows[i];
+      replica.flow_slots[i].version = 0;
+    }
+    replica.kvs_flows.assign(kvs_flows.begin(), kvs_flows.end());
+  }
+
+  num_published_flows = config.ipv6 ? flows6.size() : flows.size();
+}
+
+// The replicas are all there is left of the flows afterwards, so that they are not kept twice. Only once they have been saved or
+// dumped, which still go through flows, flows6 and kvs_flows.
+void release_flows() {
+  std::vector<flow_t>().swap(flows);
+  std::vector<flow6_t>().swap(flows6);
+  std::vector<kvs_flow_t>().swap(kvs_flows);
+}
+
+void publish_flow_idx_sequence() {
+  for (socket_replica_t *replica : replicas) {
+    if (config.sync_cores) {
+      replica->flow_idx_seq.assign(flow_idx_seq.begin(), flow_idx_seq.end());
+      replica->flow_idx_tmpls.assign(flow_idx_tmpls.begin(), flow_idx_tmpls.end());
+    }
+
+    if (config.stream_dist) {
+      replica->sampler_thresholds.assign(flow_sampler_table.thresholds.begin(), flow_sampler_table.thresholds.end());
+      replica->sampler_aliases.assign(flow_sampler_table.aliases.begin(), flow_sampler_table.aliases.end());
+      const bool uniform    = replica->sampler_thresholds.empty();
+      replica->flow_sampler = {(uint32_t)get_num_flows(), uniform ? nullptr : replica->sampler_thresholds.data(),
+                               uniform ? nullptr : replica->sampler_aliases.data()};
+    }
   }
 }
 
-void randomize_flow(uint64_t flow_idx) {
-  assert(flow_idx < flows.size() && "Invalid flow index");
-  flows[flow_idx] = generate_random_flow();
+flow_shard_t get_flow_shard(unsigned worker_id, unsigned num_workers) {
+  const uint64_t slots_per_cache_line = RTE_CACHE_LINE_SIZE / (config.ipv6 ? sizeof(flow6_slot_t) : sizeof(flow_slot_t));
+
+  // Shards start on cache line boundaries, so that no two owners ever write to the same cache line.
+  const uint64_t num_flows  = get_num_flows();
+  const uint64_t shard_size = RTE_ALIGN_CEIL((num_flows + num_workers - 1) / num_workers, slots_per_cache_line);
+
+  flow_shard_t shard;
+  shard.start = RTE_MIN(worker_id * shard_size, num_flows);
+  shard.end   = RTE_MIN(shard.start + shard_size, num_flows);
+
+  return shard;
+}
+
+// Must only be called by the owner of the flow's shard.
+void churn_flow(uint64_t flow_idx) {
+  assert(flow_idx < get_num_flows() && "Invalid flow index");
+
+  // Generated once, so that every replica ends up with the same flow.
+  if (config.ipv6) {
+    const flow6_t flow = generate_random_flow6();
+    for (socket_replica_t *replica : replicas) {
+      flow6_slot_t &slot     = replica->flow6_slots[flow_idx];
+      const uint32_t version = slot.version;
+
+      __atomic_store_n(&slot.version, version + 1, __ATOMIC_RELAXED);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.flow = flow;
+      __atomic_store_n(&slot.version, version + 2, __ATOMIC_RELEASE);
+    }
+    return;
+  }
+
+  const flow_t flow         = generate_random_flow();
+  const bool kvs            = config.kvs_mode;
+  const kvs_flow_t kvs_flow = kvs ? generate_random_kvs_flow() : kvs_flow_t{};
+  for (socket_replica_t *replica : replicas) {
+    flow_slot_t &slot      = replica->flow_slots[flow_idx];
+    const uint32_t version = slot.version;
+
+    __atomic_store_n(&slot.version, version + 1, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.flow = flow;
+    if (kvs) {
+      replica->kvs_flows[flow_idx] = kvs_flow;
+    }
+
+    __atomic_store_n(&slot.version, version + 2, __ATOMIC_RELEASE);
+  }
 }
 
 const std::vector<flow_t> &get_generated_flows() { return flows; }
 
+const std::vector<kvs_flow_t> &get_generated_kvs_flows() { return kvs_flows; }
+
 void generate_flow_idx_sequence() {
+  // Already loaded (and sorted in logical batches) along with the flows.
+  if (!config.load_workload_fname.empty()) {
+    return;
+  }
+
+  // Nothing to generate beforehand: workers draw as they go.
+  if (config.stream_dist) {
+    if (config.dist == ZIPF) {
+      flow_sampler_table = generate_zipf_alias_table(get_num_flows(), config.zipf_param, config.workload_threads);
+    }
+    return;
+  }
+
   // Already populated during generate_flows() when reading from a PCAP file.
   if (config.pcap_fname.empty()) {
     LOG("Generating distribution of flow indexes...");
@@ -113,7 +456,8 @@ void generate_flow_idx_sequence() {
       flow_idx_seq = generate_uniform_flow_idx_sequence(config.num_flows);
       break;
     case ZIPF:
-      flow_idx_seq = generate_zipf_flow_idx_sequence(config.num_flows, config.zipf_param);
+      flow_idx_seq = generate_zipf_flow_idx_sequence(config.num_flows, config.zipf_param, config.zipf_seq_len, config.zipf_cover,
+                                                     config.seed, config.workload_threads);
       break;
     }
   }
@@ -128,67 +472,150 @@ void generate_flow_idx_sequence() {
   }
 }
 
-std::vector<std::vector<uint64_t>> generate_flow_idx_sequence_per_worker() {
+std::vector<std::vector<uint32_t>> generate_flow_idx_sequence_per_worker() {
+  if (!loaded_flow_idx_seq_per_worker.empty()) {
+    LOG("Using the per-worker flow indexes of the workload...");
+    return std::move(loaded_flow_idx_seq_per_worker);
+  }
+
   LOG("Distributing flow indexes per worker...");
-  std::vector<std::vector<uint64_t>> flow_idx_seq_per_worker(config.tx.num_cores);
+  return distribute_per_worker(flow_idx_seq);
+}
+
+void pack_flow_idx_sequence_per_worker(std::vector<std::vector<uint32_t>> &flow_idx_seq_per_worker) {
+  LOG("Packing flow indexes per worker...");
 
-  // Distribute round-robin, repeating the sequence if there are fewer flows
-  // than workers to ensure every worker gets at least one entry.
-  size_t total_entries = std::max(flow_idx_seq.size(), (size_t)config.tx.num_cores);
-  uint16_t worker_id   = 0;
-  for (size_t i = 0; i < total_entries; i++) {
-    flow_idx_seq_per_worker[worker_id].push_back(flow_idx_seq[i % flow_idx_seq.size()]);
-    worker_id = (worker_id + 1) % config.tx.num_cores;
+  const size_t num_workers = flow_idx_seq_per_worker.size();
+  packed_flow_idx_seq_per_worker.resize(num_workers);
+  parallel_for_chunks(num_workers, config.workload_threads, [&](uint64_t worker) {
+    packed_flow_idx_seq_per_worker[worker] = pack_seq(flow_idx_seq_per_worker[worker], get_lcore_socket(config.tx.cores[worker]));
+    std::vector<uint32_t>().swap(flow_idx_seq_per_worker[worker]);
+  });
+
+  size_t packed_size = 0;
+  for (const packed_seq_t &packed : packed_flow_idx_seq_per_worker) {
+    packed_size += packed.mem_size();
   }
+  const size_t unpacked_size = flow_idx_seq.size() * sizeof(uint32_t);
+  LOG("Packed %zu index entries in %.1f MB (%.1f MB unpacked, %.2fx).", flow_idx_seq.size(), packed_size / 1e6, unpacked_size / 1e6,
+      packed_size > 0 ? (double)unpacked_size / packed_size : 0.0);
 
-  return flow_idx_seq_per_worker;
+  std::vector<uint32_t>().swap(flow_idx_seq);
 }
 
-std::string flow_to_string(const flow_t &flow) {
-  std::stringstream ss;
+std::vector<std::vector<uint16_t>> generate_flow_idx_tmpls_per_worker() {
+  LOG("Distributing packet templates per worker...");
+  return distribute_per_worker(flow_idx_tmpls);
+}
 
-  if (config.kvs_mode) {
-    ss << "0x";
-    for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
-      ss << std::hex << std::setw(2) << std::setfill('0') << (int)flow.kvs_key[i];
+std::vector<replay_timing_t> generate_replay_timing_per_worker() {
+  LOG("Distributing replay timing per worker...");
+  std::vector<replay_timing_t> replay_timing_per_worker;
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    replay_timing_per_worker.push_back({socket_vector_t<uint32_t>(socket_allocator_t<uint32_t>(get_lcore_socket(config.tx.cores[i]))), 0});
+  }
+
+  // Absolute offsets of the trace, with one lap lasting the whole trace plus an average gap.
+  const size_t num_entries = flow_idx_gaps.size();
+  std::vector<time_ns_t> offsets(num_entries);
+  time_ns_t offset = 0;
+  for (size_t i = 0; i < num_entries; i++) {
+    offset += flow_idx_gaps[i];
+    offsets[i] = offset;
+  }
+  const time_ns_t lap = offset + (num_entries > 1 ? offset / (num_entries - 1) : 0);
+
+  // Same distribution as distribute_per_worker().
+  const std::vector<uint16_t> routes = route_flow_idx_seq();
+  std::vector<time_ns_t> last_offsets(config.tx.num_cores, 0);
+  for (size_t i = 0; i < routes.size(); i++) {
+    const uint16_t worker_id     = routes[i];
+    const time_ns_t entry_offset = (i / num_entries) * lap + offsets[i % num_entries];
+    replay_timing_t &timing      = replay_timing_per_worker[worker_id];
+
+    if (timing.gaps.empty()) {
+      timing.first_offset = entry_offset;
+      timing.gaps.push_back(0);
+    } else {
+      timing.gaps.push_back((uint32_t)std::min(entry_offset - last_offsets[worker_id], (time_ns_t)UINT32_MAX));
     }
-  } else {
-    ss << std::dec;
-
-    ss << ((flow.src_ip >> 0) & 0xff);
-    ss << ".";
-    ss << ((flow.src_ip >> 8) & 0xff);
-    ss << ".";
-    ss << ((flow.src_ip >> 16) & 0xff);
-    ss << ".";
-    ss << ((flow.src_ip >> 24) & 0xff);
-    ss << ":";
-    ss << rte_bswap16(flow.src_port);
-    ss << " -> ";
-    ss << ((flow.dst_ip >> 0) & 0xff);
-    ss << ".";
-    ss << ((flow.dst_ip >> 8) & 0xff);
-    ss << ".";
-    ss << ((flow.dst_ip >> 16) & 0xff);
-    ss << ".";
-    ss << ((flow.dst_ip >> 24) & 0xff);
-    ss << ":";
-    ss << rte_bswap16(flow.dst_port);
-
-    ss << " (";
-    ss << std::hex << std::setw(8) << std::setfill('0') << (int)rte_bswap32(flow.src_ip);
-    ss << ":";
-    ss << std::hex << std::setw(4) << std::setfill('0') << (int)rte_bswap16(flow.src_port);
-    ss << " -> ";
-    ss << std::hex << std::setw(8) << std::setfill('0') << (int)rte_bswap32(flow.dst_ip);
-    ss << ":";
-    ss << std::hex << std::setw(4) << std::setfill('0') << (int)rte_bswap16(flow.dst_port);
-    ss << ")";
+    last_offsets[worker_id] = entry_offset;
+  }
+
+  // Wrapping around: from a worker's last entry to its first one, as many laps later as the sequence was repeated.
+  const time_ns_t laps = ((routes.size() + num_entries - 1) / num_entries) * lap;
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    replay_timing_t &timing = replay_timing_per_worker[i];
+    const time_ns_t wrap    = timing.first_offset + laps - last_offsets[i];
+    timing.gaps[0]          = (uint32_t)std::min(wrap, (time_ns_t)UINT32_MAX);
+  }
+
+  return replay_timing_per_worker;
+}
+
+std::string flow_to_string(const kvs_flow_t &kvs_flow) {
+  std::stringstream ss;
+
+  ss << "0x";
+  for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
+    ss << std::hex << std::setw(2) << std::setfill('0') << (int)kvs_flow.key[i];
   }
 
   return ss.str();
 }
 
+std::string flow_to_string(const flow_t &flow) {
+  std::stringstream ss;
+
+  ss << std::dec;
+
+  ss << ((flow.src_ip >> 0) & 0xff);
+  ss << ".";
+  ss << ((flow.src_ip >> 8) & 0xff);
+  ss << ".";
+  ss << ((flow.src_ip >> 16) & 0xff);
+  ss << ".";
+  ss << ((flow.src_ip >> 24) & 0xff);
+  ss << ":";
+  ss << rte_bswap16(flow.src_port);
+  ss << " -> ";
+  ss << ((flow.dst_ip >> 0) & 0xff);
+  ss << ".";
+  ss << ((flow.dst_ip >> 8) & 0xff);
+  ss << ".";
+  ss << ((flow.dst_ip >> 16) & 0xff);
+  ss << ".";
+  ss << ((flow.dst_ip >> 24) & 0xff);
+  ss << ":";
+  ss << rte_bswap16(flow.dst_port);
+
+  ss << " (";
+  ss << std::hex << std::setw(8) << std::setfill('0') << (int)rte_bswap32(flow.src_ip);
+  ss << ":";
+  ss << std::hex << std::setw(4) << std::setfill('0') << (int)rte_bswap16(flow.src_port);
+  ss << " -> ";
+  ss << std::hex << std::setw(8) << std::setfill('0') << (int)rte_bswap32(flow.dst_ip);
+  ss << ":";
+  ss << std::hex << std::setw(4) << std::setfill('0') << (int)rte_bswap16(flow.dst_port);
+  ss << ")";
+
+  return ss.str();
+}
+
+std::string flow_to_string(const flow6_t &flow) {
+  char src_ip[INET6_ADDRSTRLEN];
+  char dst_ip[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, flow.src_ip, src_ip, sizeof(src_ip));
+  inet_ntop(AF_INET6, flow.dst_ip, dst_ip, sizeof(dst_ip));
+
+  std::stringstream ss;
+  ss << "[" << src_ip << "]:" << rte_bswap16(flow.src_port);
+  ss << " -> ";
+  ss << "[" << dst_ip << "]:" << rte_bswap16(flow.dst_port);
+
+  return ss.str();
+}
+
 struct kvs_ratio_t {
   uint64_t get;
   uint64_t put;
@@ -214,29 +641,45 @@ static struct kvs_ratio_t calculate_kvs_ratio() {
   return ratio;
 }
 
-std::vector<std::vector<enum kvs_op>> generate_kvs_ops_per_flow() {
-  std::vector<std::vector<enum kvs_op>> kvs_ops_per_flow(flows.size());
+// The same sequence of operations is cycled through by every flow.
+std::vector<enum kvs_op> generate_kvs_ops() {
+  std::vector<enum kvs_op> kvs_ops;
 
   const struct kvs_ratio_t ratio = calculate_kvs_ratio();
 
-  for (size_t flow_idx = 0; flow_idx < kvs_ops_per_flow.size(); flow_idx++) {
-    for (uint64_t i = 0; i < ratio.put; i++) {
-      kvs_ops_per_flow[flow_idx].push_back(KVS_OP_PUT);
-    }
-    for (uint64_t i = 0; i < ratio.get; i++) {
-      kvs_ops_per_flow[flow_idx].push_back(KVS_OP_GET);
-    }
+  for (uint64_t i = 0; i < ratio.put; i++) {
+    kvs_ops.push_back(KVS_OP_PUT);
+  }
+  for (uint64_t i = 0; i < ratio.get; i++) {
+    kvs_ops.push_back(KVS_OP_GET);
   }
 
-  return kvs_ops_per_flow;
+  return kvs_ops;
 }
 
 void cmd_flows_display() {
   LOG();
-  LOG("~~~~~~ %u flows ~~~~~~", config.num_flows);
+  LOG("~~~~~~ %zu flows ~~~~~~", get_num_flows());
 
-  for (const flow_t &flow : flows) {
-    LOG("%s", flow_to_string(flow).c_str());
+  for (size_t i = 0; i < get_num_flows(); i++) {
+    if (config.ipv6) {
+      flow6_t flow6;
+      read_flow(i, flow6);
+      LOG("%s", flow_to_string(flow6).c_str());
+      continue;
+    }
+
+    flow_t flow;
+    kvs_flow_t kvs_flow;
+
+    // Show flows as they currently are, churn included.
+    if (config.kvs_mode) {
+      read_flow<true>(i, flow, kvs_flow);
+      LOG("%s", flow_to_string(kvs_flow).c_str());
+    } else {
+      read_flow<false>(i, flow, kvs_flow);
+      LOG("%s", flow_to_string(flow).c_str());
+    }
   }
 }
 
@@ -244,23 +687,38 @@ void cmd_dist_display() {
   LOG();
   LOG("~~~~~~ Traffic distribution ~~~~~~");
 
-  std::unordered_map<uint64_t, uint64_t> flow_idx_seq_count(config.num_flows);
-  uint64_t total_count = 0;
+  // Without a sequence to count, the distribution is the one flow indexes are drawn from.
+  std::vector<double> counts;
+  double total_count = 0.0;
+  if (config.stream_dist) {
+    counts      = flow_sampler_table.thresholds.empty() ? std::vector<double>(get_num_flows(), 1.0 / get_num_flows())
+                                                        : flow_sampler_table.probabilities();
+    total_count = 1.0;
+  } else {
+    std::unordered_map<uint64_t, uint64_t> flow_idx_seq_count(config.num_flows);
+    const auto count_flow_idx = [&](uint64_t flow_idx) {
+      if (flow_idx_seq_count.find(flow_idx) == flow_idx_seq_count.end()) {
+        flow_idx_seq_count[flow_idx] = 0;
+      }
+      flow_idx_seq_count[flow_idx]++;
+      total_count++;
+    };
+
+    // Packed sequences are all there is left of it by then.
+    for (uint64_t flow_idx : flow_idx_seq) {
+      count_flow_idx(flow_idx);
+    }
+    for (const packed_seq_t &packed : packed_flow_idx_seq_per_worker) {
+      packed.for_each(count_flow_idx);
+    }
 
-  for (uint64_t flow_idx : flow_idx_seq) {
-    if (flow_idx_seq_count.find(flow_idx) == flow_idx_seq_count.end()) {
-      flow_idx_seq_count[flow_idx] = 0;
+    for (const auto &pair : flow_idx_seq_count) {
+      counts.push_back(pair.second);
     }
-    flow_idx_seq_count[flow_idx]++;
-    total_count++;
   }
 
   // Sort by count
-  std::vector<uint64_t> counts(flow_idx_seq_count.size());
-  for (const auto &pair : flow_idx_seq_count) {
-    counts[pair.first] = pair.second;
-  }
-  std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+  std::sort(counts.begin(), counts.end(), std::greater<double>());
 
   // Build a CDF
   std::vector<double> cdf;
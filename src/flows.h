@@ -2,68 +2,284 @@
 
 #include "types.h"
 #include "config.h"
+#include "random.h"
+#include "packed_seq.h"
+#include "numa.h"
 
+#include <string.h>
+
+#include <atomic>
+#include <memory>
 #include <vector>
 #include <string>
 
+#include <rte_branch_prediction.h>
 #include <rte_byteorder.h>
+#include <rte_hash_crc.h>
 
+// Hot per-packet data, kept as a compact 12-byte record so that more flows fit in each cache line.
 struct flow_t {
   rte_be32_t src_ip;
   rte_be32_t dst_ip;
   rte_be16_t src_port;
   rte_be16_t dst_port;
-  kv_key_t kvs_key;
-  kv_value_t kvs_value;
 };
 
+static_assert(sizeof(flow_t) == 12, "flow_t is expected to be a packed 12-byte record");
+
+// IPv6 flows live in a table of their own (see config.ipv6), so that IPv4 ones stay as compact as they are.
+struct flow6_t {
+  uint8_t src_ip[16];
+  uint8_t dst_ip[16];
+  rte_be16_t src_port;
+  rte_be16_t dst_port;
+};
+
+static_assert(sizeof(flow6_t) == 36, "flow6_t is expected to be a packed 36-byte record");
+
+// KVS payload of each flow, stored apart from the 5-tuple and only populated in KVS mode.
+struct kvs_flow_t {
+  kv_key_t key;
+  kv_value_t value;
+};
+
+// Spreads every bit of the input over the whole word (the finalizer of MurmurHash3).
+static inline uint64_t hash_mix64(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+// CRC32C of the fields (the crc32 instruction of SSE4.2/ARMv8, through rte_hash_crc), once in each order for each half of the hash,
+// then mixed. Unlike XORing the fields, it tells apart both directions of a flow, and swapped ports. Hashing a batch of flows in a
+// loop keeps several of them in flight, as the instruction has a latency of a few cycles, but a throughput of one per cycle.
 struct flow_hash_t {
   size_t operator()(const flow_t &flow) const {
-    if (config.kvs_mode) {
-      size_t hash = 0;
-      for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
-        hash ^= std::hash<int>()(flow.kvs_key[i]);
-      }
-      return hash;
-    } else {
-      size_t hash = std::hash<int>()(flow.src_ip);
-      hash ^= std::hash<int>()(flow.dst_ip);
-      hash ^= std::hash<int>()(flow.src_port);
-      hash ^= std::hash<int>()(flow.dst_port);
-      return hash;
+    uint64_t ips;
+    uint32_t ports;
+    memcpy(&ips, &flow.src_ip, sizeof(ips));
+    memcpy(&ports, &flow.src_port, sizeof(ports));
+
+    const uint32_t fwd = rte_hash_crc_4byte(ports, rte_hash_crc_8byte(ips, 0));
+    const uint32_t rev = rte_hash_crc_8byte(ips, rte_hash_crc_4byte(ports, 0));
+    return hash_mix64(((uint64_t)fwd << 32) | rev);
+  }
+
+  size_t operator()(const flow6_t &flow) const {
+    uint64_t ips[4];
+    uint32_t ports;
+    memcpy(ips, flow.src_ip, sizeof(flow.src_ip));
+    memcpy(ips + 2, flow.dst_ip, sizeof(flow.dst_ip));
+    memcpy(&ports, &flow.src_port, sizeof(ports));
+
+    uint32_t fwd = 0;
+    uint32_t rev = rte_hash_crc_4byte(ports, 0);
+    for (int i = 0; i < 4; i++) {
+      fwd = rte_hash_crc_8byte(ips[i], fwd);
+      rev = rte_hash_crc_8byte(ips[3 - i], rev);
     }
+    fwd = rte_hash_crc_4byte(ports, fwd);
+    return hash_mix64(((uint64_t)fwd << 32) | rev);
   }
 };
 
 struct flow_comp_t {
   bool operator()(const flow_t &f1, const flow_t &f2) const {
-    if (config.kvs_mode) {
-      for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
-        if (f1.kvs_key[i] != f2.kvs_key[i]) {
-          return false;
-        }
+    return f1.src_ip == f2.src_ip && f1.dst_ip == f2.dst_ip && f1.src_port == f2.src_port && f1.dst_port == f2.dst_port;
+  };
+
+  bool operator()(const flow6_t &f1, const flow6_t &f2) const {
+    return memcmp(f1.src_ip, f2.src_ip, sizeof(f1.src_ip)) == 0 && memcmp(f1.dst_ip, f2.dst_ip, sizeof(f1.dst_ip)) == 0 &&
+           f1.src_port == f2.src_port && f1.dst_port == f2.dst_port;
+  };
+};
+
+struct kvs_flow_hash_t {
+  size_t operator()(const kvs_flow_t &kvs_flow) const {
+    static_assert(KEY_SIZE_BYTES == sizeof(uint32_t), "KVS keys are expected to be hashed as a single 32-bit word");
+    uint32_t key;
+    memcpy(&key, kvs_flow.key, sizeof(key));
+    // The CRC of a single word is a bijection, so different keys never collide before the mix spreads them over 64 bits.
+    return hash_mix64(rte_hash_crc_4byte(key, 0));
+  }
+};
+
+struct kvs_flow_comp_t {
+  bool operator()(const kvs_flow_t &f1, const kvs_flow_t &f2) const {
+    for (size_t i = 0; i < KEY_SIZE_BYTES; i++) {
+      if (f1.key[i] != f2.key[i]) {
+        return false;
       }
-      return true;
-    } else {
-      return f1.src_ip == f2.src_ip && f1.dst_ip == f2.dst_ip && f1.src_port == f2.src_port && f1.dst_port == f2.dst_port;
     }
+    return true;
   };
 };
 
+// A flow as the TX workers see it. Flows are sharded between the TX workers, and only the owner of a shard ever rewrites (churns)
+// its flows. The version is odd while the owner is writing, so readers on other cores can detect and retry torn reads. It also
+// covers the flow's KVS entry. Slots are 16 bytes, so they never straddle a cache line.
+struct alignas(16) flow_slot_t {
+  flow_t flow;
+  uint32_t version;
+};
+
+static_assert(sizeof(flow_slot_t) == 16, "flow_slot_t is expected to fit exactly 4 slots per cache line");
+
+// Same, for IPv6 flows. These take a whole cache line each.
+struct alignas(64) flow6_slot_t {
+  flow6_t flow;
+  uint32_t version;
+};
+
+static_assert(sizeof(flow6_slot_t) == 64, "flow6_slot_t is expected to take exactly one cache line");
+
+// Contiguous range of flows owned by a TX worker (or sent by a TX port, see config.tx.split_flows).
+struct flow_shard_t {
+  uint64_t start;
+  uint64_t end;
+};
+
 extern std::vector<flow_t> flows;
-extern std::vector<uint64_t> flow_idx_seq;
+// Used instead of flows (which is then left empty) if config.ipv6. Flow indexes point into whichever is in use.
+extern std::vector<flow6_t> flows6;
+extern std::vector<kvs_flow_t> kvs_flows;
+// 32 bits per entry, as there are never 2^32 flows (see config_t::num_flows, and the pcap loader).
+extern std::vector<uint32_t> flow_idx_seq;
+// Time between each entry of flow_idx_seq and the one before it, as captured in the pcap (empty otherwise). Gaps are in ns and
+// saturate at ~4.3s.
+extern std::vector<uint32_t> flow_idx_gaps;
+// Per-worker shares of flow_idx_seq, as loaded from a precompiled workload saved with as many TX workers (empty otherwise).
+extern std::vector<std::vector<uint32_t>> loaded_flow_idx_seq_per_worker;
+// Per-worker shares of flow_idx_seq, block-compressed, if config.pack_seq. flow_idx_seq is released once they are packed.
+extern std::vector<packed_seq_t> packed_flow_idx_seq_per_worker;
+
+// What a packet of the pcap is rebuilt from: its L4 protocol and frame size (with CRC).
+struct pkt_template_key_t {
+  uint8_t proto;
+  bytes_t size;
+};
+
+// Template of each entry of flow_idx_seq, as an index into pkt_template_keys. Only filled in if pcap_templates_enabled().
+extern std::vector<uint16_t> flow_idx_tmpls;
+extern std::vector<pkt_template_key_t> pkt_template_keys;
+
+// Replay timing of a worker's share of the sequence. gaps[k] is the time between the worker's entries k-1 and k, cyclically (so
+// gaps[0] wraps around from its last entry, one trace duration earlier). first_offset is when its entry 0 goes out, relative to
+// the start of the trace.
+struct replay_timing_t {
+  socket_vector_t<uint32_t> gaps;
+  time_ns_t first_offset;
+};
+
+// Copy, on a socket, of everything the TX workers there read on every packet: the flow tables (one of them, see config.ipv6), and
+// whatever they walk or draw flow indexes from together. There is one on every socket with TX cores, and on the main lcore's. Owners
+// churn their flows in all of them.
+struct socket_replica_t {
+  socket_vector_t<flow_slot_t> flow_slots;
+  socket_vector_t<flow6_slot_t> flow6_slots;
+  socket_vector_t<kvs_flow_t> kvs_flows;
+
+  // flow_idx_seq and flow_idx_tmpls, for workers walking them together (config.sync_cores).
+  socket_vector_t<uint32_t> flow_idx_seq;
+  socket_vector_t<uint16_t> flow_idx_tmpls;
+
+  // What TX workers draw flow indexes from instead of a sequence, if config.stream_dist, and the alias table columns it draws from.
+  socket_vector_t<uint32_t> sampler_thresholds;
+  socket_vector_t<uint32_t> sampler_aliases;
+  flow_sampler_t flow_sampler;
+
+  explicit socket_replica_t(int socket_id)
+      : flow_slots(socket_allocator_t<flow_slot_t>(socket_id)), flow6_slots(socket_allocator_t<flow6_slot_t>(socket_id)),
+        kvs_flows(socket_allocator_t<kvs_flow_t>(socket_id)), flow_idx_seq(socket_allocator_t<uint32_t>(socket_id)),
+        flow_idx_tmpls(socket_allocator_t<uint16_t>(socket_id)), sampler_thresholds(socket_allocator_t<uint32_t>(socket_id)),
+        sampler_aliases(socket_allocator_t<uint32_t>(socket_id)), flow_sampler{0, nullptr, nullptr} {}
+};
+
+// Indexed by socket, null for sockets without one.
+extern std::unique_ptr<socket_replica_t> socket_replicas[RTE_MAX_NUMA_NODES];
+
+// That of the socket, or that of the main lcore's if there is none there.
+static inline const socket_replica_t &get_socket_replica(int socket_id) {
+  if (socket_id >= 0 && socket_id < RTE_MAX_NUMA_NODES && socket_replicas[socket_id]) {
+    return *socket_replicas[socket_id];
+  }
+  return *socket_replicas[get_lcore_socket(rte_get_main_lcore())];
+}
+
+// Flows published in the replicas, which outlive flows and flows6 (see release_flows()). 0 until then.
+extern size_t num_published_flows;
+
+static inline size_t get_num_flows() {
+  if (num_published_flows > 0) {
+    return num_published_flows;
+  }
+  return config.ipv6 ? flows6.size() : flows.size();
+}
+
+// Reads a consistent snapshot of a flow (and its KVS entry), retrying if its owner was churning it at the same time.
+template <bool kvs_mode>
+static inline void read_flow(const socket_replica_t &replica, uint64_t flow_idx, flow_t &flow, kvs_flow_t &kvs_flow) {
+  const flow_slot_t &slot = replica.flow_slots[flow_idx];
+  uint32_t begin_version;
+  uint32_t end_version;
+
+  do {
+    begin_version = __atomic_load_n(&slot.version, __ATOMIC_ACQUIRE);
+    flow          = slot.flow;
+    if constexpr (kvs_mode) {
+      kvs_flow = replica.kvs_flows[flow_idx];
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    end_version = __atomic_load_n(&slot.version, __ATOMIC_RELAXED);
+  } while (unlikely((begin_version & 1) || begin_version != end_version));
+}
+
+// Same, for IPv6 flows, which never have a KVS entry.
+static inline void read_flow(const socket_replica_t &replica, uint64_t flow_idx, flow6_t &flow) {
+  const flow6_slot_t &slot = replica.flow6_slots[flow_idx];
+  uint32_t begin_version;
+  uint32_t end_version;
+
+  do {
+    begin_version = __atomic_load_n(&slot.version, __ATOMIC_ACQUIRE);
+    flow          = slot.flow;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    end_version = __atomic_load_n(&slot.version, __ATOMIC_RELAXED);
+  } while (unlikely((begin_version & 1) || begin_version != end_version));
+}
+
+// Same, from the replica of the calling lcore's socket, for whatever is not on the per-packet path.
+template <bool kvs_mode> static inline void read_flow(uint64_t flow_idx, flow_t &flow, kvs_flow_t &kvs_flow) {
+  read_flow<kvs_mode>(get_socket_replica(rte_socket_id()), flow_idx, flow, kvs_flow);
+}
+
+static inline void read_flow(uint64_t flow_idx, flow6_t &flow) { read_flow(get_socket_replica(rte_socket_id()), flow_idx, flow); }
 
 std::string flow_to_string(const flow_t &flow);
+std::string flow_to_string(const flow6_t &flow);
+std::string flow_to_string(const kvs_flow_t &kvs_flow);
 void generate_flows();
 const std::vector<flow_t> &get_generated_flows();
+const std::vector<kvs_flow_t> &get_generated_kvs_flows();
 void generate_flow_idx_sequence();
-std::vector<std::vector<uint64_t>> generate_flow_idx_sequence_per_worker();
-void randomize_flow(uint64_t flow_idx);
+std::vector<std::vector<uint32_t>> generate_flow_idx_sequence_per_worker();
+void pack_flow_idx_sequence_per_worker(std::vector<std::vector<uint32_t>> &flow_idx_seq_per_worker);
+std::vector<replay_timing_t> generate_replay_timing_per_worker();
+std::vector<std::vector<uint16_t>> generate_flow_idx_tmpls_per_worker();
+void publish_flows();
+void publish_flow_idx_sequence();
+void release_flows();
+flow_shard_t get_flow_shard(unsigned worker_id, unsigned num_workers);
+flow_shard_t get_tx_port_flows(uint16_t port_idx);
+void churn_flow(uint64_t flow_idx);
 
 void generate_unique_flows_per_worker();
 const std::vector<flow_t> &get_worker_flows(unsigned worker_id);
 
-std::vector<std::vector<enum kvs_op>> generate_kvs_ops_per_flow();
+std::vector<enum kvs_op> generate_kvs_ops();
 
 void cmd_flows_display();
 void cmd_dist_display();
@@ -0,0 +1,68 @@
+#include "latency.h"
+#include "config.h"
+
+struct latency_hist_t latency_hists[RTE_MAX_LCORE];
+
+// Same as the worker counters, resetting only moves the baseline.
+static struct latency_hist_t latency_hists_baseline[RTE_MAX_LCORE];
+
+// Lowest value that falls in the given bucket.
+static time_ns_t latency_bucket_value(unsigned bucket) {
+  if (bucket < 2 * LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  const unsigned shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return (time_ns_t)(bucket % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS) << shift;
+}
+
+struct latency_summary_t get_latency() {
+  static struct latency_hist_t merged;
+
+  latency_summary_t summary = {.samples = 0, .p50 = 0, .p99 = 0, .p999 = 0, .max = 0};
+
+  for (unsigned b = 0; b < LATENCY_NUM_BUCKETS; b++) {
+    merged.counts[b] = 0;
+    for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+      merged.counts[b] += latency_hists[i].counts[b] - latency_hists_baseline[i].counts[b];
+    }
+    summary.samples += merged.counts[b];
+  }
+
+  if (summary.samples == 0) {
+    return summary;
+  }
+
+  const uint64_t p50_rank  = (summary.samples * 500 + 999) / 1000;
+  const uint64_t p99_rank  = (summary.samples * 990 + 999) / 1000;
+  const uint64_t p999_rank = (summary.samples * 999 + 999) / 1000;
+
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < LATENCY_NUM_BUCKETS; b++) {
+    if (merged.counts[b] == 0) {
+      continue;
+    }
+
+    const uint64_t prev = seen;
+    seen += merged.counts[b];
+
+    const time_ns_t value = latency_bucket_value(b);
+    if (prev < p50_rank && seen >= p50_rank) {
+      summary.p50 = value;
+    }
+    if (prev < p99_rank && seen >= p99_rank) {
+      summary.p99 = value;
+    }
+    if (prev < p999_rank && seen >= p999_rank) {
+      summary.p999 = value;
+    }
+    summary.max = value;
+  }
+
+  return summary;
+}
+
+void latency_reset() {
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    latency_hists_baseline[i] = latency_hists[i];
+  }
+}
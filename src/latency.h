@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <rte_common.h>
+
+#include "types.h"
+
+// HDR-style histogram: values below 2^(LATENCY_SUB_BUCKET_BITS+1) get a bucket each, then every power of two is split into
+// 2^LATENCY_SUB_BUCKET_BITS buckets. Relative error stays below 1/2^LATENCY_SUB_BUCKET_BITS across the whole range.
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_NUM_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+// Per RX worker latency histogram, in nanoseconds. Each worker only ever writes to its own.
+struct latency_hist_t {
+  uint64_t counts[LATENCY_NUM_BUCKETS];
+} __rte_cache_aligned;
+
+extern struct latency_hist_t latency_hists[RTE_MAX_LCORE];
+
+struct latency_summary_t {
+  uint64_t samples;
+  time_ns_t p50;
+  time_ns_t p99;
+  time_ns_t p999;
+  time_ns_t max;
+};
+
+static inline unsigned latency_bucket(time_ns_t value) {
+  if (value < 2 * LATENCY_SUB_BUCKETS) {
+    return value;
+  }
+  const unsigned shift = (63 - __builtin_clzll(value)) - LATENCY_SUB_BUCKET_BITS;
+  return (shift + 1) * LATENCY_SUB_BUCKETS + ((value >> shift) - LATENCY_SUB_BUCKETS);
+}
+
+static inline void latency_record(struct latency_hist_t *hist, time_ns_t value) { hist->counts[latency_bucket(value)]++; }
+
+// Merges every RX worker histogram (since the last reset).
+struct latency_summary_t get_latency();
+void latency_reset();
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <type_traits>
+#include <vector>
+
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_memory.h>
+
+#include "config.h"
+#include "log.h"
+
+// Hugepages of the socket, or of any other if it has none left: with --socket-mem for a single node, or --no-huge, all of the memory
+// may well be on one socket. Placement is only a matter of speed, so that is worth a warning, not giving up.
+inline void *socket_malloc(const char *name, size_t size, int socket_id) {
+  void *mem = rte_malloc_socket(name, size, RTE_CACHE_LINE_SIZE, socket_id);
+  if (mem != nullptr || socket_id == SOCKET_ID_ANY) {
+    return mem;
+  }
+
+  static bool warned[RTE_MAX_NUMA_NODES] = {};
+  if (socket_id < RTE_MAX_NUMA_NODES && !warned[socket_id]) {
+    warned[socket_id] = true;
+    WARNING("*************************************************************************");
+    WARNING("Out of memory on socket %d, allocating on any socket instead.", socket_id);
+    WARNING("Workers on socket %d will be slower, give it memory with --socket-mem.", socket_id);
+    WARNING("*************************************************************************");
+  }
+  return rte_malloc_socket(name, size, RTE_CACHE_LINE_SIZE, SOCKET_ID_ANY);
+}
+
+// Allocates from the hugepages of a given socket, so that whatever the TX workers read on every packet is local to them. Workers on
+// the other socket of a dual-socket box lose about a third of their rate otherwise.
+template <typename T> struct socket_allocator_t {
+  typedef T value_type;
+  // Vectors keep their socket when assigned or swapped, instead of moving element by element to the socket of the other one.
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  int socket_id;
+
+  socket_allocator_t() : socket_id(SOCKET_ID_ANY) {}
+  explicit socket_allocator_t(int _socket_id) : socket_id(_socket_id) {}
+  template <typename U> socket_allocator_t(const socket_allocator_t<U> &other) : socket_id(other.socket_id) {}
+
+  T *allocate(size_t n) {
+    T *elems = (T *)socket_malloc("socket_vector", n * sizeof(T), socket_id);
+    if (elems == nullptr) {
+      panic("Cannot allocate %zu bytes on socket %d", n * sizeof(T), socket_id);
+    }
+    return elems;
+  }
+
+  void deallocate(T *elems, size_t) { rte_free(elems); }
+
+  template <typename U> bool operator==(const socket_allocator_t<U> &other) const { return socket_id == other.socket_id; }
+  template <typename U> bool operator!=(const socket_allocator_t<U> &other) const { return socket_id != other.socket_id; }
+};
+
+template <typename T> using socket_vector_t = std::vector<T, socket_allocator_t<T>>;
+
+template <typename T> static inline socket_vector_t<T> copy_to_socket(const std::vector<T> &elems, int socket_id) {
+  return socket_vector_t<T>(elems.begin(), elems.end(), socket_allocator_t<T>(socket_id));
+}
+
+static inline int get_lcore_socket(unsigned lcore_id) { return (int)rte_lcore_to_socket_id(lcore_id); }
+
+// Sockets of the TX cores, and of the main lcore (which reads flows too, for the commands that show them).
+static inline std::vector<int> get_tx_sockets() {
+  std::vector<int> sockets = {get_lcore_socket(rte_get_main_lcore())};
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    const int socket_id = get_lcore_socket(config.tx.cores[i]);
+    bool known          = false;
+    for (int known_socket : sockets) {
+      known |= (known_socket == socket_id);
+    }
+    if (!known) {
+      sockets.push_back(socket_id);
+    }
+  }
+  return sockets;
+}
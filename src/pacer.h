@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_ether.h>
+
+#include "types.h"
+#include "clock.h"
+
+// Costs are kept in fixed point, as a single packet can cost less than a tick at high rates.
+#define PACER_FP_SHIFT 16
+#define PACER_FP_MASK ((1ull << PACER_FP_SHIFT) - 1)
+
+// Preamble, start of frame delimiter and inter-packet gap: what a packet takes on the wire on top of its frame.
+#define WIRE_OVERHEAD_BYTES 20
+
+// Token bucket in TSC ticks (as a virtual send time): every packet pushes next_tick forward by its cost, and may only go out once
+// the clock has caught up with it.
+struct pacer_t {
+  ticks_t next_tick;
+  uint64_t next_tick_frac;
+
+  // Cost of a packet: fixed part (pps target) plus a part per wire byte (bps target).
+  uint64_t pkt_cost;
+  uint64_t byte_cost;
+
+  // Replay instead charges each packet the trace gap to the next one, converted to ticks (at the replay speed).
+  uint64_t ns_cost;
+
+  // Cost of a template-sized packet, used to estimate how many packets are due.
+  uint64_t expected_cost;
+
+  // How far behind we may fall (after a stall) and still catch up. Anything older is forgiven, instead of going out as a burst.
+  ticks_t max_lag;
+};
+
+// Paces at the given rate, in Gbps if gbps > 0, otherwise in Mpps. frame_size is the expected frame size, CRC included.
+static inline void pacer_init(struct pacer_t *pacer, rate_gbps_t gbps, rate_mpps_t mpps, bytes_t frame_size, ticks_t start_tick) {
+  const double ticks_per_s = (double)clock_scale() * 1e6;
+
+  pacer->next_tick      = start_tick;
+  pacer->next_tick_frac = 0;
+  pacer->pkt_cost       = 0;
+  pacer->byte_cost      = 0;
+  pacer->ns_cost        = 0;
+
+  if (gbps > 0) {
+    pacer->byte_cost = (uint64_t)((ticks_per_s * 8 / (gbps * 1e9)) * (1ull << PACER_FP_SHIFT));
+  } else if (mpps > 0) {
+    pacer->pkt_cost = (uint64_t)((ticks_per_s / (mpps * 1e6)) * (1ull << PACER_FP_SHIFT));
+  }
+
+  pacer->expected_cost = RTE_MAX(pacer->pkt_cost + (frame_size + WIRE_OVERHEAD_BYTES) * pacer->byte_cost, (uint64_t)1);
+  pacer->max_lag       = (BURST_SIZE * pacer->expected_cost) >> PACER_FP_SHIFT;
+}
+
+// How many packets (up to max) are due by now.
+static inline uint16_t pacer_due(struct pacer_t *pacer, ticks_t now, uint16_t max) {
+  if (now < pacer->next_tick) {
+    return 0;
+  }
+
+  if (unlikely(now - pacer->next_tick > pacer->max_lag)) {
+    pacer->next_tick      = now - pacer->max_lag;
+    pacer->next_tick_frac = 0;
+  }
+
+  const uint64_t elapsed = (now - pacer->next_tick) << PACER_FP_SHIFT;
+  if (elapsed < pacer->next_tick_frac) {
+    return 0;
+  }
+
+  const uint64_t due = (elapsed - pacer->next_tick_frac) / pacer->expected_cost + 1;
+  return (uint16_t)RTE_MIN(due, (uint64_t)max);
+}
+
+// Charges a packet that was sent, by its actual size (without CRC).
+static inline void pacer_charge(struct pacer_t *pacer, bytes_t pkt_size) {
+  const uint64_t bytes = pkt_size + RTE_ETHER_CRC_LEN + WIRE_OVERHEAD_BYTES;
+  const uint64_t cost  = pacer->next_tick_frac + pacer->pkt_cost + bytes * pacer->byte_cost;
+
+  pacer->next_tick += cost >> PACER_FP_SHIFT;
+  pacer->next_tick_frac = cost & PACER_FP_MASK;
+}
+
+// Paces by the trace timing, sped up by the given factor (0 for as fast as possible). The first packet goes out first_offset after
+// start_tick, a time base shared by all workers.
+static inline void pacer_init_replay(struct pacer_t *pacer, double speed, time_ns_t first_offset, time_ns_t mean_gap,
+                                     ticks_t start_tick) {
+  const double ticks_per_ns = (double)clock_scale() / 1e3;
+
+  pacer->pkt_cost       = 0;
+  pacer->byte_cost      = 0;
+  pacer->ns_cost        = (speed > 0) ? (uint64_t)((ticks_per_ns / speed) * (1ull << PACER_FP_SHIFT)) : 0;
+  pacer->expected_cost  = RTE_MAX(mean_gap * pacer->ns_cost, (uint64_t)1);
+  pacer->max_lag        = (BURST_SIZE * pacer->expected_cost) >> PACER_FP_SHIFT;
+  pacer->next_tick      = start_tick + ((first_offset * pacer->ns_cost) >> PACER_FP_SHIFT);
+  pacer->next_tick_frac = 0;
+}
+
+// How many entries (up to max) of the replay are due by now, starting at gaps[idx].
+static inline uint16_t pacer_due_replay(struct pacer_t *pacer, ticks_t now, uint16_t max, const uint32_t *gaps, size_t num_gaps,
+                                        size_t idx) {
+  if (now < pacer->next_tick) {
+    return 0;
+  }
+
+  if (unlikely(now - pacer->next_tick > pacer->max_lag)) {
+    pacer->next_tick      = now - pacer->max_lag;
+    pacer->next_tick_frac = 0;
+  }
+
+  ticks_t tick = pacer->next_tick;
+  uint16_t due = 0;
+  while (due < max && tick <= now) {
+    due++;
+    if (++idx == num_gaps) {
+      idx = 0;
+    }
+    tick += (gaps[idx] * pacer->ns_cost) >> PACER_FP_SHIFT;
+  }
+
+  return due;
+}
+
+// Charges a replayed packet, by the trace gap to the one following it.
+static inline void pacer_charge_gap(struct pacer_t *pacer, uint32_t gap) {
+  const uint64_t cost = pacer->next_tick_frac + gap * pacer->ns_cost;
+
+  pacer->next_tick += cost >> PACER_FP_SHIFT;
+  pacer->next_tick_frac = cost & PACER_FP_MASK;
+}
@@ -0,0 +1,57 @@
+#include "packed_seq.h"
+
+static uint32_t bit_width(uint32_t value) { return value == 0 ? 0 : 32 - __builtin_clz(value); }
+
+static uint32_t zigzag(uint32_t delta) { return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31); }
+
+packed_seq_t pack_seq(const std::vector<uint32_t> &seq, int socket_id) {
+  packed_seq_t packed = {seq.size(), socket_vector_t<packed_seq_block_t>(socket_allocator_t<packed_seq_block_t>(socket_id)),
+                         socket_vector_t<uint64_t>(socket_allocator_t<uint64_t>(socket_id))};
+
+  uint32_t entries[PACKED_SEQ_BLOCK_SIZE];
+  uint32_t deltas[PACKED_SEQ_BLOCK_SIZE];
+  for (size_t start = 0; start < seq.size(); start += PACKED_SEQ_BLOCK_SIZE) {
+    const size_t num_entries = std::min(seq.size() - start, (size_t)PACKED_SEQ_BLOCK_SIZE);
+    for (size_t i = 0; i < PACKED_SEQ_BLOCK_SIZE; i++) {
+      entries[i] = seq[start + std::min(i, num_entries - 1)];
+    }
+
+    const uint32_t min = *std::min_element(entries, entries + PACKED_SEQ_BLOCK_SIZE);
+    const uint32_t max = *std::max_element(entries, entries + PACKED_SEQ_BLOCK_SIZE);
+    uint32_t delta_or  = 0;
+    deltas[0]          = 0;
+    for (size_t i = 1; i < PACKED_SEQ_BLOCK_SIZE; i++) {
+      deltas[i] = zigzag(entries[i] - entries[i - 1]);
+      delta_or |= deltas[i];
+    }
+
+    // Deltas only when strictly narrower, as they take longer to unpack.
+    packed_seq_block_t block = {packed.words.size(), min, (uint8_t)bit_width(max - min), 0, 0};
+    const uint32_t *values   = entries;
+    if (bit_width(delta_or) < block.bits) {
+      block.base  = entries[0];
+      block.bits  = bit_width(delta_or);
+      block.delta = 1;
+      values      = deltas;
+    }
+
+    packed.words.resize(block.offset + block.bits * PACKED_SEQ_BLOCK_SIZE / 64, 0);
+    for (uint32_t i = 0; i < PACKED_SEQ_BLOCK_SIZE && block.bits > 0; i++) {
+      const uint64_t value = block.delta ? values[i] : values[i] - min;
+      const uint32_t bit   = i * block.bits;
+      const uint32_t lo    = bit % 64;
+      packed.words[block.offset + bit / 64] |= value << lo;
+      if (lo + block.bits > 64) {
+        packed.words[block.offset + bit / 64 + 1] |= value >> (64 - lo);
+      }
+    }
+
+    packed.blocks.push_back(block);
+  }
+
+  packed.words.resize(packed.words.size() + 2, 0);
+  packed.words.shrink_to_fit();
+  packed.blocks.shrink_to_fit();
+
+  return packed;
+}
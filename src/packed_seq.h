@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#include "numa.h"
+
+// Flow index sequences, block-compressed for as long as the TX workers walk them. Every block of PACKED_SEQ_BLOCK_SIZE entries is
+// bit-packed at the narrowest width that fits either of:
+//  - Frame of reference: each entry minus the smallest of the block. Good enough for any sequence, as entries only take as many bits
+//    as there are flows.
+//  - Deltas: each entry minus the one before it, zigzag encoded. Made for sorted runs (see --logical-batch-size), and for runs of the
+//    same flow, which take no bits at all.
+//
+// Blocks are unpacked whole, by branchless code specialized for each width.
+
+#define PACKED_SEQ_BLOCK_SIZE 128
+
+// One per width, so that every shift and mask is known at compile time. Every entry is a single unaligned 64-bit load from the byte
+// it starts in, which holds all of its (at most 32) bits.
+template <uint32_t bits> static void unpack_bits(const uint64_t *words, uint32_t *out) {
+  constexpr uint64_t mask = (1ull << bits) - 1;
+  const uint8_t *bytes    = (const uint8_t *)words;
+  for (uint32_t i = 0; i < PACKED_SEQ_BLOCK_SIZE; i++) {
+    uint64_t value;
+    memcpy(&value, bytes + i * bits / 8, sizeof(value));
+    out[i] = (uint32_t)((value >> (i * bits % 8)) & mask);
+  }
+}
+
+typedef void (*unpack_bits_fn_t)(const uint64_t *, uint32_t *);
+
+template <uint32_t... widths>
+static constexpr std::array<unpack_bits_fn_t, sizeof...(widths)> make_unpackers(std::integer_sequence<uint32_t, widths...>) {
+  return {{&unpack_bits<widths>...}};
+}
+
+// Indexed by width, from 0 to 32 bits.
+static constexpr std::array<unpack_bits_fn_t, 33> packed_seq_unpackers = make_unpackers(std::make_integer_sequence<uint32_t, 33>{});
+
+struct packed_seq_block_t {
+  uint64_t offset; // Of its first word
+  uint32_t base;   // Smallest entry, or first entry if delta
+  uint8_t bits;
+  uint8_t delta;
+  uint16_t reserved;
+};
+
+struct packed_seq_t {
+  uint64_t size;
+  socket_vector_t<packed_seq_block_t> blocks;
+  // Every block takes bits * PACKED_SEQ_BLOCK_SIZE / 64 words. Followed by two spare ones, so that unpacking can always read the word
+  // after the one it is in.
+  socket_vector_t<uint64_t> words;
+
+  size_t num_blocks() const { return blocks.size(); }
+
+  size_t mem_size() const { return blocks.size() * sizeof(packed_seq_block_t) + words.size() * sizeof(uint64_t); }
+
+  // Entries of the block, in out. The last block is padded with copies of the last entry of the sequence.
+  inline void unpack_block(size_t block_idx, uint32_t *out) const {
+    const packed_seq_block_t &block = blocks[block_idx];
+    packed_seq_unpackers[block.bits](&words[block.offset], out);
+
+    if (block.delta) {
+      uint32_t value = block.base;
+      for (uint32_t i = 0; i < PACKED_SEQ_BLOCK_SIZE; i++) {
+        value += (out[i] >> 1) ^ -(out[i] & 1);
+        out[i] = value;
+      }
+    } else {
+      for (uint32_t i = 0; i < PACKED_SEQ_BLOCK_SIZE; i++) {
+        out[i] += block.base;
+      }
+    }
+  }
+
+  // Calls fn on every entry, in order.
+  template <typename fn_t> void for_each(fn_t fn) const {
+    uint32_t entries[PACKED_SEQ_BLOCK_SIZE];
+    for (size_t block_idx = 0; block_idx < blocks.size(); block_idx++) {
+      unpack_block(block_idx, entries);
+      const uint64_t num_entries = std::min<uint64_t>(size - block_idx * PACKED_SEQ_BLOCK_SIZE, PACKED_SEQ_BLOCK_SIZE);
+      for (uint64_t i = 0; i < num_entries; i++) {
+        fn(entries[i]);
+      }
+    }
+  }
+};
+
+// Walks a packed sequence over and over, a block at a time.
+struct packed_seq_reader_t {
+  const packed_seq_t *seq;
+  size_t next_block;
+  uint32_t pos;
+  uint32_t num_entries;
+  uint32_t entries[PACKED_SEQ_BLOCK_SIZE];
+
+  explicit packed_seq_reader_t(const packed_seq_t *_seq) : seq(_seq), next_block(0), pos(0), num_entries(0), entries() {}
+
+  void rewind() {
+    next_block  = 0;
+    pos         = 0;
+    num_entries = 0;
+  }
+
+  inline uint32_t next() {
+    if (pos == num_entries) {
+      seq->unpack_block(next_block, entries);
+      num_entries = std::min<uint64_t>(seq->size - next_block * PACKED_SEQ_BLOCK_SIZE, PACKED_SEQ_BLOCK_SIZE);
+      pos         = 0;
+      if (++next_block == seq->num_blocks()) {
+        next_block = 0;
+      }
+    }
+    return entries[pos++];
+  }
+};
+
+// Packed on the socket of the worker that is to walk it.
+packed_seq_t pack_seq(const std::vector<uint32_t> &seq, int socket_id);
@@ -0,0 +1,295 @@
+#include "packet.h"
+#include "config.h"
+
+// Source/destination MACs
+const struct rte_ether_addr src_mac = {{0xb4, 0x96, 0x91, 0xa4, 0x02, 0xe9}};
+const struct rte_ether_addr dst_mac = {{0xb4, 0x96, 0x91, 0xa4, 0x04, 0x21}};
+
+// Writes the Ethernet header and the encapsulation in front of the inner IP header (see encap.h), returning where the latter starts.
+// Everything but the per-flow fields is constant, lengths and the outer IP checksum included.
+static bytes_t build_encap_hdrs(pkt_template_t &tmpl, bytes_t size, bool cksum_offload, bool outer_udp_cksum_offload) {
+  const encap_t &encap = config.encap;
+  byte_t *pkt          = tmpl.pkt;
+  byte_t *ptr          = pkt;
+
+  tmpl.encap_sport_offset = 0;
+  tmpl.encap_id_offset    = 0;
+  tmpl.encap_id_base      = encap.tunnel_id;
+  tmpl.encap_id_count     = encap.tunnel_id_count;
+  tmpl.encap_id_shift     = 0;
+
+  // The tags are followed by the outer IPv4 header of the tunnel, if there is one, or else by the inner IP header itself.
+  const bool tunnel                 = encap_has_tunnel(encap);
+  const uint16_t inner_ether_type   = config.ipv6 ? RTE_ETHER_TYPE_IPV6 : RTE_ETHER_TYPE_IPV4;
+  const uint16_t after_tags_ethtype = tunnel ? RTE_ETHER_TYPE_IPV4 : inner_ether_type;
+
+  struct rte_ether_hdr *ether_hdr = (struct rte_ether_hdr *)ptr;
+  ptr += sizeof(rte_ether_hdr);
+
+  ether_hdr->src_addr   = src_mac;
+  ether_hdr->dst_addr   = dst_mac;
+  ether_hdr->ether_type = rte_cpu_to_be_16(encap.num_vlans > 0 ? encap.vlan_tpids[0] : after_tags_ethtype);
+
+  for (int i = 0; i < encap.num_vlans; i++) {
+    struct rte_vlan_hdr *vlan_hdr = (struct rte_vlan_hdr *)ptr;
+    ptr += sizeof(rte_vlan_hdr);
+
+    vlan_hdr->vlan_tci  = rte_cpu_to_be_16(encap.vlan_ids[i]);
+    vlan_hdr->eth_proto = rte_cpu_to_be_16(i + 1 < encap.num_vlans ? encap.vlan_tpids[i + 1] : after_tags_ethtype);
+  }
+
+  if (!tunnel) {
+    return ptr - pkt;
+  }
+
+  struct rte_ipv4_hdr *outer_ip_hdr = (struct rte_ipv4_hdr *)ptr;
+  ptr += sizeof(rte_ipv4_hdr);
+
+  outer_ip_hdr->version_ihl     = RTE_IPV4_VHL_DEF;
+  outer_ip_hdr->type_of_service = 0;
+  outer_ip_hdr->total_length    = rte_cpu_to_be_16(size - ((byte_t *)outer_ip_hdr - pkt));
+  outer_ip_hdr->packet_id       = 0;
+  outer_ip_hdr->fragment_offset = 0;
+  outer_ip_hdr->time_to_live    = 64;
+  outer_ip_hdr->next_proto_id   = (encap.tunnel == ENCAP_TUNNEL_GRE) ? IPPROTO_GRE : IPPROTO_UDP;
+  outer_ip_hdr->hdr_checksum    = 0;
+  outer_ip_hdr->src_addr        = encap.outer_src_ip;
+  outer_ip_hdr->dst_addr        = encap.outer_dst_ip;
+  if (!cksum_offload) {
+    outer_ip_hdr->hdr_checksum = ~cksum_fold(cksum_add_bytes(0, (const byte_t *)outer_ip_hdr, sizeof(rte_ipv4_hdr)));
+  }
+
+  if (encap.tunnel == ENCAP_TUNNEL_GRE) {
+    rte_be16_t *gre_hdr = (rte_be16_t *)ptr;
+    ptr += sizeof(rte_gre_hdr);
+
+    gre_hdr[0] = rte_cpu_to_be_16(encap.tunnel_has_id ? GRE_FLAG_KEY : 0);
+    gre_hdr[1] = rte_cpu_to_be_16(inner_ether_type);
+    if (encap.tunnel_has_id) {
+      const rte_be32_t key = rte_cpu_to_be_32(encap.tunnel_id);
+      memcpy(ptr, &key, sizeof(key));
+      tmpl.encap_id_offset = ptr - pkt;
+      ptr += sizeof(key);
+    }
+    return ptr - pkt;
+  }
+
+  // VXLAN and GTP-U go over UDP. Its checksum is left at zero (as RFC 7348 recommends), unless the NIC computes it: ports are then the
+  // only per-flow fields it covers, and they are not part of the pseudo-header sum the NIC starts from.
+  struct rte_udp_hdr *outer_udp_hdr = (struct rte_udp_hdr *)ptr;
+  ptr += sizeof(rte_udp_hdr);
+
+  const bytes_t outer_udp_len = size - ((byte_t *)outer_udp_hdr - pkt);
+  const bool vxlan            = (encap.tunnel == ENCAP_TUNNEL_VXLAN);
+
+  outer_udp_hdr->src_port    = rte_cpu_to_be_16(vxlan ? ENCAP_SPORT_MIN : RTE_GTPU_UDP_PORT); // Parameter with VXLAN
+  outer_udp_hdr->dst_port    = rte_cpu_to_be_16(vxlan ? RTE_VXLAN_DEFAULT_PORT : RTE_GTPU_UDP_PORT);
+  outer_udp_hdr->dgram_len   = rte_cpu_to_be_16(outer_udp_len);
+  outer_udp_hdr->dgram_cksum = 0;
+  if (cksum_offload && outer_udp_cksum_offload) {
+    uint32_t phdr_sum          = 0;
+    phdr_sum                   = cksum_add32(phdr_sum, encap.outer_src_ip);
+    phdr_sum                   = cksum_add32(phdr_sum, encap.outer_dst_ip);
+    phdr_sum                   = cksum_add16(phdr_sum, rte_cpu_to_be_16(IPPROTO_UDP));
+    phdr_sum                   = cksum_add16(phdr_sum, rte_cpu_to_be_16(outer_udp_len));
+    outer_udp_hdr->dgram_cksum = cksum_fold(phdr_sum);
+  }
+
+  if (vxlan) {
+    tmpl.encap_sport_offset = (const byte_t *)&outer_udp_hdr->src_port - pkt;
+
+    struct rte_vxlan_hdr *vxlan_hdr = (struct rte_vxlan_hdr *)ptr;
+    ptr += sizeof(rte_vxlan_hdr);
+
+    // The VNI takes up the top 24 bits of its word.
+    vxlan_hdr->vx_flags  = rte_cpu_to_be_32(VXLAN_FLAG_VNI);
+    vxlan_hdr->vx_vni    = rte_cpu_to_be_32(encap.tunnel_id << 8);
+    tmpl.encap_id_offset = (const byte_t *)&vxlan_hdr->vx_vni - pkt;
+    tmpl.encap_id_shift  = 8;
+
+    struct rte_ether_hdr *inner_ether_hdr = (struct rte_ether_hdr *)ptr;
+    ptr += sizeof(rte_ether_hdr);
+
+    inner_ether_hdr->src_addr   = src_mac;
+    inner_ether_hdr->dst_addr   = dst_mac;
+    inner_ether_hdr->ether_type = rte_cpu_to_be_16(inner_ether_type);
+  } else {
+    struct rte_gtp_hdr *gtp_hdr = (struct rte_gtp_hdr *)ptr;
+    ptr += sizeof(rte_gtp_hdr);
+
+    gtp_hdr->gtp_hdr_info = GTPU_FLAGS;
+    gtp_hdr->msg_type     = GTPU_MSG_TPDU;
+    gtp_hdr->plen         = rte_cpu_to_be_16(size - (ptr - pkt));
+    gtp_hdr->teid         = rte_cpu_to_be_32(encap.tunnel_id);
+    tmpl.encap_id_offset  = (const byte_t *)&gtp_hdr->teid - pkt;
+  }
+
+  return ptr - pkt;
+}
+
+void generate_template_packet(pkt_template_t &tmpl, bytes_t size, uint8_t proto, bool cksum_offload, bool outer_udp_cksum_offload) {
+  assert((proto == IPPROTO_UDP || (proto == IPPROTO_TCP && !config.kvs_mode)) && "Unsupported template protocol");
+
+  byte_t *pkt = tmpl.pkt;
+
+  tmpl.size         = size;
+  tmpl.proto        = proto;
+  tmpl.probe_offset = get_probe_offset(config.kvs_mode, proto, config.ipv6);
+  tmpl.ip_offset    = build_encap_hdrs(tmpl, size, cksum_offload, outer_udp_cksum_offload);
+
+  bytes_t current_pkt_size = tmpl.ip_offset;
+  byte_t *current_pkt_ptr  = pkt + tmpl.ip_offset;
+
+  const bytes_t ip_hdr_size = get_ip_hdr_size(config.ipv6);
+  const bytes_t l4_len      = size - (tmpl.ip_offset + ip_hdr_size);
+
+  struct rte_ipv4_hdr *ip_hdr = nullptr;
+  if (config.ipv6) {
+    struct rte_ipv6_hdr *ip6_hdr = (struct rte_ipv6_hdr *)current_pkt_ptr;
+
+    ip6_hdr->vtc_flow    = rte_cpu_to_be_32(6 << 28);
+    ip6_hdr->payload_len = rte_cpu_to_be_16(l4_len);
+    ip6_hdr->proto       = proto;
+    ip6_hdr->hop_limits  = 64;
+    memset(ip6_hdr->src_addr, 0, sizeof(ip6_hdr->src_addr)); // Parameter
+    memset(ip6_hdr->dst_addr, 0, sizeof(ip6_hdr->dst_addr)); // Parameter
+  } else {
+    ip_hdr = (struct rte_ipv4_hdr *)current_pkt_ptr;
+
+    ip_hdr->version_ihl     = RTE_IPV4_VHL_DEF;
+    ip_hdr->type_of_service = 0;
+    ip_hdr->total_length    = rte_cpu_to_be_16(size - tmpl.ip_offset);
+    ip_hdr->packet_id       = 0;
+    ip_hdr->fragment_offset = 0;
+    ip_hdr->time_to_live    = 64;
+    ip_hdr->next_proto_id   = proto;
+    ip_hdr->hdr_checksum    = 0; // Parameter
+    ip_hdr->src_addr        = 0; // Parameter
+    ip_hdr->dst_addr        = 0; // Parameter
+  }
+  current_pkt_size += ip_hdr_size;
+  current_pkt_ptr += ip_hdr_size;
+
+  const byte_t *l4_start = current_pkt_ptr;
+  tmpl.l4_offset         = l4_start - pkt;
+
+  struct rte_udp_hdr *udp_hdr = nullptr;
+  if (proto == IPPROTO_TCP) {
+    // Initialize the TCP header. Unless connections are stateful (see tcp.h), there is no connection behind it: just the configured
+    // flags (an ACK by default) carrying the payload.
+    struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)current_pkt_ptr;
+    current_pkt_size += sizeof(rte_tcp_hdr);
+    current_pkt_ptr += sizeof(rte_tcp_hdr);
+
+    tcp_hdr->src_port  = 0; // Parameter
+    tcp_hdr->dst_port  = 0; // Parameter
+    tcp_hdr->sent_seq  = 0;
+    tcp_hdr->recv_ack  = 0;
+    tcp_hdr->data_off  = (sizeof(rte_tcp_hdr) / 4) << 4;
+    tcp_hdr->tcp_flags = tcp_conns_enabled() ? 0 : config.tcp_flags; // Parameter in stateful mode
+    tcp_hdr->rx_win    = rte_cpu_to_be_16(UINT16_MAX);
+    tcp_hdr->cksum     = 0; // Parameter
+    tcp_hdr->tcp_urp   = 0;
+
+    tmpl.l4_cksum_offset = (const byte_t *)&tcp_hdr->cksum - pkt;
+  } else {
+    // Initialize the UDP header
+    udp_hdr = (struct rte_udp_hdr *)current_pkt_ptr;
+    current_pkt_size += sizeof(rte_udp_hdr);
+    current_pkt_ptr += sizeof(rte_udp_hdr);
+
+    udp_hdr->src_port    = 0; // Parameter
+    udp_hdr->dst_port    = 0; // Parameter
+    udp_hdr->dgram_cksum = 0; // Parameter
+    udp_hdr->dgram_len   = rte_cpu_to_be_16(l4_len);
+
+    tmpl.l4_cksum_offset = (const byte_t *)&udp_hdr->dgram_cksum - pkt;
+  }
+
+  struct kvs_hdr_t *kvs_hdr = nullptr;
+  if (config.kvs_mode) {
+    udp_hdr->dst_port = rte_cpu_to_be_16(KVSTORE_PORT);
+
+    kvs_hdr = (struct kvs_hdr_t *)(udp_hdr + 1);
+    current_pkt_size += sizeof(kvs_hdr_t);
+    current_pkt_ptr += sizeof(kvs_hdr_t);
+
+    kvs_hdr->op = KVS_OP_PUT;
+    memset(kvs_hdr->key, 0, KEY_SIZE_BYTES);
+    memset(kvs_hdr->value, 0, MAX_VALUE_SIZE_BYTES);
+    kvs_hdr->status      = KVS_STATUS_MISS;
+    kvs_hdr->client_port = 0;
+  }
+
+  constexpr uint16_t max_pkt_size_no_crc = MAX_PKT_SIZE - RTE_ETHER_CRC_LEN;
+
+  byte_t *payload      = current_pkt_ptr;
+  bytes_t payload_size = max_pkt_size_no_crc - current_pkt_size;
+  memset(payload, 0xff, payload_size);
+
+  if (probe_hdr_enabled()) {
+    memset(pkt + tmpl.probe_offset, 0, sizeof(probe_hdr_t));
+  }
+
+  // Checksum partial sums. Per-flow fields are still zero here, so they drop out on their own, except for the KVS header which is
+  // skipped explicitly. The IPv6 pseudo-header has the same length and protocol words, just wider addresses, which are all per-flow.
+  const byte_t *l4_end = pkt + size;
+
+  uint32_t phdr_sum = 0;
+  phdr_sum          = cksum_add16(phdr_sum, rte_cpu_to_be_16(proto));
+  phdr_sum          = cksum_add16(phdr_sum, rte_cpu_to_be_16(l4_len));
+  if (ip_hdr) {
+    phdr_sum = cksum_add32(phdr_sum, ip_hdr->dst_addr);
+  }
+
+  uint32_t l4_sum = phdr_sum;
+  if (kvs_hdr) {
+    const byte_t *kvs_variable_end = (const byte_t *)kvs_hdr + KVS_HDR_VARIABLE_BYTES;
+    l4_sum                         = cksum_add_bytes(l4_sum, l4_start, (const byte_t *)kvs_hdr - l4_start);
+    l4_sum                         = cksum_add_bytes(l4_sum, kvs_variable_end, l4_end - kvs_variable_end);
+  } else {
+    l4_sum = cksum_add_bytes(l4_sum, l4_start, l4_end - l4_start);
+  }
+
+  tmpl.ip_cksum_base      = ip_hdr ? cksum_add_bytes(0, (const byte_t *)ip_hdr, sizeof(rte_ipv4_hdr)) : 0;
+  tmpl.l4_cksum_base      = l4_sum;
+  tmpl.l4_phdr_cksum_base = phdr_sum;
+
+  if (cksum_offload) {
+    const bool tcp          = (proto == IPPROTO_TCP);
+    const uint64_t l3_flags = config.ipv6 ? RTE_MBUF_F_TX_IPV6 : (RTE_MBUF_F_TX_IPV4 | RTE_MBUF_F_TX_IP_CKSUM);
+    const bytes_t l4_size   = tcp ? sizeof(rte_tcp_hdr) : sizeof(rte_udp_hdr);
+    tmpl.ol_flags           = l3_flags | (tcp ? RTE_MBUF_F_TX_TCP_CKSUM : RTE_MBUF_F_TX_UDP_CKSUM);
+
+    // With a tunnel, the NIC takes everything from the outer L4 header up to the inner IP header as the (inner) L2 header.
+    const encap_t &encap = config.encap;
+    if (encap_has_tunnel(encap)) {
+      const bytes_t outer_l2_len = sizeof(rte_ether_hdr) + encap.num_vlans * sizeof(rte_vlan_hdr);
+      const bytes_t outer_l3_len = sizeof(rte_ipv4_hdr);
+      const bool outer_udp       = (encap.tunnel != ENCAP_TUNNEL_GRE);
+
+      tmpl.ol_flags |= RTE_MBUF_F_TX_OUTER_IPV4 | RTE_MBUF_F_TX_OUTER_IP_CKSUM;
+      tmpl.ol_flags |= (outer_udp && outer_udp_cksum_offload) ? RTE_MBUF_F_TX_OUTER_UDP_CKSUM : 0;
+      switch (encap.tunnel) {
+      case ENCAP_TUNNEL_VXLAN:
+        tmpl.ol_flags |= RTE_MBUF_F_TX_TUNNEL_VXLAN;
+        break;
+      case ENCAP_TUNNEL_GRE:
+        tmpl.ol_flags |= RTE_MBUF_F_TX_TUNNEL_GRE;
+        break;
+      case ENCAP_TUNNEL_GTPU:
+        tmpl.ol_flags |= RTE_MBUF_F_TX_TUNNEL_GTP;
+        break;
+      case ENCAP_TUNNEL_NONE:
+        break;
+      }
+      tmpl.tx_offload = rte_mbuf_tx_offload(tmpl.ip_offset - (outer_l2_len + outer_l3_len), ip_hdr_size, l4_size, 0, outer_l3_len,
+                                            outer_l2_len, 0);
+    } else {
+      tmpl.tx_offload = rte_mbuf_tx_offload(tmpl.ip_offset, ip_hdr_size, l4_size, 0, 0, 0, 0);
+    }
+  } else {
+    tmpl.ol_flags   = 0;
+    tmpl.tx_offload = 0;
+  }
+}
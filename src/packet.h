@@ -0,0 +1,257 @@
+#pragma once
+
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_memcpy.h>
+#include <rte_tcp.h>
+#include <rte_udp.h>
+
+#include "types.h"
+#include "flows.h"
+#include "encap.h"
+
+// Source/destination MACs
+extern const struct rte_ether_addr src_mac;
+extern const struct rte_ether_addr dst_mac;
+
+// Leading bytes of the KVS header that vary per packet (op, key and value), rounded up to whole 16-bit words with the status byte.
+#define KVS_HDR_VARIABLE_BYTES (sizeof(uint8_t) + KEY_SIZE_BYTES + MAX_VALUE_SIZE_BYTES + sizeof(uint8_t))
+
+// Bytes that differ between templates of different protocols and sizes (headers and probe header), and so must be rewritten when a
+// buffer is reused for another template. The payload past them is the same for all.
+#define PKT_TEMPLATE_HDRS_LEN (sizeof(rte_ether_hdr) + ENCAP_MAX_LEN + sizeof(rte_ipv6_hdr) + sizeof(rte_tcp_hdr) + sizeof(probe_hdr_t))
+
+// Per-packet metadata first, so that it shares cache lines with the headers.
+struct pkt_template_t {
+  bytes_t size; // Without CRC
+  uint8_t proto;
+
+  // Where the (inner) IP header, the L4 header, the probe header and the L4 checksum go.
+  bytes_t ip_offset;
+  bytes_t l4_offset;
+  bytes_t probe_offset;
+  bytes_t l4_cksum_offset;
+
+  // One's complement sums of the template, leaving out every per-flow field. Per-packet checksums are then updated incrementally
+  // (RFC 1624), folding in only the words that changed. IPv6 has no IP checksum.
+  uint32_t ip_cksum_base;
+  uint32_t l4_cksum_base;
+  uint32_t l4_phdr_cksum_base;
+
+  // Per-flow fields of the encapsulation (see modify_encap()). Offsets are 0 for fields that are not there.
+  bytes_t encap_sport_offset;
+  bytes_t encap_id_offset;
+  uint32_t encap_id_base;
+  uint32_t encap_id_count;
+  uint8_t encap_id_shift;
+
+  // Used instead when the NIC computes the checksums.
+  uint64_t ol_flags;
+  uint64_t tx_offload;
+
+  byte_t pkt[MAX_PKT_SIZE];
+};
+
+// Builds a template packet of the given size (without CRC), over IPv6 if config.ipv6 and behind config.encap. Only UDP templates can
+// carry a KVS header. The outer UDP checksum of tunnels is only offloaded along with the others, and only if the NIC can.
+void generate_template_packet(pkt_template_t &tmpl, bytes_t size, uint8_t proto, bool cksum_offload, bool outer_udp_cksum_offload = false);
+
+static inline bytes_t get_ip_hdr_size(bool ipv6) { return ipv6 ? sizeof(rte_ipv6_hdr) : sizeof(rte_ipv4_hdr); }
+
+// Offset of the probe header: right after the L4 header, or after the KVS header in KVS mode. Encapsulation comes in front of all of it.
+static inline bytes_t get_probe_offset(bool kvs_mode, uint8_t proto, bool ipv6) {
+  const bytes_t l4_hdr_size = (proto == IPPROTO_TCP) ? sizeof(rte_tcp_hdr) : sizeof(rte_udp_hdr);
+  return sizeof(rte_ether_hdr) + get_encap_len(config.encap) + get_ip_hdr_size(ipv6) + l4_hdr_size + (kvs_mode ? sizeof(kvs_hdr_t) : 0);
+}
+
+// Smallest packet (with CRC) of the given protocol that still fits its headers, and the probe header if there is one.
+static inline bytes_t get_min_pkt_size(uint8_t proto) {
+  const bytes_t hdrs_size = get_probe_offset(config.kvs_mode, proto, config.ipv6) + (probe_hdr_enabled() ? sizeof(probe_hdr_t) : 0);
+  return RTE_MAX(MIN_PKT_SIZE, hdrs_size + RTE_ETHER_CRC_LEN);
+}
+
+static inline uint32_t cksum_add16(uint32_t sum, uint16_t word) { return sum + word; }
+
+static inline uint32_t cksum_add32(uint32_t sum, uint32_t word) { return sum + (word & 0xffff) + (word >> 16); }
+
+static inline uint16_t cksum_fold(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (uint16_t)sum;
+}
+
+// Adds data as 16-bit words in memory order, zero padding an odd trailing byte.
+static inline uint32_t cksum_add_bytes(uint32_t sum, const byte_t *data, bytes_t len) {
+  bytes_t i = 0;
+  for (; i + 1 < len; i += 2) {
+    uint16_t word;
+    memcpy(&word, data + i, sizeof(word));
+    sum += word;
+  }
+  if (i < len) {
+    uint16_t word = 0;
+    memcpy(&word, data + i, 1);
+    sum += word;
+  }
+  return sum;
+}
+
+// TCP fields that change along a connection (see tcp.h). Templates of stateful TCP have them zeroed.
+struct tcp_seg_t {
+  rte_be32_t seq;
+  rte_be32_t ack;
+  uint8_t flags;
+};
+
+// Writes the segment fields over the template's, returning their checksum words for modify_packet() to fold in.
+static inline uint32_t set_tcp_seg(byte_t *pkt, const pkt_template_t &tmpl, const tcp_seg_t &seg) {
+  struct rte_tcp_hdr *tcp_hdr = (struct rte_tcp_hdr *)(pkt + tmpl.l4_offset);
+  tcp_hdr->sent_seq           = seg.seq;
+  tcp_hdr->recv_ack           = seg.ack;
+  tcp_hdr->tcp_flags          = seg.flags;
+
+  // The flags share their word with the data offset, which the template already accounts for.
+  const byte_t flags_word[2] = {0, seg.flags};
+
+  uint32_t words = 0;
+  words          = cksum_add32(words, seg.seq);
+  words          = cksum_add32(words, seg.ack);
+  words          = cksum_add_bytes(words, flags_word, sizeof(flags_word));
+  return words;
+}
+
+// Writes the per-flow fields of the encapsulation: the VXLAN source port, spread over its range by a hash of the flow, and the tunnel
+// id, if flows are spread over more than one. No checksum covers them: GRE has none, and the outer UDP checksum is either zero or
+// left to the NIC.
+static inline void modify_encap(byte_t *pkt, const pkt_template_t &tmpl, uint64_t flow_idx) {
+  if (tmpl.encap_sport_offset != 0) {
+    const uint64_t hash       = flow_idx * 0x9e3779b97f4a7c15ull;
+    const rte_be16_t src_port = rte_cpu_to_be_16(ENCAP_SPORT_MIN | (hash >> (64 - ENCAP_SPORT_BITS)));
+    memcpy(pkt + tmpl.encap_sport_offset, &src_port, sizeof(src_port));
+  }
+  if (tmpl.encap_id_count > 1) {
+    const rte_be32_t id = rte_cpu_to_be_32((uint32_t)(tmpl.encap_id_base + flow_idx % tmpl.encap_id_count) << tmpl.encap_id_shift);
+    memcpy(pkt + tmpl.encap_id_offset, &id, sizeof(id));
+  }
+}
+
+// Brings a buffer holding some other template packet up to this one. The payload is common to all of them.
+static inline void copy_template_hdrs(byte_t *pkt, const pkt_template_t &tmpl) { rte_memcpy(pkt, tmpl.pkt, PKT_TEMPLATE_HDRS_LEN); }
+
+// Only the per-flow fields (and the probe header, if any) are written: everything else is already in place from the template packet.
+// Anything else written over the template goes into the L4 checksum through extra_l4_words (see set_tcp_seg()).
+template <bool kvs_mode, bool cksum_offload, bool probe>
+static inline void modify_packet(byte_t *pkt, const pkt_template_t &tmpl, const flow_t &flow, const kvs_flow_t *kvs_flow,
+                                 enum kvs_op kvs_op, const probe_hdr_t &probe_hdr, uint32_t extra_l4_words = 0) {
+  struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(pkt + tmpl.ip_offset);
+  struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(pkt + tmpl.l4_offset); // TCP has its ports in the same place
+
+  uint32_t ip_words = 0;
+  uint32_t l4_words = extra_l4_words;
+
+  if constexpr (kvs_mode) {
+    ip_hdr->src_addr  = flow.src_ip;
+    udp_hdr->src_port = flow.src_port;
+
+    struct kvs_hdr_t *kvs_hdr = (struct kvs_hdr_t *)(udp_hdr + 1);
+    kvs_hdr->op               = kvs_op;
+    memcpy(kvs_hdr->key, kvs_flow->key, KEY_SIZE_BYTES);
+    memcpy(kvs_hdr->value, kvs_flow->value, MAX_VALUE_SIZE_BYTES);
+
+    ip_words = cksum_add32(ip_words, flow.src_ip);
+    l4_words = cksum_add16(l4_words, flow.src_port);
+    if constexpr (!cksum_offload) {
+      l4_words = cksum_add_bytes(l4_words, (const byte_t *)kvs_hdr, KVS_HDR_VARIABLE_BYTES);
+    }
+  } else {
+    (void)kvs_flow;
+    (void)kvs_op;
+    ip_hdr->src_addr  = flow.src_ip;
+    udp_hdr->src_port = flow.src_port;
+    ip_hdr->dst_addr  = flow.dst_ip;
+    udp_hdr->dst_port = flow.dst_port;
+
+    ip_words = cksum_add32(ip_words, flow.src_ip);
+    ip_words = cksum_add32(ip_words, flow.dst_ip);
+    l4_words = cksum_add16(l4_words, flow.src_port);
+    l4_words = cksum_add16(l4_words, flow.dst_port);
+  }
+
+  if constexpr (probe) {
+    // Always written, even when zeroed out, as buffers are reused. The template has it zeroed, so only actual probes change the sum.
+    memcpy(pkt + tmpl.probe_offset, &probe_hdr, sizeof(probe_hdr_t));
+    if constexpr (!cksum_offload) {
+      if (probe_hdr.magic == PROBE_MAGIC) {
+        l4_words = cksum_add_bytes(l4_words, (const byte_t *)&probe_hdr, sizeof(probe_hdr_t));
+      }
+    }
+  } else {
+    (void)probe_hdr;
+  }
+
+  uint16_t l4_cksum;
+  if constexpr (cksum_offload) {
+    // The NIC fills in the IP checksum and the rest of the L4 checksum, it only needs the pseudo-header sum.
+    l4_cksum = cksum_fold(tmpl.l4_phdr_cksum_base + ip_words);
+  } else {
+    ip_hdr->hdr_checksum = ~cksum_fold(tmpl.ip_cksum_base + ip_words);
+
+    // The pseudo-header repeats the IP addresses. Zero means no checksum for UDP, and is the same as 0xffff for TCP.
+    l4_cksum = ~cksum_fold(tmpl.l4_cksum_base + ip_words + l4_words);
+    l4_cksum = (l4_cksum == 0) ? 0xffff : l4_cksum;
+  }
+  memcpy(pkt + tmpl.l4_cksum_offset, &l4_cksum, sizeof(l4_cksum));
+}
+
+// Same, for IPv6 flows. There is no IP checksum, but the addresses take a bigger share of the L4 one.
+template <bool cksum_offload, bool probe>
+static inline void modify_packet6(byte_t *pkt, const pkt_template_t &tmpl, const flow6_t &flow, const probe_hdr_t &probe_hdr,
+                                  uint32_t extra_l4_words = 0) {
+  struct rte_ipv6_hdr *ip_hdr = (struct rte_ipv6_hdr *)(pkt + tmpl.ip_offset);
+  struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(pkt + tmpl.l4_offset); // TCP has its ports in the same place
+
+  memcpy(ip_hdr->src_addr, flow.src_ip, sizeof(flow.src_ip));
+  memcpy(ip_hdr->dst_addr, flow.dst_ip, sizeof(flow.dst_ip));
+  udp_hdr->src_port = flow.src_port;
+  udp_hdr->dst_port = flow.dst_port;
+
+  uint32_t phdr_words = 0;
+  phdr_words          = cksum_add_bytes(phdr_words, flow.src_ip, sizeof(flow.src_ip));
+  phdr_words          = cksum_add_bytes(phdr_words, flow.dst_ip, sizeof(flow.dst_ip));
+
+  uint32_t l4_words = extra_l4_words;
+  l4_words          = cksum_add16(l4_words, flow.src_port);
+  l4_words          = cksum_add16(l4_words, flow.dst_port);
+
+  if constexpr (probe) {
+    memcpy(pkt + tmpl.probe_offset, &probe_hdr, sizeof(probe_hdr_t));
+    if constexpr (!cksum_offload) {
+      if (probe_hdr.magic == PROBE_MAGIC) {
+        l4_words = cksum_add_bytes(l4_words, (const byte_t *)&probe_hdr, sizeof(probe_hdr_t));
+      }
+    }
+  } else {
+    (void)probe_hdr;
+  }
+
+  uint16_t l4_cksum;
+  if constexpr (cksum_offload) {
+    l4_cksum = cksum_fold(tmpl.l4_phdr_cksum_base + phdr_words);
+  } else {
+    // Unlike IPv4, a zero UDP checksum is not allowed: it is sent as 0xffff.
+    l4_cksum = ~cksum_fold(tmpl.l4_cksum_base + phdr_words + l4_words);
+    l4_cksum = (l4_cksum == 0) ? 0xffff : l4_cksum;
+  }
+  memcpy(pkt + tmpl.l4_cksum_offset, &l4_cksum, sizeof(l4_cksum));
+}
+
+template <bool cksum_offload> static inline void set_mbuf_offloads(struct rte_mbuf *mbuf, const pkt_template_t &tmpl) {
+  if constexpr (cksum_offload) {
+    mbuf->ol_flags   = tmpl.ol_flags;
+    mbuf->tx_offload = tmpl.tx_offload;
+  } else {
+    (void)mbuf;
+    (void)tmpl;
+  }
+}
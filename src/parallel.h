@@ -0,0 +1,45 @@
+#pragma once
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// The EAL pins the main lcore, and threads inherit its affinity. Workload setup runs before any worker does, so it may use every core.
+static inline void unpin_thread() {
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  for (long cpu = 0; cpu < num_cpus && cpu < CPU_SETSIZE; cpu++) {
+    CPU_SET(cpu, &cpus);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+// Runs fn(chunk) for every chunk in [0, num_chunks), handed out in order to num_threads threads (the calling one among them). Whatever
+// only depends on the chunk comes out the same for any number of threads.
+template <typename fn_t> static inline void parallel_for_chunks(uint64_t num_chunks, unsigned num_threads, const fn_t &fn) {
+  std::atomic<uint64_t> next_chunk{0};
+  const auto run = [&] {
+    for (uint64_t chunk = next_chunk.fetch_add(1); chunk < num_chunks; chunk = next_chunk.fetch_add(1)) {
+      fn(chunk);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (uint64_t i = 1; i < std::min<uint64_t>(num_threads, num_chunks); i++) {
+    threads.emplace_back([&run] {
+      unpin_thread();
+      run();
+    });
+  }
+  run();
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,893 @@
+#include "pcap_loader.h"
+#include "pcap_reader.h"
+#include "parallel.h"
+#include "flat_index.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+#include <rte_prefetch.h>
+
+#include <zstd.h>
+
+// Decoded bytes are handed over to the parsers in chunks of this size.
+#define PCAP_CHUNK_SIZE (4 * 1024 * 1024)
+
+// Chunks decoded ahead of the splitter, per zstd frame.
+#define PCAP_FRAME_QUEUE_DEPTH 4
+
+// Batches in flight (queued, being parsed or waiting to be merged), per parser.
+#define PCAP_BATCHES_PER_PARSER 4
+
+// Uncompressed files are read straight from the mapping. The kernel is asked to read this far ahead of the splitter.
+#define PCAP_READAHEAD_SIZE (64 * 1024 * 1024)
+
+// Records parsed ahead of the packet whose headers are prefetched.
+#define PCAP_PREFETCH_DISTANCE 8
+
+// Records larger than this are taken as a sign of a corrupted file (same limits as libpcap).
+#define PCAP_MAX_RECORD_SIZE (256 * 1024)
+#define PCAPNG_MAX_BLOCK_SIZE (16 * 1024 * 1024)
+
+#define PCAP_DEDUP_SHARD_BITS 6
+#define PCAP_DEDUP_SHARDS (1 << PCAP_DEDUP_SHARD_BITS)
+// Flow references (see parsed_batch_t) take 32 bits, like the flow indexes they end up as, which then stay below 2^32 too.
+#define PCAP_DEDUP_SHARD_MAX_FLOWS ((1u << (32 - PCAP_DEDUP_SHARD_BITS)) - 1)
+
+namespace {
+
+const uint8_t zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+
+// Enough to tell a pcap from a pcapng.
+#define PCAP_MAGIC_SIZE 4
+
+typedef std::chrono::steady_clock loader_clock_t;
+
+// Time spent by the threads of a stage actually working (not waiting on other stages), and how much they got through.
+struct stage_stats_t {
+  const char *name;
+  unsigned num_threads;
+  std::atomic<uint64_t> busy_ns;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> pkts;
+
+  stage_stats_t(const char *_name, unsigned _num_threads) : name(_name), num_threads(_num_threads), busy_ns(0), bytes(0), pkts(0) {}
+};
+
+struct busy_timer_t {
+  stage_stats_t &stats;
+  const loader_clock_t::time_point start;
+
+  busy_timer_t(stage_stats_t &_stats) : stats(_stats), start(loader_clock_t::now()) {}
+  ~busy_timer_t() {
+    stats.busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(loader_clock_t::now() - start).count();
+  }
+};
+
+// Bounded blocking queue, closed by the producer once it is done.
+template <typename T> struct work_queue_t {
+  std::mutex lock;
+  std::condition_variable not_full;
+  std::condition_variable not_empty;
+  std::deque<T> items;
+  const size_t capacity;
+  bool closed;
+
+  work_queue_t(size_t _capacity) : capacity(_capacity), closed(false) {}
+
+  void push(T &&item) {
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [&] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+  }
+
+  // False once the queue is closed and drained.
+  bool pop(T &item) {
+    std::unique_lock<std::mutex> guard(lock);
+    not_empty.wait(guard, [&] { return !items.empty() || closed; });
+    if (items.empty()) {
+      return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    not_empty.notify_all();
+  }
+};
+
+typedef std::vector<uint8_t> chunk_t;
+
+// Unit of input decoded in order by a single thread.
+struct frame_t {
+  const uint8_t *src;
+  size_t src_size;
+  work_queue_t<chunk_t> chunks;
+
+  frame_t(const uint8_t *_src, size_t _src_size) : src(_src), src_size(_src_size), chunks(PCAP_FRAME_QUEUE_DEPTH) {}
+};
+
+// Decode stage, for compressed files. The file is mapped, and its zstd frames handed out in order to the decoder threads. The splitter
+// then reads the decoded chunks back frame by frame, so the stream comes out in order even though frames are decoded in parallel.
+struct decoder_t {
+  const uint8_t *data;
+  size_t size;
+  size_t max_frames_in_flight;
+  stage_stats_t &stats;
+
+  std::mutex lock;
+  std::condition_variable frames_changed;
+  size_t next_offset;
+  std::deque<std::shared_ptr<frame_t>> frames;
+
+  decoder_t(const uint8_t *_data, size_t _size, size_t _max_frames_in_flight, stage_stats_t &_stats)
+      : data(_data), size(_size), max_frames_in_flight(_max_frames_in_flight), stats(_stats), next_offset(0) {}
+
+  // Takes the next frame to decode, or nullptr once there are none left.
+  std::shared_ptr<frame_t> take_frame() {
+    std::unique_lock<std::mutex> guard(lock);
+    frames_changed.wait(guard, [&] { return frames.size() < max_frames_in_flight || next_offset == size; });
+    if (next_offset == size) {
+      return nullptr;
+    }
+
+    const size_t frame_size = ZSTD_findFrameCompressedSize(data + next_offset, size - next_offset);
+    if (ZSTD_isError(frame_size)) {
+      panic("Corrupted zstd frame at offset %zu: %s", next_offset, ZSTD_getErrorName(frame_size));
+    }
+
+    std::shared_ptr<frame_t> frame = std::make_shared<frame_t>(data + next_offset, frame_size);
+    next_offset += frame_size;
+    frames.push_back(frame);
+    frames_changed.notify_all();
+    return frame;
+  }
+
+  void decode_frame(ZSTD_DCtx *dctx, frame_t &frame) {
+    ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+    ZSTD_inBuffer input = {frame.src, frame.src_size, 0};
+
+    size_t ret = 1;
+    while (ret != 0) {
+      chunk_t chunk;
+      {
+        busy_timer_t timer(stats);
+        chunk.resize(PCAP_CHUNK_SIZE);
+        ZSTD_outBuffer output = {chunk.data(), chunk.size(), 0};
+        while (output.pos < output.size) {
+          ret = ZSTD_decompressStream(dctx, &output, &input);
+          if (ZSTD_isError(ret)) {
+            panic("Decompression failed: %s", ZSTD_getErrorName(ret));
+          }
+          if (ret == 0) {
+            break;
+          }
+          if (input.pos == input.size && output.pos < output.size) {
+            panic("Truncated zstd frame");
+          }
+        }
+        chunk.resize(output.pos);
+      }
+
+      stats.bytes += chunk.size();
+      if (!chunk.empty()) {
+        frame.chunks.push(std::move(chunk));
+      }
+    }
+    frame.chunks.close();
+  }
+
+  void run() {
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    while (std::shared_ptr<frame_t> frame = take_frame()) {
+      decode_frame(dctx, *frame);
+    }
+    ZSTD_freeDCtx(dctx);
+  }
+
+  // Next chunk of the decoded stream, in order. False at the end of the stream.
+  bool next_chunk(chunk_t &chunk) {
+    while (true) {
+      std::shared_ptr<frame_t> frame;
+      {
+        std::unique_lock<std::mutex> guard(lock);
+        frames_changed.wait(guard, [&] { return !frames.empty() || next_offset == size; });
+        if (frames.empty()) {
+          return false;
+        }
+        frame = frames.front();
+      }
+
+      if (frame->chunks.pop(chunk)) {
+        return true;
+      }
+
+      std::lock_guard<std::mutex> guard(lock);
+      frames.pop_front();
+      frames_changed.notify_all();
+    }
+  }
+};
+
+// Whole records, ready to be parsed. Records straddling two decoded chunks are stitched back together apart, so chunks are never
+// copied. Uncompressed files are not copied at all: their records are parsed right from the mapping. The records of a pcapng are its
+// blocks, and the interfaces they refer to are those of the section as it was where the batch starts.
+struct batch_t {
+  uint64_t seq;
+  chunk_t stitched;
+  chunk_t chunk; // Owns the records, unless they are in the mapping
+  const uint8_t *records;
+  size_t size;
+  std::shared_ptr<const pcapng_section_t> section;
+};
+
+// Section headers and interface descriptions change the state of their pcapng section. Batches cut before them still point to the
+// previous state, so it is copied rather than changed in place. Returns whether the block was one of those.
+bool update_section(std::shared_ptr<const pcapng_section_t> &section, const uint8_t *block, const pcapng_block_hdr_t &hdr) {
+  if (hdr.type != PCAPNG_BLOCK_SHB && hdr.type != PCAPNG_BLOCK_IDB) {
+    return false;
+  }
+  std::shared_ptr<pcapng_section_t> updated = std::make_shared<pcapng_section_t>(*section);
+  parse_pcapng_section_block(block, hdr, *updated);
+  section = std::move(updated);
+  return true;
+}
+
+struct parsed_batch_t {
+  uint64_t num_pkts;
+  std::vector<pcap_pkt_meta_t> metas;
+  // Flow of each packet in metas, as (id within its dedup shard << PCAP_DEDUP_SHARD_BITS) | shard.
+  std::vector<uint32_t> flow_refs;
+};
+
+template <typename flow_type> struct alignas(64) dedup_shard_t {
+  std::mutex lock;
+  flat_index_t<flow_type, flow_comp_t> ids;
+  std::vector<flow_type> flows;
+  // Earliest position each flow was seen at, as (batch << 32) | index in batch, to number flows in capture order at the end.
+  std::vector<uint64_t> first_pos;
+};
+
+// From the low bits of the hash, as the flat index within the shard takes its high ones.
+static inline unsigned get_dedup_shard(uint64_t hash) { return hash & (PCAP_DEDUP_SHARDS - 1); }
+
+// Caps how many batches are in flight, so memory stays bounded however far ahead the splitter gets.
+struct batch_slots_t {
+  std::mutex lock;
+  std::condition_variable released;
+  size_t available;
+
+  batch_slots_t(size_t _available) : available(_available) {}
+
+  void acquire() {
+    std::unique_lock<std::mutex> guard(lock);
+    released.wait(guard, [&] { return available > 0; });
+    available--;
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> guard(lock);
+    available++;
+    released.notify_one();
+  }
+};
+
+// Parsed batches wait here until every batch before them has been merged.
+struct merge_queue_t {
+  std::mutex lock;
+  std::condition_variable ready;
+  std::map<uint64_t, parsed_batch_t> batches;
+  uint64_t total_batches;
+  bool splitter_done;
+
+  merge_queue_t() : total_batches(0), splitter_done(false) {}
+
+  void push(uint64_t seq, parsed_batch_t &&batch) {
+    std::lock_guard<std::mutex> guard(lock);
+    batches.emplace(seq, std::move(batch));
+    ready.notify_one();
+  }
+
+  void finish(uint64_t _total_batches) {
+    std::lock_guard<std::mutex> guard(lock);
+    total_batches = _total_batches;
+    splitter_done = true;
+    ready.notify_one();
+  }
+
+  // False once every batch has been merged.
+  bool pop(uint64_t seq, parsed_batch_t &batch) {
+    std::unique_lock<std::mutex> guard(lock);
+    ready.wait(guard, [&] { return batches.count(seq) > 0 || (splitter_done && seq == total_batches); });
+    auto found = batches.find(seq);
+    if (found == batches.end()) {
+      return false;
+    }
+    batch = std::move(found->second);
+    batches.erase(found);
+    return true;
+  }
+};
+
+// Flows are either IPv4 (flow_t) or IPv6 (flow6_t) ones, the packets of the other family have none.
+template <typename flow_type> struct pipeline_t {
+  decoder_t *decoder;
+  work_queue_t<batch_t> parse_queue;
+  batch_slots_t slots;
+  merge_queue_t merge_queue;
+  dedup_shard_t<flow_type> shards[PCAP_DEDUP_SHARDS];
+
+  pcap_format_t format;
+  bool pcapng;
+  // Section the splitter is in, for pcapng.
+  std::shared_ptr<const pcapng_section_t> section;
+
+  stage_stats_t &split_stats;
+  stage_stats_t &parse_stats;
+  stage_stats_t &dedup_stats;
+
+  pipeline_t(decoder_t *_decoder, size_t max_batches, stage_stats_t &_split_stats, stage_stats_t &_parse_stats,
+             stage_stats_t &_dedup_stats)
+      : decoder(_decoder), parse_queue(max_batches), slots(max_batches), format(), pcapng(false),
+        section(std::make_shared<const pcapng_section_t>()), split_stats(_split_stats), parse_stats(_parse_stats),
+        dedup_stats(_dedup_stats) {}
+
+  uint64_t next_seq = 0;
+
+  void emit(batch_t &&batch) {
+    batch.seq = next_seq++;
+    slots.acquire();
+    parse_queue.push(std::move(batch));
+  }
+
+  void finish() {
+    parse_queue.close();
+    merge_queue.finish(next_seq);
+  }
+
+  // Cuts an uncompressed file into batches of whole records, without copying it. Walking the record headers is what faults the file
+  // in, so the kernel is asked to read ahead of it.
+  void split_mapped(const uint8_t *data, size_t size) {
+    if (size < PCAP_FILE_HDR_SIZE) {
+      WARNING("Ignoring a truncated pcap (%zu bytes).", size);
+      finish();
+      return;
+    }
+
+    // A pcapng has no file header of its own, it starts right away with the block heading its first section.
+    check_file_format(data);
+    size_t pos = 0;
+    if (!pcapng) {
+      format = parse_pcap_file_hdr(data);
+      pos    = PCAP_FILE_HDR_SIZE;
+    }
+
+    const uintptr_t page_mask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+    size_t advised            = 0;
+
+    while (true) {
+      batch_t batch;
+      batch.section      = section;
+      const size_t begin = pos;
+
+      {
+        busy_timer_t timer(split_stats);
+
+        if (advised < size && pos + PCAP_READAHEAD_SIZE / 2 > advised) {
+          const uintptr_t start = (uintptr_t)(data + advised) & page_mask;
+          const size_t len      = std::min((size_t)PCAP_READAHEAD_SIZE, size - advised);
+          madvise((void *)start, (uintptr_t)(data + advised + len) - start, MADV_WILLNEED);
+          advised += len;
+        }
+
+        while (size - pos >= get_record_hdr_size() && pos - begin < PCAP_CHUNK_SIZE) {
+          const size_t record_size = get_record_size(data + pos);
+          if (size - pos < record_size) {
+            break;
+          }
+          track_record(data + pos);
+          pos += record_size;
+        }
+      }
+
+      if (pos == begin) {
+        break;
+      }
+
+      split_stats.bytes += pos - begin;
+      batch.records = data + begin;
+      batch.size    = pos - begin;
+      emit(std::move(batch));
+    }
+
+    if (pos < size) {
+      WARNING("Ignoring a truncated record at the end of the pcap (%zu bytes).", size - pos);
+    }
+
+    finish();
+  }
+
+  // Cuts the decoded stream into batches of whole records.
+  void split_decoded() {
+    bool have_magic  = false;
+    bool have_format = false;
+    chunk_t carry; // Start of a record (or of the file header) cut short by the end of the previous chunk.
+    chunk_t chunk;
+
+    // How long what is being carried over will be once whole.
+    auto carry_size = [&]() -> size_t {
+      if (!have_magic) {
+        return PCAP_MAGIC_SIZE;
+      }
+      if (!have_format) {
+        return PCAP_FILE_HDR_SIZE;
+      }
+      if (carry.size() < get_record_hdr_size()) {
+        return get_record_hdr_size();
+      }
+      return get_record_size(carry.data());
+    };
+
+    while (decoder->next_chunk(chunk)) {
+      batch_t batch;
+      batch.section = section;
+      size_t pos    = 0;
+      size_t begin;
+
+      {
+        busy_timer_t timer(split_stats);
+
+        while ((!carry.empty() || !have_format) && pos < chunk.size()) {
+          const size_t take = std::min(carry_size() - carry.size(), chunk.size() - pos);
+          carry.insert(carry.end(), chunk.begin() + pos, chunk.begin() + pos + take);
+          pos += take;
+
+          if (carry.size() == carry_size()) {
+            if (!have_magic) {
+              // A pcapng has no file header of its own, what was read is the start of its first block.
+              check_file_format(carry.data());
+              have_magic  = true;
+              have_format = pcapng;
+            } else if (!have_format) {
+              format      = parse_pcap_file_hdr(carry.data());
+              have_format = true;
+              carry.clear();
+            } else {
+              track_record(carry.data());
+              batch.stitched.insert(batch.stitched.end(), carry.begin(), carry.end());
+              carry.clear();
+            }
+          }
+        }
+
+        begin = pos;
+        while (chunk.size() - pos >= get_record_hdr_size()) {
+          const size_t record_size = get_record_size(chunk.data() + pos);
+          if (chunk.size() - pos < record_size) {
+            break;
+          }
+          track_record(chunk.data() + pos);
+          pos += record_size;
+        }
+        carry.insert(carry.end(), chunk.begin() + pos, chunk.end());
+      }
+
+      split_stats.bytes += chunk.size();
+
+      if (batch.stitched.empty() && begin == pos) {
+        continue;
+      }
+
+      batch.chunk   = std::move(chunk);
+      batch.records = batch.chunk.data() + begin;
+      batch.size    = pos - begin;
+      chunk         = chunk_t();
+      emit(std::move(batch));
+    }
+
+    if (!carry.empty()) {
+      WARNING("Ignoring a truncated record at the end of the pcap (%zu bytes).", carry.size());
+    }
+
+    finish();
+  }
+
+  // What has to be read of a record to know its size.
+  size_t get_record_hdr_size() const { return pcapng ? PCAPNG_BLOCK_HDR_SIZE : PCAP_RECORD_HDR_SIZE; }
+
+  size_t get_record_size(const uint8_t *record_hdr) const {
+    if (pcapng) {
+      bool swapped                 = section->swapped;
+      const pcapng_block_hdr_t hdr = parse_pcapng_block_hdr(swapped, record_hdr);
+      if (hdr.len < PCAPNG_BLOCK_HDR_SIZE || hdr.len % 4 != 0 || hdr.len > PCAPNG_MAX_BLOCK_SIZE) {
+        panic("Corrupted pcapng: block of %u bytes", hdr.len);
+      }
+      return hdr.len;
+    }
+
+    const pcap_record_hdr_t record = parse_pcap_record_hdr(format, record_hdr);
+    if (record.caplen > PCAP_MAX_RECORD_SIZE) {
+      panic("Corrupted pcap: record of %u bytes", record.caplen);
+    }
+    return PCAP_RECORD_HDR_SIZE + record.caplen;
+  }
+
+  // Keeps up with the pcapng section, as the splitter goes through whole records.
+  void track_record(const uint8_t *record) {
+    if (!pcapng) {
+      return;
+    }
+
+    bool swapped                 = section->swapped;
+    const pcapng_block_hdr_t hdr = parse_pcapng_block_hdr(swapped, record);
+    if (update_section(section, record, hdr) && hdr.type == PCAPNG_BLOCK_IDB) {
+      const pcapng_iface_t &iface = section->ifaces.back();
+      if (iface.format.link == PCAP_LINK_UNSUPPORTED) {
+        WARNING("Unsupported link type (%u) on pcapng interface %zu, none of its packets will have a flow.", iface.format.link_hdr_type,
+                section->ifaces.size() - 1);
+      }
+    }
+  }
+
+  void check_file_format(const uint8_t *file_hdr) {
+    pcapng = is_pcapng_magic(file_hdr);
+    if (!pcapng && !is_pcap_magic(file_hdr)) {
+      panic("Unknown file format");
+    }
+  }
+
+  void add_packet(const packet_t &packet, std::vector<flow_type> &batch_flows, parsed_batch_t &parsed) {
+    const std::optional<flow_type> *flow;
+    if constexpr (std::is_same_v<flow_type, flow6_t>) {
+      flow = &packet.flow6;
+    } else {
+      flow = &packet.flow;
+    }
+
+    parsed.num_pkts++;
+    if (flow->has_value()) {
+      batch_flows.push_back(flow->value());
+      parsed.metas.push_back({packet.ts, packet.total_len, packet.proto});
+    }
+  }
+
+  // Walks the record headers first, so that the packet headers can then be prefetched a few records ahead of parsing them.
+  void parse_records(const uint8_t *data, size_t size, std::vector<size_t> &offsets, std::vector<flow_type> &batch_flows,
+                     parsed_batch_t &parsed) {
+    offsets.clear();
+    for (size_t pos = 0; pos < size; pos += PCAP_RECORD_HDR_SIZE + parse_pcap_record_hdr(format, data + pos).caplen) {
+      offsets.push_back(pos);
+    }
+
+    packet_t packet;
+    for (size_t i = 0; i < offsets.size(); i++) {
+      if (i + PCAP_PREFETCH_DISTANCE < offsets.size()) {
+        const uint8_t *ahead = data + offsets[i + PCAP_PREFETCH_DISTANCE];
+        rte_prefetch0(ahead);
+        rte_prefetch0(ahead + RTE_CACHE_LINE_SIZE);
+      }
+
+      const uint8_t *record_hdr      = data + offsets[i];
+      const pcap_record_hdr_t record = parse_pcap_record_hdr(format, record_hdr);
+      parse_packet(record_hdr + PCAP_RECORD_HDR_SIZE, record, format, packet);
+      add_packet(packet, batch_flows, parsed);
+    }
+  }
+
+  // Same for the blocks of a pcapng, keeping up with the changes to its section along the way.
+  void parse_blocks(const uint8_t *data, size_t size, std::shared_ptr<const pcapng_section_t> &batch_section,
+                    std::vector<size_t> &offsets, std::vector<flow_type> &batch_flows, parsed_batch_t &parsed) {
+    offsets.clear();
+    bool swapped = batch_section->swapped;
+    for (size_t pos = 0; pos < size; pos += parse_pcapng_block_hdr(swapped, data + pos).len) {
+      offsets.push_back(pos);
+    }
+
+    packet_t packet;
+    pcap_record_hdr_t record;
+    const uint8_t *pkt;
+    const pcap_format_t *pkt_format;
+    for (size_t i = 0; i < offsets.size(); i++) {
+      if (i + PCAP_PREFETCH_DISTANCE < offsets.size()) {
+        const uint8_t *ahead = data + offsets[i + PCAP_PREFETCH_DISTANCE];
+        rte_prefetch0(ahead);
+        rte_prefetch0(ahead + RTE_CACHE_LINE_SIZE);
+      }
+
+      const uint8_t *block         = data + offsets[i];
+      bool block_swapped           = batch_section->swapped;
+      const pcapng_block_hdr_t hdr = parse_pcapng_block_hdr(block_swapped, block);
+      if (update_section(batch_section, block, hdr) || !parse_pcapng_pkt_block(block, hdr, *batch_section, record, pkt, pkt_format)) {
+        continue;
+      }
+
+      parse_packet(pkt, record, *pkt_format, packet);
+      add_packet(packet, batch_flows, parsed);
+    }
+  }
+
+  // Looks up every flow of the batch in its shard, taking each shard lock only once per batch.
+  void dedup(uint64_t seq, const std::vector<flow_type> &batch_flows, parsed_batch_t &parsed) {
+    // Hashed all at once, before any lock is taken.
+    std::vector<uint64_t> hashes(batch_flows.size());
+    for (size_t i = 0; i < batch_flows.size(); i++) {
+      hashes[i] = flow_hash_t()(batch_flows[i]);
+    }
+
+    std::vector<uint32_t> shard_counts(PCAP_DEDUP_SHARDS + 1, 0);
+    std::vector<uint8_t> flow_shards(batch_flows.size());
+    for (size_t i = 0; i < batch_flows.size(); i++) {
+      flow_shards[i] = get_dedup_shard(hashes[i]);
+      shard_counts[flow_shards[i] + 1]++;
+    }
+    for (unsigned shard = 0; shard < PCAP_DEDUP_SHARDS; shard++) {
+      shard_counts[shard + 1] += shard_counts[shard];
+    }
+
+    std::vector<uint32_t> by_shard(batch_flows.size());
+    for (size_t i = 0; i < batch_flows.size(); i++) {
+      by_shard[shard_counts[flow_shards[i]]++] = i;
+    }
+
+    parsed.flow_refs.resize(batch_flows.size());
+
+    size_t next = 0;
+    for (unsigned shard_id = 0; shard_id < PCAP_DEDUP_SHARDS; shard_id++) {
+      const size_t shard_end = shard_counts[shard_id];
+      if (next == shard_end) {
+        continue;
+      }
+
+      dedup_shard_t<flow_type> &shard = shards[shard_id];
+      std::lock_guard<std::mutex> guard(shard.lock);
+      for (; next < shard_end; next++) {
+        const uint32_t i        = by_shard[next];
+        const uint64_t pos      = (seq << 32) | i;
+        const flow_type &flow   = batch_flows[i];
+        const uint32_t new_id   = shard.flows.size();
+        const uint32_t local_id = shard.ids.find_or_insert(shard.flows, flow, hashes[i], new_id);
+
+        if (local_id == new_id) {
+          if (unlikely(new_id == PCAP_DEDUP_SHARD_MAX_FLOWS)) {
+            panic("Too many flows in the pcap (over %u in dedup shard %u)", PCAP_DEDUP_SHARD_MAX_FLOWS, shard_id);
+          }
+          shard.flows.push_back(flow);
+          shard.first_pos.push_back(pos);
+        } else {
+          shard.first_pos[local_id] = std::min(shard.first_pos[local_id], pos);
+        }
+
+        parsed.flow_refs[i] = (local_id << PCAP_DEDUP_SHARD_BITS) | shard_id;
+      }
+    }
+  }
+
+  void parse() {
+    batch_t batch;
+    std::vector<size_t> offsets;
+    std::vector<flow_type> batch_flows;
+
+    while (parse_queue.pop(batch)) {
+      parsed_batch_t parsed;
+      parsed.num_pkts = 0;
+      batch_flows.clear();
+
+      {
+        busy_timer_t timer(parse_stats);
+        if (pcapng) {
+          parse_blocks(batch.stitched.data(), batch.stitched.size(), batch.section, offsets, batch_flows, parsed);
+          parse_blocks(batch.records, batch.size, batch.section, offsets, batch_flows, parsed);
+        } else {
+          parse_records(batch.stitched.data(), batch.stitched.size(), offsets, batch_flows, parsed);
+          parse_records(batch.records, batch.size, offsets, batch_flows, parsed);
+        }
+      }
+      parse_stats.bytes += batch.stitched.size() + batch.size;
+      parse_stats.pkts += parsed.num_pkts;
+
+      {
+        busy_timer_t timer(dedup_stats);
+        dedup(batch.seq, batch_flows, parsed);
+      }
+      dedup_stats.pkts += batch_flows.size();
+
+      merge_queue.push(batch.seq, std::move(parsed));
+    }
+  }
+};
+
+void report_stage(const stage_stats_t &stats, double wall_s) {
+  const double busy_s      = stats.busy_ns / 1e9;
+  const double utilization = wall_s > 0 ? 100.0 * busy_s / (wall_s * stats.num_threads) : 0;
+  const double mbps        = busy_s > 0 ? stats.bytes / busy_s / 1e6 : 0;
+  const double mpps        = busy_s > 0 ? stats.pkts / busy_s / 1e6 : 0;
+
+  LOG("  %-7s %3u threads  busy %8.2lf s  %5.1lf%% utilization  %9.1lf MB/s/thread  %7.2lf Mpps/thread", stats.name,
+      stats.num_threads, busy_s, utilization, mbps, mpps);
+}
+
+} // namespace
+
+template <typename flow_type>
+pcap_trace_t<flow_type> load_pcap(const std::filesystem::path &file, unsigned num_threads, const pcap_pkt_fn_t &on_flow_pkt) {
+  const loader_clock_t::time_point start = loader_clock_t::now();
+
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    panic("Failed to open pcap file");
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(zstd_magic)) {
+    panic("Invalid pcap file");
+  }
+
+  const size_t file_size = file_stat.st_size;
+  const uint8_t *data    = (const uint8_t *)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    panic("Failed to map pcap file");
+  }
+
+  // The file is read front to back, once. Hugepages are only a hint, which not every filesystem takes.
+  madvise((void *)data, file_size, MADV_SEQUENTIAL);
+  madvise((void *)data, file_size, MADV_HUGEPAGE);
+
+  // Only compressed input needs decoding, which runs in parallel if it has more than one frame. The rest of the threads parse.
+  const bool compressed       = memcmp(data, zstd_magic, sizeof(zstd_magic)) == 0;
+  num_threads                 = std::max(num_threads, 2u);
+  const unsigned num_decoders = compressed ? num_threads / 2 : 0;
+  const unsigned num_parsers  = num_threads - num_decoders - (compressed ? 0 : 1);
+  const size_t max_batches    = num_parsers * PCAP_BATCHES_PER_PARSER;
+
+  stage_stats_t decode_stats("decode", num_decoders);
+  stage_stats_t split_stats("split", 1);
+  stage_stats_t parse_stats("parse", num_parsers);
+  stage_stats_t dedup_stats("dedup", num_parsers);
+  stage_stats_t merge_stats("merge", 1);
+  stage_stats_t remap_stats("remap", num_threads);
+
+  LOG("Loading pcap with %u decoder and %u parser threads...", num_decoders, num_parsers);
+
+  decoder_t decoder(data, file_size, 2 * num_decoders, decode_stats);
+  std::unique_ptr<pipeline_t<flow_type>> pipeline =
+      std::make_unique<pipeline_t<flow_type>>(compressed ? &decoder : nullptr, max_batches, split_stats, parse_stats, dedup_stats);
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < num_decoders; i++) {
+    threads.emplace_back([&decoder] {
+      unpin_thread();
+      decoder.run();
+    });
+  }
+  threads.emplace_back([&pipeline, compressed, data, file_size] {
+    unpin_thread();
+    if (compressed) {
+      pipeline->split_decoded();
+    } else {
+      pipeline->split_mapped(data, file_size);
+    }
+  });
+  for (unsigned i = 0; i < num_parsers; i++) {
+    threads.emplace_back([&pipeline] {
+      unpin_thread();
+      pipeline->parse();
+    });
+  }
+
+  // Merge, in capture order, on this thread.
+  pcap_trace_t<flow_type> trace;
+  trace.num_pkts = 0;
+
+  parsed_batch_t parsed;
+  for (uint64_t seq = 0; pipeline->merge_queue.pop(seq, parsed); seq++) {
+    {
+      busy_timer_t timer(merge_stats);
+      trace.flow_idx_seq.insert(trace.flow_idx_seq.end(), parsed.flow_refs.begin(), parsed.flow_refs.end());
+      for (const pcap_pkt_meta_t &meta : parsed.metas) {
+        on_flow_pkt(meta);
+      }
+      trace.num_pkts += parsed.num_pkts;
+    }
+    merge_stats.pkts += parsed.metas.size();
+    pipeline->slots.release();
+
+    LOG_REWRITE("Reading pcap file: %lu packets, %zu index entries", trace.num_pkts, trace.flow_idx_seq.size());
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  munmap((void *)data, file_size);
+
+  // Number flows by first appearance, as reading the trace packet by packet would, and point the sequence at those numbers.
+  const loader_clock_t::time_point remap_start = loader_clock_t::now();
+
+  std::vector<std::pair<uint64_t, uint32_t>> first_seen;
+  for (unsigned shard_id = 0; shard_id < PCAP_DEDUP_SHARDS; shard_id++) {
+    const dedup_shard_t<flow_type> &shard = pipeline->shards[shard_id];
+    for (uint32_t local_id = 0; local_id < shard.flows.size(); local_id++) {
+      first_seen.emplace_back(shard.first_pos[local_id], (local_id << PCAP_DEDUP_SHARD_BITS) | shard_id);
+    }
+  }
+  std::sort(first_seen.begin(), first_seen.end());
+
+  std::vector<std::vector<uint32_t>> flow_idxs(PCAP_DEDUP_SHARDS);
+  for (unsigned shard_id = 0; shard_id < PCAP_DEDUP_SHARDS; shard_id++) {
+    flow_idxs[shard_id].resize(pipeline->shards[shard_id].flows.size());
+  }
+
+  trace.flows.resize(first_seen.size());
+  for (uint32_t flow_idx = 0; flow_idx < first_seen.size(); flow_idx++) {
+    const uint32_t flow_ref       = first_seen[flow_idx].second;
+    const unsigned shard_id       = flow_ref & (PCAP_DEDUP_SHARDS - 1);
+    const uint32_t local_id       = flow_ref >> PCAP_DEDUP_SHARD_BITS;
+    trace.flows[flow_idx]         = pipeline->shards[shard_id].flows[local_id];
+    flow_idxs[shard_id][local_id] = flow_idx;
+  }
+
+  std::vector<std::thread> remappers;
+  const size_t num_entries = trace.flow_idx_seq.size();
+  for (unsigned i = 0; i < num_threads; i++) {
+    remappers.emplace_back([&, i] {
+      unpin_thread();
+      const size_t begin = num_entries * i / num_threads;
+      const size_t end   = num_entries * (i + 1) / num_threads;
+
+      busy_timer_t timer(remap_stats);
+      for (size_t j = begin; j < end; j++) {
+        const uint32_t flow_ref = trace.flow_idx_seq[j];
+        trace.flow_idx_seq[j]   = flow_idxs[flow_ref & (PCAP_DEDUP_SHARDS - 1)][flow_ref >> PCAP_DEDUP_SHARD_BITS];
+      }
+    });
+  }
+  for (std::thread &thread : remappers) {
+    thread.join();
+  }
+  remap_stats.pkts = num_entries;
+
+  const loader_clock_t::time_point end = loader_clock_t::now();
+  const double wall_s                   = std::chrono::duration<double>(end - start).count();
+  const double pipeline_s               = std::chrono::duration<double>(remap_start - start).count();
+  const double remap_s                  = std::chrono::duration<double>(end - remap_start).count();
+
+  LOG("Loaded pcap in %.2lf s: %.1lf MB on disk, %.1lf MB of pcap, %lu packets (%.2lf Mpps).", wall_s, file_size / 1e6,
+      split_stats.bytes / 1e6, trace.num_pkts, wall_s > 0 ? trace.num_pkts / wall_s / 1e6 : 0);
+  if (compressed) {
+    report_stage(decode_stats, pipeline_s);
+  }
+  report_stage(split_stats, pipeline_s);
+  report_stage(parse_stats, pipeline_s);
+  report_stage(dedup_stats, pipeline_s);
+  report_stage(merge_stats, pipeline_s);
+  report_stage(remap_stats, remap_s);
+
+  return trace;
+}
+
+template pcap_trace_t<flow_t> load_pcap(const std::filesystem::path &file, unsigned num_threads, const pcap_pkt_fn_t &on_flow_pkt);
+template pcap_trace_t<flow6_t> load_pcap(const std::filesystem::path &file, unsigned num_threads, const pcap_pkt_fn_t &on_flow_pkt);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+
+#include "types.h"
+#include "flows.h"
+
+// What is kept of every packet with a flow, once parsed.
+struct pcap_pkt_meta_t {
+  time_ns_t ts;
+  uint16_t total_len; // With CRC
+  uint8_t proto;
+};
+
+// Either of IPv4 flows (flow_t), or of IPv6 ones (flow6_t).
+template <typename flow_type> struct pcap_trace_t {
+  // Unique flows, in order of first appearance, and the flow of every packet that has one.
+  std::vector<flow_type> flows;
+  std::vector<uint32_t> flow_idx_seq;
+  uint64_t num_pkts;
+};
+
+typedef std::function<void(const pcap_pkt_meta_t &)> pcap_pkt_fn_t;
+
+// Loads a pcap or pcapng (possibly zstd compressed) as a pipeline: zstd frames are decoded, packets parsed and flows deduplicated on
+// separate threads, while the results are merged back in capture order. on_flow_pkt is called, in capture order, for every packet with
+// a flow (of the family asked for). The result is the same as reading the trace packet by packet. Reports the throughput of each stage
+// when done.
+template <typename flow_type>
+pcap_trace_t<flow_type> load_pcap(const std::filesystem::path &file, unsigned num_threads, const pcap_pkt_fn_t &on_flow_pkt);
@@ -1,247 +1,391 @@
-#ifndef _GNU_SOURCE
-#define _GNU_SOURCE // Required for fopencookie
-#endif
-
 #include "pcap_reader.h"
 #include "log.h"
 
-#include <vector>
-#include <fstream>
+#include <netinet/in.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <rte_ether.h>
 #include <rte_ip.h>
 #include <rte_tcp.h>
 #include <rte_udp.h>
 #include <rte_byteorder.h>
 
-#include <zstd.h>
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+// Link types as stored in files (LINKTYPE_*), which do not always match the DLT_* values of the platform.
+#define LINKTYPE_NULL 0
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+#define LINKTYPE_LOOP 108
+#define LINKTYPE_LINUX_SLL 113
+#define LINKTYPE_IPV4 228
+#define LINKTYPE_IPV6 229
+#define LINKTYPE_LINUX_SLL2 276
+
+// Older writers stored the platform DLT_RAW instead.
+#define DLT_RAW_BSD 12
+#define DLT_RAW_OPENBSD 14
+
+#define PCAPNG_SHB_MIN_SIZE 28
+#define PCAPNG_IDB_MIN_SIZE 20
+#define PCAPNG_IDB_LINKTYPE_OFFSET 8
+#define PCAPNG_IDB_SNAPLEN_OFFSET 12
+#define PCAPNG_IDB_OPTS_OFFSET 16
+#define PCAPNG_EPB_MIN_SIZE 32
+#define PCAPNG_EPB_DATA_OFFSET 28
+#define PCAPNG_SPB_MIN_SIZE 16
+#define PCAPNG_SPB_DATA_OFFSET 12
+
+#define PCAPNG_OPT_HDR_SIZE 4
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_IF_TSOFFSET 14
+
+#define NULL_HDR_SIZE 4
+#define NULL_AF_INET 2
+// AF_INET6 differs between platforms.
+#define NULL_AF_INET6_LINUX 10
+#define NULL_AF_INET6_BSD 24
+#define NULL_AF_INET6_FREEBSD 28
+#define NULL_AF_INET6_DARWIN 30
+#define LINUX_SLL_HDR_SIZE 16
+#define LINUX_SLL_PROTO_OFFSET 14
+#define LINUX_SLL2_HDR_SIZE 20
+#define LINUX_SLL2_PROTO_OFFSET 0
+
+#define IPV6_FRAG_HDR_SIZE 8
+#define IPV6_FRAG_OFFSET_MASK 0xfff8
+// More extension headers than this are not worth walking through.
+#define IPV6_MAX_EXT_HDRS 8
+
+static pcap_link_t get_link(uint32_t link_hdr_type) {
+  switch (link_hdr_type) {
+  case LINKTYPE_ETHERNET:
+    // Normal ethernet, as expected. Nothing to do here.
+    return PCAP_LINK_ETHERNET;
+  case LINKTYPE_RAW:
+  case LINKTYPE_IPV4:
+  case LINKTYPE_IPV6:
+  case DLT_RAW_BSD:
+  case DLT_RAW_OPENBSD:
+    // Contains raw IP packets.
+    return PCAP_LINK_IP;
+  case LINKTYPE_NULL:
+  case LINKTYPE_LOOP:
+    return PCAP_LINK_NULL;
+  case LINKTYPE_LINUX_SLL:
+    return PCAP_LINK_LINUX_SLL;
+  case LINKTYPE_LINUX_SLL2:
+    return PCAP_LINK_LINUX_SLL2;
+  default: {
+    return PCAP_LINK_UNSUPPORTED;
+  }
+  }
+}
 
-namespace {
+bool is_pcap_magic(const uint8_t *hdr) {
+  uint32_t magic;
+  memcpy(&magic, hdr, sizeof(magic));
+  return magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC || magic == __builtin_bswap32(PCAP_MAGIC_USEC) ||
+         magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+}
 
-std::vector<uint8_t> get_file_signature(const std::string &filepath, size_t bytesToRead = 4) {
-  std::ifstream file(filepath, std::ios::binary);
-  if (!file) {
-    return {};
+pcap_format_t parse_pcap_file_hdr(const uint8_t *hdr) {
+  uint32_t magic;
+  uint32_t link_hdr_type;
+  memcpy(&magic, hdr, sizeof(magic));
+  memcpy(&link_hdr_type, hdr + 20, sizeof(link_hdr_type));
+
+  pcap_format_t format;
+  format.swapped = (magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+  if (format.swapped) {
+    magic         = __builtin_bswap32(magic);
+    link_hdr_type = __builtin_bswap32(link_hdr_type);
   }
 
-  std::vector<uint8_t> buffer(bytesToRead);
-  file.read(reinterpret_cast<char *>(buffer.data()), bytesToRead);
+  if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) {
+    panic("Unknown file format");
+  }
+  format.nsec = (magic == PCAP_MAGIC_NSEC);
 
-  // Resize buffer if fewer bytes were read (e.g., small file)
-  buffer.resize(file.gcount());
+  // The upper bits of the link type may carry FCS information.
+  format.link_hdr_type = link_hdr_type & 0xffff;
+  format.link          = get_link(format.link_hdr_type);
+  if (format.link == PCAP_LINK_UNSUPPORTED) {
+    WARNING("Unsupported link type (%u), none of the packets will have a flow.", format.link_hdr_type);
+  }
 
-  return buffer;
+  return format;
 }
 
-struct ZstdContext {
-  FILE *raw_file;
-  ZSTD_DStream *dctx;
-
-  // Input buffer (compressed data from disk)
-  std::vector<uint8_t> in_buff;
-  size_t in_pos;
-  size_t in_len;
-
-  // Output buffer (decompressed data for libpcap)
-  std::vector<uint8_t> out_buff;
-  size_t out_pos;
-  size_t out_len;
+bool is_pcapng_magic(const uint8_t *hdr) {
+  uint32_t type;
+  memcpy(&type, hdr, sizeof(type));
+  return type == PCAPNG_BLOCK_SHB;
+}
 
-  bool eof_reached;
+static inline uint32_t read_u32(bool swapped, const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return swapped ? __builtin_bswap32(value) : value;
+}
 
-  ZstdContext(const char *filename) : in_pos(0), in_len(0), out_pos(0), out_len(0), eof_reached(false) {
-    raw_file = fopen(filename, "rb");
-    if (!raw_file) {
-      perror("fopen");
-      exit(1);
-    }
+static inline uint16_t read_u16(bool swapped, const uint8_t *data) {
+  uint16_t value;
+  memcpy(&value, data, sizeof(value));
+  return swapped ? __builtin_bswap16(value) : value;
+}
 
-    dctx = ZSTD_createDStream();
-    ZSTD_initDStream(dctx);
+// Timestamp resolution of an interface, from its if_tsresol option: a power of 10, or of 2 if the top bit is set.
+static void set_ts_resolution(pcapng_iface_t &iface, uint8_t tsresol) {
+  const bool pow2      = tsresol & 0x80;
+  const uint8_t exp    = tsresol & 0x7f;
+  const uint8_t limit  = pow2 ? 63 : 19;
+  uint64_t units_per_s = 1;
 
-    in_buff.resize(ZSTD_DStreamInSize());
-    out_buff.resize(ZSTD_DStreamOutSize());
+  if (exp > limit) {
+    WARNING("Unsupported pcapng timestamp resolution (0x%02x), using microseconds instead.", tsresol);
+    return;
   }
-
-  ~ZstdContext() {
-    if (raw_file) {
-      fclose(raw_file);
-    }
-    ZSTD_freeDStream(dctx);
+  for (uint8_t i = 0; i < exp; i++) {
+    units_per_s *= pow2 ? 2 : 10;
   }
-};
 
-// Libpcap calls this thinking it's reading a normal file.
-// We intercept it and feed it decompressed data.
-ssize_t zstd_read_fn(void *cookie, char *buf, size_t size) {
-  ZstdContext *ctx    = static_cast<ZstdContext *>(cookie);
-  size_t total_copied = 0;
-
-  while (total_copied < size) {
-    // 1. If we have data in the output buffer, give it to libpcap
-    if (ctx->out_pos < ctx->out_len) {
-      const size_t available = ctx->out_len - ctx->out_pos;
-      const size_t needed    = size - total_copied;
-      const size_t to_copy   = (available < needed) ? available : needed;
-
-      memcpy(buf + total_copied, ctx->out_buff.data() + ctx->out_pos, to_copy);
-
-      ctx->out_pos += to_copy;
-      total_copied += to_copy;
+  iface.ts_units_per_s = units_per_s;
+  iface.ts_ns_per_unit = (1'000'000'000 % units_per_s == 0) ? 1'000'000'000 / units_per_s : 0;
+}
 
-      if (total_copied == size) {
-        return total_copied;
-      }
+static pcapng_iface_t parse_pcapng_idb(const uint8_t *block, const pcapng_block_hdr_t &hdr, bool swapped) {
+  pcapng_iface_t iface;
+  iface.format.swapped       = swapped;
+  iface.format.nsec          = false;
+  iface.format.link_hdr_type = read_u16(swapped, block + PCAPNG_IDB_LINKTYPE_OFFSET);
+  iface.format.link          = get_link(iface.format.link_hdr_type);
+  iface.snaplen              = read_u32(swapped, block + PCAPNG_IDB_SNAPLEN_OFFSET);
+  iface.ts_units_per_s       = 1'000'000;
+  iface.ts_ns_per_unit       = 1'000;
+  iface.ts_offset            = 0;
+
+  // Options, each padded to 32 bits, up until the end of the block or an end of options.
+  const uint8_t *opt = block + PCAPNG_IDB_OPTS_OFFSET;
+  const uint8_t *end = block + hdr.len - PCAPNG_BLOCK_TRAILER_SIZE;
+  while (opt + PCAPNG_OPT_HDR_SIZE <= end) {
+    const uint16_t code = read_u16(swapped, opt);
+    const uint16_t len  = read_u16(swapped, opt + 2);
+    const uint8_t *val  = opt + PCAPNG_OPT_HDR_SIZE;
+    if (code == PCAPNG_OPT_END || val + len > end) {
+      break;
     }
 
-    // 2. Output buffer is empty. We need to decompress more data.
-    if (ctx->eof_reached && ctx->in_pos >= ctx->in_len) {
-      return total_copied; // Real EOF
+    if (code == PCAPNG_OPT_IF_TSRESOL && len >= 1) {
+      set_ts_resolution(iface, val[0]);
+    } else if (code == PCAPNG_OPT_IF_TSOFFSET && len >= 8) {
+      int64_t offset_s;
+      memcpy(&offset_s, val, sizeof(offset_s));
+      offset_s        = swapped ? (int64_t)__builtin_bswap64(offset_s) : offset_s;
+      iface.ts_offset = (time_ns_t)offset_s * 1'000'000'000;
     }
 
-    // Reset output buffer state
-    ctx->out_pos = 0;
-    ctx->out_len = 0;
-
-    ZSTD_outBuffer output = {ctx->out_buff.data(), ctx->out_buff.size(), 0};
-
-    // Decompression Loop
-    // We loop until we produce *some* output or hit EOF/Error
-    while (output.pos == 0) {
-      // Refill input buffer if empty
-      if (ctx->in_pos >= ctx->in_len) {
-        if (feof(ctx->raw_file)) {
-          ctx->eof_reached = true;
-          // If we are at EOF and no output was produced, we are done
-          if (output.pos == 0) {
-            return total_copied;
-          }
-          break;
-        }
-
-        const size_t read = fread(ctx->in_buff.data(), 1, ctx->in_buff.size(), ctx->raw_file);
-        if (read == 0) {
-          ctx->eof_reached = true;
-          break;
-        }
-        ctx->in_len = read;
-        ctx->in_pos = 0;
-      }
-
-      ZSTD_inBuffer input = {ctx->in_buff.data(), ctx->in_len, ctx->in_pos};
-
-      // The actual decompression
-      const size_t ret = ZSTD_decompressStream(ctx->dctx, &output, &input);
-
-      ctx->in_pos = input.pos;
-
-      if (ZSTD_isError(ret)) {
-        panic("Decompression failed: %s", ZSTD_getErrorName(ret));
-      }
-
-      // If frame is over (ret==0), we might need to loop again to get next frame
-      // But usually we just return what we have.
-      if (output.pos > 0) {
-        break;
-      }
-    }
-
-    ctx->out_len = output.pos;
+    opt = val + ((len + 3) & ~3);
   }
 
-  return total_copied;
+  return iface;
 }
 
-int zstd_close_fn(void *cookie) {
-  ZstdContext *ctx = static_cast<ZstdContext *>(cookie);
-  delete ctx; // Clean up our context
-  return 0;
+void parse_pcapng_section_block(const uint8_t *block, const pcapng_block_hdr_t &hdr, pcapng_section_t &section) {
+  switch (hdr.type) {
+  case PCAPNG_BLOCK_SHB: {
+    if (hdr.len < PCAPNG_SHB_MIN_SIZE) {
+      panic("Corrupted pcapng: section header of %u bytes", hdr.len);
+    }
+    // Interfaces only live as long as their section.
+    const uint32_t byte_order_magic = read_u32(false, block + 8);
+    if (byte_order_magic != PCAPNG_BYTE_ORDER_MAGIC && byte_order_magic != __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+      panic("Corrupted pcapng: unknown byte order magic 0x%08x", byte_order_magic);
+    }
+    section.swapped = (byte_order_magic != PCAPNG_BYTE_ORDER_MAGIC);
+    section.ifaces.clear();
+  } break;
+  case PCAPNG_BLOCK_IDB: {
+    if (hdr.len < PCAPNG_IDB_MIN_SIZE) {
+      panic("Corrupted pcapng: interface description of %u bytes", hdr.len);
+    }
+    section.ifaces.push_back(parse_pcapng_idb(block, hdr, section.swapped));
+  } break;
+  }
 }
 
-} // namespace
-
-pcap_reader_t::pcap_reader_t(const std::filesystem::path &file)
-    : pd(nullptr), assume_ip(false), pcap_start(0), total_pkts(0), start(0), end(0) {
-  const std::vector<uint8_t> signature = get_file_signature(file.string());
-
-  static const std::vector<uint8_t> zst_sig     = {0x28, 0xB5, 0x2F, 0xFD};
-  static const std::vector<uint8_t> pcap_be_sig = {0xA1, 0xB2, 0xC3, 0xD4};
-  static const std::vector<uint8_t> pcap_le_sig = {0xD4, 0xC3, 0xB2, 0xA1};
-  static const std::vector<uint8_t> pcapng_sig  = {0x0A, 0x0D, 0x0D, 0x0A};
-
-  FILE *pcap_fptr = nullptr;
-
-  if (signature == zst_sig) {
-    ZstdContext *ctx = new ZstdContext(file.c_str());
-
-    cookie_io_functions_t funcs = {
-        .read  = zstd_read_fn,
-        .write = NULL, // Libpcap only reads
-        .seek  = NULL, // Streaming zstd is not seekable
-        .close = zstd_close_fn,
-    };
-
-    pcap_fptr = fopencookie(ctx, "r", funcs);
-    if (!pcap_fptr) {
-      panic("Failed to create cookie stream");
+bool parse_pcapng_pkt_block(const uint8_t *block, const pcapng_block_hdr_t &hdr, const pcapng_section_t &section,
+                            pcap_record_hdr_t &record, const uint8_t *&data, const pcap_format_t *&format) {
+  const bool swapped = section.swapped;
+  uint32_t iface_id;
+  uint64_t ts;
+  size_t data_offset;
+
+  switch (hdr.type) {
+  case PCAPNG_BLOCK_EPB:
+  case PCAPNG_BLOCK_PB: {
+    if (hdr.len < PCAPNG_EPB_MIN_SIZE) {
+      panic("Corrupted pcapng: packet block of %u bytes", hdr.len);
     }
-  } else if (signature == pcap_be_sig || signature == pcap_le_sig) {
-    pcap_fptr = fopen(file.c_str(), "rb");
-    if (!pcap_fptr) {
-      perror("fopen");
-      panic("Failed to open pcap file");
+    // Same layout, but the obsolete packet block only has 16 bits of interface (and then a drop count).
+    iface_id      = (hdr.type == PCAPNG_BLOCK_EPB) ? read_u32(swapped, block + 8) : read_u16(swapped, block + 8);
+    ts            = ((uint64_t)read_u32(swapped, block + 12) << 32) | read_u32(swapped, block + 16);
+    record.caplen = read_u32(swapped, block + 20);
+    record.len    = read_u32(swapped, block + 24);
+    data_offset   = PCAPNG_EPB_DATA_OFFSET;
+  } break;
+  case PCAPNG_BLOCK_SPB: {
+    if (hdr.len < PCAPNG_SPB_MIN_SIZE) {
+      panic("Corrupted pcapng: simple packet block of %u bytes", hdr.len);
     }
-  } else if (signature == pcapng_sig) {
-    // Handle PCAPNG file
-    panic("PCAPNG format is not supported yet");
-  } else {
-    panic("Unknown file format");
+    // No timestamp, and how much was captured has to be worked out from the snap length of the (only) interface.
+    iface_id      = 0;
+    ts            = 0;
+    record.len    = read_u32(swapped, block + 8);
+    record.caplen = std::min(record.len, hdr.len - PCAPNG_SPB_MIN_SIZE);
+    data_offset   = PCAPNG_SPB_DATA_OFFSET;
+  } break;
+  default: {
+    return false;
+  }
   }
 
-  assert(pcap_fptr && "Invalid pcap file pointer");
-  pcap_start = ftell(pcap_fptr);
+  if (iface_id >= section.ifaces.size()) {
+    panic("Corrupted pcapng: packet from undescribed interface %u", iface_id);
+  }
+  const pcapng_iface_t &iface = section.ifaces[iface_id];
 
-  char errbuf[PCAP_ERRBUF_SIZE];
-  pd = pcap_fopen_offline(pcap_fptr, errbuf);
+  if (hdr.type == PCAPNG_BLOCK_SPB && iface.snaplen > 0) {
+    record.caplen = std::min(record.caplen, iface.snaplen);
+  }
+  if (data_offset + record.caplen > hdr.len - PCAPNG_BLOCK_TRAILER_SIZE) {
+    panic("Corrupted pcapng: %u bytes captured in a block of %u bytes", record.caplen, hdr.len);
+  }
 
-  if (!pd) {
-    fclose(pcap_fptr);
-    panic("Failed to open pcap file: %s", errbuf);
+  if (iface.ts_ns_per_unit > 0) {
+    record.ts = ts * iface.ts_ns_per_unit + iface.ts_offset;
+  } else {
+    record.ts = (time_ns_t)((unsigned __int128)ts * 1'000'000'000 / iface.ts_units_per_s) + iface.ts_offset;
   }
 
-  const int link_hdr_type = pcap_datalink(pd);
+  data   = block + data_offset;
+  format = &iface.format;
+  return true;
+}
 
-  switch (link_hdr_type) {
-  case DLT_EN10MB:
-    // Normal ethernet, as expected. Nothing to do here.
-    break;
-  case DLT_RAW:
-    // Contains raw IP packets.
-    assume_ip = true;
-    break;
+static bool is_null_af_inet(uint32_t family) {
+  switch (family) {
+  case NULL_AF_INET:
+  case NULL_AF_INET6_LINUX:
+  case NULL_AF_INET6_BSD:
+  case NULL_AF_INET6_FREEBSD:
+  case NULL_AF_INET6_DARWIN:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Bytes that come before the IP header in the given link layer, or -1 if it does not carry IP.
+static int get_link_hdr_size(const uint8_t *data, const uint8_t *end, pcap_link_t link) {
+  switch (link) {
+  case PCAP_LINK_IP: {
+    return 0;
+  }
+  case PCAP_LINK_NULL: {
+    if (data + NULL_HDR_SIZE > end) {
+      return -1;
+    }
+    // The address family is in the byte order of the capturing host (or always big endian, for LINKTYPE_LOOP).
+    uint32_t family;
+    memcpy(&family, data, sizeof(family));
+    return (is_null_af_inet(family) || is_null_af_inet(rte_bswap32(family))) ? NULL_HDR_SIZE : -1;
+  }
+  case PCAP_LINK_LINUX_SLL:
+  case PCAP_LINK_LINUX_SLL2: {
+    const bool v2             = (link == PCAP_LINK_LINUX_SLL2);
+    const size_t hdr_size     = v2 ? LINUX_SLL2_HDR_SIZE : LINUX_SLL_HDR_SIZE;
+    const size_t proto_offset = v2 ? LINUX_SLL2_PROTO_OFFSET : LINUX_SLL_PROTO_OFFSET;
+    if (data + hdr_size > end) {
+      return -1;
+    }
+    uint16_t proto;
+    memcpy(&proto, data + proto_offset, sizeof(proto));
+    return (ntohs(proto) == RTE_ETHER_TYPE_IPV4 || ntohs(proto) == RTE_ETHER_TYPE_IPV6) ? (int)hdr_size : -1;
+  }
   default: {
-    panic("Unknown header type (%d)", link_hdr_type);
+    return -1;
   }
   }
 }
 
-bool pcap_reader_t::read_next_packet(packet_t &read_data) {
-  const uint8_t *data;
-  struct pcap_pkthdr *header;
+// Moves past the IPv6 extension headers, leaving proto with the protocol that follows them. False if they are cut short, or if this is
+// a fragment other than the first (which is the only one with the L4 header).
+static bool skip_ipv6_ext_hdrs(const uint8_t *&data, const uint8_t *end, uint8_t &proto, uint16_t &hdrs_len) {
+  for (unsigned i = 0; i < IPV6_MAX_EXT_HDRS; i++) {
+    size_t len;
+    switch (proto) {
+    case IPPROTO_HOPOPTS:
+    case IPPROTO_ROUTING:
+    case IPPROTO_DSTOPTS: {
+      if (data + 2 > end) {
+        return false;
+      }
+      len = (data[1] + 1) * 8;
+    } break;
+    case IPPROTO_FRAGMENT: {
+      if (data + IPV6_FRAG_HDR_SIZE > end) {
+        return false;
+      }
+      uint16_t frag_data;
+      memcpy(&frag_data, data + 2, sizeof(frag_data));
+      if ((ntohs(frag_data) & IPV6_FRAG_OFFSET_MASK) != 0) {
+        return false;
+      }
+      len = IPV6_FRAG_HDR_SIZE;
+    } break;
+    case IPPROTO_AH: {
+      if (data + 2 > end) {
+        return false;
+      }
+      len = (data[1] + 2) * 4;
+    } break;
+    default: {
+      return true;
+    }
+    }
 
-  if (pcap_next_ex(pd, &header, &data) != 1) {
-    return false;
+    if (data + len > end) {
+      return false;
+    }
+    proto = data[0];
+    data += len;
+    hdrs_len += len;
   }
 
+  return false;
+}
+
+void parse_packet(const uint8_t *data, const pcap_record_hdr_t &record, const pcap_format_t &format, packet_t &read_data) {
+  const uint8_t *end = data + record.caplen;
+
   read_data.pkt       = data;
   read_data.hdrs_len  = 0;
-  read_data.total_len = header->len + RTE_ETHER_CRC_LEN;
-  read_data.ts        = header->ts.tv_sec * 1'000'000'000 + header->ts.tv_usec * 1'000;
+  read_data.total_len = record.len + RTE_ETHER_CRC_LEN;
+  read_data.ts        = record.ts;
+  read_data.proto     = 0;
+  read_data.flow      = std::nullopt;
+  read_data.flow6     = std::nullopt;
+
+  if (format.link == PCAP_LINK_ETHERNET) {
+    if (data + sizeof(rte_ether_hdr) > end) {
+      return;
+    }
 
-  if (assume_ip) {
-    read_data.total_len += sizeof(rte_ether_hdr);
-  } else {
     const rte_ether_hdr *ether_hdr = reinterpret_cast<const rte_ether_hdr *>(data);
     data += sizeof(rte_ether_hdr);
     read_data.hdrs_len += sizeof(rte_ether_hdr);
@@ -255,6 +399,9 @@ bool pcap_reader_t::read_next_packet(packet_t &read_data) {
 
       // Ignore the VLAN header and advance the data pointer.
       data += sizeof(rte_vlan_hdr);
+      if (data + sizeof(uint16_t) > end) {
+        return;
+      }
 
       // Grab the encapsulated ethertype and offset the data pointer.
       ether_type = ntohs(reinterpret_cast<const uint16_t *>(data)[0]);
@@ -262,26 +409,71 @@ bool pcap_reader_t::read_next_packet(packet_t &read_data) {
       read_data.hdrs_len += sizeof(rte_vlan_hdr) + sizeof(uint16_t);
     }
 
-    if (ether_type != RTE_ETHER_TYPE_IPV4) {
+    if (ether_type != RTE_ETHER_TYPE_IPV4 && ether_type != RTE_ETHER_TYPE_IPV6) {
       read_data.hdrs_len = read_data.total_len;
-      return true;
+      return;
     }
+  } else {
+    // Replayed with an Ethernet header in place of whatever link layer it was captured with.
+    const int link_hdr_size = get_link_hdr_size(data, end, format.link);
+    if (link_hdr_size < 0) {
+      return;
+    }
+
+    read_data.total_len = record.len - link_hdr_size + sizeof(rte_ether_hdr) + RTE_ETHER_CRC_LEN;
+    data += link_hdr_size;
+    read_data.hdrs_len += link_hdr_size;
   }
 
-  const rte_ipv4_hdr *ip_hdr = reinterpret_cast<const rte_ipv4_hdr *>(data);
-  data += sizeof(rte_ipv4_hdr);
-  read_data.hdrs_len += sizeof(rte_ipv4_hdr);
+  if (data + 1 > end) {
+    return;
+  }
 
-  if (ip_hdr->version != 4) {
-    return true;
+  // Raw IP and some cooked captures only tell the IP version apart from the header itself.
+  const uint8_t ip_version    = data[0] >> 4;
+  const rte_ipv4_hdr *ip_hdr  = nullptr;
+  const rte_ipv6_hdr *ip6_hdr = nullptr;
+  uint8_t proto;
+
+  if (ip_version == 4) {
+    if (data + sizeof(rte_ipv4_hdr) > end) {
+      return;
+    }
+    ip_hdr = reinterpret_cast<const rte_ipv4_hdr *>(data);
+
+    // Options come along in the header length, and only the first fragment has the L4 header (same as skip_ipv6_ext_hdrs()).
+    const size_t ip_hdr_len = (ip_hdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    if (ip_hdr_len < sizeof(rte_ipv4_hdr) || data + ip_hdr_len > end ||
+        (ntohs(ip_hdr->fragment_offset) & RTE_IPV4_HDR_OFFSET_MASK) != 0) {
+      return;
+    }
+    data += ip_hdr_len;
+    read_data.hdrs_len += ip_hdr_len;
+    proto = ip_hdr->next_proto_id;
+  } else if (ip_version == 6) {
+    if (data + sizeof(rte_ipv6_hdr) > end) {
+      return;
+    }
+    ip6_hdr = reinterpret_cast<const rte_ipv6_hdr *>(data);
+    data += sizeof(rte_ipv6_hdr);
+    read_data.hdrs_len += sizeof(rte_ipv6_hdr);
+    proto = ip6_hdr->proto;
+    if (!skip_ipv6_ext_hdrs(data, end, proto, read_data.hdrs_len)) {
+      return;
+    }
+  } else {
+    return;
   }
 
   uint16_t sport = 0;
   uint16_t dport = 0;
 
   // We only support TCP/UDP
-  switch (ip_hdr->next_proto_id) {
+  switch (proto) {
   case IPPROTO_TCP: {
+    if (data + sizeof(rte_tcp_hdr) > end) {
+      return;
+    }
     const rte_tcp_hdr *tcp_hdr = reinterpret_cast<const rte_tcp_hdr *>(data);
     data += sizeof(rte_tcp_hdr);
     read_data.hdrs_len += sizeof(rte_tcp_hdr);
@@ -290,6 +482,9 @@ bool pcap_reader_t::read_next_packet(packet_t &read_data) {
   } break;
 
   case IPPROTO_UDP: {
+    if (data + sizeof(rte_udp_hdr) > end) {
+      return;
+    }
     const rte_udp_hdr *udp_hdr = reinterpret_cast<const rte_udp_hdr *>(data);
     data += sizeof(rte_udp_hdr);
     read_data.hdrs_len += sizeof(rte_udp_hdr);
@@ -297,15 +492,22 @@ bool pcap_reader_t::read_next_packet(packet_t &read_data) {
     dport = udp_hdr->dst_port;
   } break;
   default: {
-    return true;
+    return;
   }
   }
 
-  read_data.flow           = flow_t();
-  read_data.flow->src_ip   = ip_hdr->src_addr;
-  read_data.flow->dst_ip   = ip_hdr->dst_addr;
-  read_data.flow->src_port = sport;
-  read_data.flow->dst_port = dport;
-
-  return true;
-}
\ No newline at end of file
+  read_data.proto = proto;
+  if (ip_hdr) {
+    read_data.flow           = flow_t();
+    read_data.flow->src_ip   = ip_hdr->src_addr;
+    read_data.flow->dst_ip   = ip_hdr->dst_addr;
+    read_data.flow->src_port = sport;
+    read_data.flow->dst_port = dport;
+  } else {
+    read_data.flow6 = flow6_t();
+    memcpy(read_data.flow6->src_ip, ip6_hdr->src_addr, sizeof(ip6_hdr->src_addr));
+    memcpy(read_data.flow6->dst_ip, ip6_hdr->dst_addr, sizeof(ip6_hdr->dst_addr));
+    read_data.flow6->src_port = sport;
+    read_data.flow6->dst_port = dport;
+  }
+}
@@ -1,30 +1,127 @@
 #pragma once
 
-#include <filesystem>
 #include <optional>
-#include <pcap.h>
+#include <vector>
 
+#include "types.h"
 #include "flows.h"
 
-typedef uint64_t time_ns_t;
+// Classic pcap layout: a file header, then every packet behind its own record header.
+#define PCAP_FILE_HDR_SIZE 24
+#define PCAP_RECORD_HDR_SIZE 16
 
 struct packet_t {
   const uint8_t *pkt;
   uint16_t hdrs_len;
   uint16_t total_len;
   time_ns_t ts;
+  uint8_t proto; // L4 protocol (IPPROTO_TCP/IPPROTO_UDP), only meaningful with a flow
+  // At most one of them is set, depending on the IP version.
   std::optional<flow_t> flow;
+  std::optional<flow6_t> flow6;
 };
 
-struct pcap_reader_t {
-  pcap_t *pd;
-  bool assume_ip;
-  long pcap_start;
-  uint64_t total_pkts;
-  time_ns_t start;
-  time_ns_t end;
+// Link layers we can find IP behind. Anything else is still read (it takes up time), but none of its packets have a flow.
+enum pcap_link_t {
+  PCAP_LINK_ETHERNET,
+  PCAP_LINK_IP,         // Raw IP, no link layer at all
+  PCAP_LINK_NULL,       // BSD loopback: a 4-byte address family
+  PCAP_LINK_LINUX_SLL,  // Linux "cooked" capture
+  PCAP_LINK_LINUX_SLL2, // Same, v2
+  PCAP_LINK_UNSUPPORTED,
+};
+
+// How the records of a pcap are to be read, as told by its file header.
+struct pcap_format_t {
+  bool swapped; // Written with the other byte order
+  bool nsec;    // Timestamps in ns instead of us
+  pcap_link_t link;
+  uint32_t link_hdr_type;
+};
+
+struct pcap_record_hdr_t {
+  time_ns_t ts;
+  uint32_t caplen;
+  uint32_t len;
+};
+
+// Whether this is the magic number of a classic pcap file (any byte order or timestamp resolution).
+bool is_pcap_magic(const uint8_t *hdr);
+
+// Panics if this is not a pcap at all, but only warns about link layers we cannot parse.
+pcap_format_t parse_pcap_file_hdr(const uint8_t *hdr);
+
+static inline pcap_record_hdr_t parse_pcap_record_hdr(const pcap_format_t &format, const uint8_t *hdr) {
+  uint32_t fields[4];
+  memcpy(fields, hdr, sizeof(fields));
+  if (format.swapped) {
+    for (uint32_t &field : fields) {
+      field = __builtin_bswap32(field);
+    }
+  }
+
+  const time_ns_t frac = format.nsec ? fields[1] : (time_ns_t)fields[1] * 1'000;
+  return {(time_ns_t)fields[0] * 1'000'000'000 + frac, fields[2], fields[3]};
+}
+
+// pcapng: a sequence of blocks, each starting with its type and total length (and ending with the length again). Every section starts
+// with a section header block, with the byte order of the section, and its packets refer to the interfaces described before them.
+#define PCAPNG_BLOCK_HDR_SIZE 12 // Type and total length, plus the byte order magic of section headers
+#define PCAPNG_BLOCK_TRAILER_SIZE 4
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 1
+#define PCAPNG_BLOCK_PB 2 // Obsolete packet block
+#define PCAPNG_BLOCK_SPB 3
+#define PCAPNG_BLOCK_EPB 6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+struct pcapng_block_hdr_t {
+  uint32_t type;
+  uint32_t len;
+};
+
+struct pcapng_iface_t {
+  pcap_format_t format;
+  uint32_t snaplen;
+  // Timestamps are counted in units of 1/ts_units_per_s seconds, plus an offset.
+  uint64_t ts_units_per_s;
+  uint64_t ts_ns_per_unit; // 0 if a unit is not a whole number of ns
+  time_ns_t ts_offset;
+};
+
+struct pcapng_section_t {
+  bool swapped;
+  std::vector<pcapng_iface_t> ifaces;
+};
+
+bool is_pcapng_magic(const uint8_t *hdr);
+
+// Reads the type and total length of a block. Section headers carry the byte order of their section, which swapped is set to, and
+// the blocks that follow are read with.
+static inline pcapng_block_hdr_t parse_pcapng_block_hdr(bool &swapped, const uint8_t *hdr) {
+  uint32_t fields[3];
+  memcpy(fields, hdr, sizeof(fields));
+
+  // The type of section headers reads the same in both byte orders.
+  if (fields[0] == PCAPNG_BLOCK_SHB) {
+    swapped = (fields[2] != PCAPNG_BYTE_ORDER_MAGIC);
+  }
+  if (swapped) {
+    fields[0] = __builtin_bswap32(fields[0]);
+    fields[1] = __builtin_bswap32(fields[1]);
+  }
+
+  return {fields[0], fields[1]};
+}
+
+// Applies a section header or interface description block to the state of its section, ignoring every other kind of block.
+void parse_pcapng_section_block(const uint8_t *block, const pcapng_block_hdr_t &hdr, pcapng_section_t &section);
 
-  pcap_reader_t(const std::filesystem::path &file);
+// Reads the packet out of a packet block (EPB, SPB or PB), returning false for blocks without one. The format it is to be parsed with
+// is that of its interface.
+bool parse_pcapng_pkt_block(const uint8_t *block, const pcapng_block_hdr_t &hdr, const pcapng_section_t &section,
+                            pcap_record_hdr_t &record, const uint8_t *&data, const pcap_format_t *&format);
 
-  bool read_next_packet(packet_t &read_data);
-};
\ No newline at end of file
+// Parses the headers of a captured packet (caplen bytes at data), filling in its flow if it is TCP/UDP over IPv4 (or flow6, over IPv6).
+// Its total length is that of the Ethernet frame it is replayed as.
+void parse_packet(const uint8_t *data, const pcap_record_hdr_t &record, const pcap_format_t &format, packet_t &read_data);
@@ -7,19 +7,23 @@
 #include <rte_lcore.h>
 #include <rte_malloc.h>
 #include <rte_mbuf.h>
+#include <rte_prefetch.h>
 #include <rte_random.h>
 #include <rte_udp.h>
 #include <signal.h>
 #include <stdint.h>
 #include <time.h>
 
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <optional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <numeric>
 #include <thread>
+#include <utility>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -32,13 +36,19 @@
 #include "stats.h"
 #include "config.h"
 #include "cmdline.h"
-
-// Source/destination MACs
-const struct rte_ether_addr src_mac = {{0xb4, 0x96, 0x91, 0xa4, 0x02, 0xe9}};
-const struct rte_ether_addr dst_mac = {{0xb4, 0x96, 0x91, 0xa4, 0x04, 0x21}};
+#include "packet.h"
+#include "tcp.h"
+#include "latency.h"
+#include "tracker.h"
+#include "pacer.h"
+#include "workload.h"
+#include "sync.h"
 
 volatile bool quit;
-std::atomic<uint64_t> shared_flow_idx_counter{0};
+// Per TX port, as ports may not all offload the same.
+static bool tx_cksum_offload[RTE_MAX_ETHPORTS];
+static bool tx_outer_udp_cksum_offload[RTE_MAX_ETHPORTS];
+struct sync_pos_t sync_positions[RTE_MAX_LCORE];
 
 static void signal_handler(int signum) {
   (void)signum;
@@ -52,16 +62,27 @@ struct worker_config_t {
   bool ready;
 
   struct rte_mempool *pool;
+  // Index among the TX workers, which sends on a queue of a port (see config.tx.core_ports).
+  const uint16_t worker_id;
+  const uint16_t port;
   const uint16_t queue_id;
 
   const bytes_t pkt_size;
-  const std::optional<std::vector<uint64_t>> worker_flow_idx_seq;
+  // On the socket of the worker.
+  const std::optional<socket_vector_t<uint32_t>> worker_flow_idx_seq;
+  const std::optional<socket_vector_t<uint16_t>> worker_flow_idx_tmpls;
+  const std::optional<replay_timing_t> replay_timing;
   const runtime_config_t *runtime;
-
-  worker_config_t(struct rte_mempool *_pool, uint16_t _queue_id, bytes_t _pkt_size,
-                  std::optional<std::vector<uint64_t>> _worker_flow_idx_seq, const runtime_config_t *_runtime)
-      : ready(false), pool(_pool), queue_id(_queue_id), pkt_size(_pkt_size), worker_flow_idx_seq(std::move(_worker_flow_idx_seq)),
-        runtime(_runtime) {}
+  struct tx_worker_stats_t *stats;
+
+  worker_config_t(struct rte_mempool *_pool, uint16_t _worker_id, uint16_t _port, uint16_t _queue_id, bytes_t _pkt_size,
+                  std::optional<socket_vector_t<uint32_t>> _worker_flow_idx_seq,
+                  std::optional<socket_vector_t<uint16_t>> _worker_flow_idx_tmpls,
+                  std::optional<replay_timing_t> _replay_timing, const runtime_config_t *_runtime, struct tx_worker_stats_t *_stats)
+      : ready(false), pool(_pool), worker_id(_worker_id), port(_port), queue_id(_queue_id), pkt_size(_pkt_size),
+        worker_flow_idx_seq(std::move(_worker_flow_idx_seq)),
+        worker_flow_idx_tmpls(std::move(_worker_flow_idx_tmpls)), replay_timing(std::move(_replay_timing)), runtime(_runtime),
+        stats(_stats) {}
 };
 
 // Initializes a given port using global settings.
@@ -92,6 +113,25 @@ static inline int port_init(uint16_t port, unsigned num_rx_queues, unsigned num_
   if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_OUTER_UDP_CKSUM)
     port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_OUTER_UDP_CKSUM;
 
+  // Let the NIC fill in the checksums if it can, otherwise the TX workers update them incrementally in software. Pcaps may also
+  // bring TCP packets along. Tunnels have an outer IPv4 checksum too, and an outer UDP one the NIC fills in if it can (or else goes
+  // without).
+  const bool tcp                = pcap_templates_enabled() || config.proto == IPPROTO_TCP;
+  const bool tunnel             = encap_has_tunnel(config.encap);
+  const uint64_t cksum_offloads = RTE_ETH_TX_OFFLOAD_IPV4_CKSUM | RTE_ETH_TX_OFFLOAD_UDP_CKSUM | (tcp ? RTE_ETH_TX_OFFLOAD_TCP_CKSUM : 0) |
+                                  (tunnel ? RTE_ETH_TX_OFFLOAD_OUTER_IPV4_CKSUM : 0);
+  if (is_tx_port(port) && (dev_info.tx_offload_capa & cksum_offloads) == cksum_offloads) {
+    port_conf.txmode.offloads |= cksum_offloads;
+    tx_cksum_offload[port]           = true;
+    tx_outer_udp_cksum_offload[port] = (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_OUTER_UDP_CKSUM) != 0;
+  }
+
+  // Spread received packets across RX queues, so each RX worker gets its own share.
+  if (rx_rings > 1) {
+    port_conf.rxmode.mq_mode              = RTE_ETH_MQ_RX_RSS;
+    port_conf.rx_adv_conf.rss_conf.rss_hf = (RTE_ETH_RSS_IP | RTE_ETH_RSS_UDP) & dev_info.flow_type_rss_offloads;
+  }
+
   // Enable RX in promiscuous mode, just in case
   rte_eth_promiscuous_enable(port);
   if (rte_eth_promiscuous_get(port) != 1) {
@@ -140,12 +180,13 @@ static inline int port_init(uint16_t port, unsigned num_rx_queues, unsigned num_
   return 0;
 }
 
-struct rte_mempool *create_mbuf_pool(unsigned lcore_id) {
-  const unsigned mbuf_entries = RTE_MAX(MBUF_CACHE_SIZE + BURST_SIZE + NUM_SAMPLE_PACKETS, MIN_NUM_MBUFS);
+struct rte_mempool *create_mbuf_pool(const char *kind, unsigned lcore_id) {
+  // Enough for a full descriptor ring still waiting for completion, plus what the lcore cache and the bursts in flight hold.
+  const unsigned mbuf_entries = RTE_MAX(DESC_RING_SIZE + MBUF_CACHE_SIZE + 2 * BURST_SIZE, MIN_NUM_MBUFS);
 
   /* Creates a new mempool in memory to hold the mbufs. */
-  char MBUF_POOL_NAME[20];
-  sprintf(MBUF_POOL_NAME, "MBUF_POOL_%u", lcore_id);
+  char MBUF_POOL_NAME[32];
+  sprintf(MBUF_POOL_NAME, "%s_MBUF_POOL_%u", kind, lcore_id);
 
   unsigned socket_id = rte_lcore_to_socket_id(lcore_id);
 
@@ -162,7 +203,8 @@ struct rte_mempool *create_mbuf_pool(unsigned lcore_id) {
 void wait_to_start() {
   uint64_t last_cnt = runtime_config.update_cnt;
   while (!quit) {
-    if (runtime_config.running && (runtime_config.rate_per_core > 0)) {
+    const bool has_rate = config.replay_speed.has_value() || runtime_config.rate > 0 || runtime_config.mpps > 0;
+    if (runtime_config.running && has_rate) {
       break;
     }
     while ((runtime_config.update_cnt == last_cnt) && !quit) {
@@ -172,93 +214,12 @@ void wait_to_start() {
   }
 }
 
-static void generate_template_packet(byte_t *pkt, uint16_t size) {
-  bytes_t current_pkt_size = 0;
-  byte_t *current_pkt_ptr  = pkt;
-
-  struct rte_ether_hdr *ether_hdr = (struct rte_ether_hdr *)pkt;
-  current_pkt_size += sizeof(rte_ether_hdr);
-  current_pkt_ptr += sizeof(rte_ether_hdr);
-
-  ether_hdr->src_addr   = src_mac;
-  ether_hdr->dst_addr   = dst_mac;
-  ether_hdr->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
-
-  struct rte_ipv4_hdr *ip_hdr = (struct rte_ipv4_hdr *)(ether_hdr + 1);
-  current_pkt_size += sizeof(rte_ipv4_hdr);
-  current_pkt_ptr += sizeof(rte_ipv4_hdr);
-
-  ip_hdr->version_ihl     = RTE_IPV4_VHL_DEF;
-  ip_hdr->type_of_service = 0;
-  ip_hdr->total_length    = rte_cpu_to_be_16(size - sizeof(rte_ether_hdr));
-  ip_hdr->packet_id       = 0;
-  ip_hdr->fragment_offset = 0;
-  ip_hdr->time_to_live    = 64;
-  ip_hdr->next_proto_id   = IPPROTO_UDP;
-  ip_hdr->hdr_checksum    = 0; // Parameter
-  ip_hdr->src_addr        = 0; // Parameter
-  ip_hdr->dst_addr        = 0; // Parameter
-
-  // Initialize the UDP header
-  struct rte_udp_hdr *udp_hdr = (struct rte_udp_hdr *)(ip_hdr + 1);
-  current_pkt_size += sizeof(rte_udp_hdr);
-  current_pkt_ptr += sizeof(rte_udp_hdr);
-
-  udp_hdr->src_port    = 0; // Parameter
-  udp_hdr->dst_port    = 0; // Parameter
-  udp_hdr->dgram_cksum = 0;
-  udp_hdr->dgram_len   = rte_cpu_to_be_16(size - (sizeof(rte_ether_hdr) + sizeof(rte_ipv4_hdr)));
-
-  if (config.kvs_mode) {
-    udp_hdr->dst_port = rte_cpu_to_be_16(KVSTORE_PORT);
-
-    struct kvs_hdr_t *kvs_hdr = (struct kvs_hdr_t *)(udp_hdr + 1);
-    current_pkt_size += sizeof(kvs_hdr_t);
-    current_pkt_ptr += sizeof(kvs_hdr_t);
-
-    kvs_hdr->op = KVS_OP_PUT;
-    memset(kvs_hdr->key, 0, KEY_SIZE_BYTES);
-    memset(kvs_hdr->value, 0, MAX_VALUE_SIZE_BYTES);
-    kvs_hdr->status      = KVS_STATUS_MISS;
-    kvs_hdr->client_port = 0;
-  }
-
-  constexpr uint16_t max_pkt_size_no_crc = MAX_PKT_SIZE - RTE_ETHER_CRC_LEN;
-
-  byte_t *payload      = current_pkt_ptr;
-  bytes_t payload_size = max_pkt_size_no_crc - current_pkt_size;
-  memset(payload, 0xff, payload_size);
-}
-
-static void modify_packet(byte_t *pkt, const flow_t &flow, enum kvs_op kvs_op) {
-  struct rte_ether_hdr *ether_hdr = (struct rte_ether_hdr *)pkt;
-  struct rte_ipv4_hdr *ip_hdr     = (struct rte_ipv4_hdr *)(ether_hdr + 1);
-  struct rte_udp_hdr *udp_hdr     = (struct rte_udp_hdr *)(ip_hdr + 1);
-
-  ip_hdr->next_proto_id = IPPROTO_UDP;
-
-  if (config.kvs_mode) {
-    ip_hdr->src_addr  = flow.src_ip;
-    udp_hdr->src_port = flow.src_port;
-    udp_hdr->dst_port = rte_cpu_to_be_16(KVSTORE_PORT);
-
-    struct kvs_hdr_t *kvs_hdr = (struct kvs_hdr_t *)(udp_hdr + 1);
-    kvs_hdr->op               = kvs_op;
-    memcpy(kvs_hdr->key, flow.kvs_key, KEY_SIZE_BYTES);
-    memcpy(kvs_hdr->value, flow.kvs_value, MAX_VALUE_SIZE_BYTES);
-  } else {
-    ip_hdr->src_addr  = flow.src_ip;
-    udp_hdr->src_port = flow.src_port;
-    ip_hdr->dst_addr  = flow.dst_ip;
-    udp_hdr->dst_port = flow.dst_port;
-  }
-}
-
 static void dump_flows_to_file() {
   bytes_t pkt_size_without_crc = config.pkt_size - 4;
 
-  byte_t template_packet[MAX_PKT_SIZE];
-  generate_template_packet(template_packet, pkt_size_without_crc);
+  // Checksums are always computed in software here, there is no NIC to offload them to.
+  pkt_template_t tmpl;
+  generate_template_packet(tmpl, pkt_size_without_crc, config.proto, false);
 
   struct pcap_pkthdr header = {
       .ts = {.tv_sec = 0, .tv_usec = 0}, .caplen = (bpf_u_int32)pkt_size_without_crc, .len = (bpf_u_int32)pkt_size_without_crc};
@@ -274,167 +235,679 @@ static void dump_flows_to_file() {
     exit(7);
   }
 
-  const std::vector<flow_t> &flows = get_generated_flows();
-  for (const flow_t &flow : flows) {
-    modify_packet(template_packet, flow, KVS_OP_GET);
-    pcap_dump((u_char *)pd, &header, template_packet);
+  const std::vector<flow_t> &flows         = get_generated_flows();
+  const std::vector<kvs_flow_t> &kvs_flows = get_generated_kvs_flows();
+  const probe_hdr_t no_probe               = {};
+  for (size_t i = 0; i < flows6.size(); i++) {
+    modify_encap(tmpl.pkt, tmpl, i);
+    modify_packet6<false, false>(tmpl.pkt, tmpl, flows6[i], no_probe);
+    pcap_dump((u_char *)pd, &header, tmpl.pkt);
+  }
+  for (size_t i = 0; i < flows.size(); i++) {
+    modify_encap(tmpl.pkt, tmpl, i);
+    if (config.kvs_mode) {
+      modify_packet<true, false, false>(tmpl.pkt, tmpl, flows[i], &kvs_flows[i], KVS_OP_GET, no_probe);
+    } else {
+      modify_packet<false, false, false>(tmpl.pkt, tmpl, flows[i], nullptr, KVS_OP_GET, no_probe);
+    }
+    pcap_dump((u_char *)pd, &header, tmpl.pkt);
   }
 
   pcap_dump_close(pd);
   pcap_close(p);
 }
 
-// Given a desired throughput and (expected) packet size, computes the number of
-// TSC ticks per packet burst.
-static inline uint64_t compute_ticks_per_burst(rate_gbps_t rate, bits_t pkt_size) {
-  // Traffic-gen is disabled
-  if (rate == 0) {
-    return 0;
+// TX loop specializations, one per combination of what the per-packet header writers do. The mode is resolved every time the worker
+// (re)starts, so writing the headers never branches on it.
+#define TX_MODE_KVS (1 << 0)
+#define TX_MODE_CKSUM_OFFLOAD (1 << 1)
+#define TX_MODE_PROBE (1 << 2)
+#define TX_MODE_IPV6 (1 << 3)
+#define TX_MODE_TCP_CONNS (1 << 4)
+#define TX_MODE_ENCAP (1 << 5)
+#define TX_MODE_NUM_FLAGS 6
+
+// Where the flow indexes come from. That is only looked at once per burst, so instead of more TX loop specializations it picks one of
+// a few of next_flow_idxs() at runtime. The same goes for pacing, churn and which probes to send.
+enum flow_idx_source_t {
+  FLOW_IDX_SEQ,
+  FLOW_IDX_SYNC,
+  FLOW_IDX_STREAM,
+  FLOW_IDX_PACKED,
+};
+
+static enum flow_idx_source_t get_flow_idx_source() {
+  if (config.stream_dist) {
+    return FLOW_IDX_STREAM;
+  }
+  if (config.pack_seq) {
+    return FLOW_IDX_PACKED;
   }
+  return config.sync_cores ? FLOW_IDX_SYNC : FLOW_IDX_SEQ;
+}
+
+// State kept by a TX worker across (re)starts of its TX loop.
+struct tx_worker_state_t {
+  const worker_config_t *worker_config;
+
+  // Everything else the loop reads or writes per flow is on our socket too.
+  const socket_replica_t &replica;
+  const socket_vector_t<uint32_t> &local_seq;
+
+  // Template of each entry of local_seq, if they differ (see pcap_templates_enabled()). Otherwise all packets use the first one.
+  const std::vector<pkt_template_t> &tmpls;
+  const socket_vector_t<uint16_t> &local_tmpls;
 
-  pkt_size += (20 + RTE_ETHER_CRC_LEN) * 8; // CRC and inter-packet gap.
-  double packets_per_us = (rate * 1000 / pkt_size);
-  uint64_t ticks_per_us = clock_scale();
+  // Buffers are owned by the NIC from the moment it accepts them until TX completion returns them to the pool. Only packets it has
+  // not accepted yet are kept here, at the head of the next burst.
+  struct rte_mempool *pool;
+  struct rte_mbuf *burst[BURST_SIZE];
+  uint16_t num_pending;
+  struct tx_worker_stats_t *stats;
+
+  uint64_t last_update_cnt;
+  uint64_t local_flow_idx_counter;
+
+  // Where we are in the shared sequence, if synced with the other workers (see sync.h).
+  struct sync_stride_t sync_stride;
+
+  // Flow indexes drawn on the fly (see config.stream_dist) or unpacked (see config.pack_seq), a burst ahead of being sent so that
+  // their flows are in cache by then. flow_idxs_ahead is a ring, with the next one to send at ahead_pos.
+  xoshiro256_t flow_stream;
+  packed_seq_reader_t packed_reader;
+  uint64_t flow_idxs_ahead[BURST_SIZE];
+  uint16_t ahead_pos;
+
+  // Rate control
+  struct pacer_t pacer;
+  const replay_timing_t *replay_timing;
+
+  // Churn, restricted to the flows this worker owns.
+  const flow_shard_t shard;
+  ticks_t churn_ticks_inc;
+  ticks_t next_churn_tick;
+  uint64_t churn_flow_idx;
+
+  // KVS
+  const std::vector<enum kvs_op> kvs_ops;
+  socket_vector_t<uint32_t> kvs_op_cursors;
+
+  // Latency probes
+  uint32_t probe_interval;
+  uint32_t probe_countdown;
+
+  // Next sequence number of each flow on our stream, if tracking flows.
+  uint32_t *tx_seqs;
+
+  // Our connection on each flow, in stateful TCP mode.
+  socket_vector_t<tcp_conn_t> tcp_conns;
+  tcp_conn_params_t tcp_conn_params;
+
+  tx_worker_state_t(const worker_config_t *_worker_config, size_t num_flows, const socket_replica_t &_replica,
+                    const socket_vector_t<uint32_t> &_local_seq, const std::vector<pkt_template_t> &_tmpls,
+                    const socket_vector_t<uint16_t> &_local_tmpls, const flow_shard_t &_shard, std::vector<enum kvs_op> _kvs_ops)
+      : worker_config(_worker_config), replica(_replica), local_seq(_local_seq), tmpls(_tmpls), local_tmpls(_local_tmpls),
+        pool(_worker_config->pool), burst(), num_pending(0), stats(_worker_config->stats), last_update_cnt(0),
+        local_flow_idx_counter(0), sync_stride(), flow_stream(make_stream(config.seed, _worker_config->worker_id)),
+        packed_reader(config.pack_seq ? &packed_flow_idx_seq_per_worker[_worker_config->worker_id] : nullptr), flow_idxs_ahead(),
+        ahead_pos(0), pacer(), replay_timing(_worker_config->replay_timing ? &_worker_config->replay_timing.value() : nullptr),
+        shard(_shard), churn_ticks_inc(0), next_churn_tick(0), churn_flow_idx(_shard.start), kvs_ops(std::move(_kvs_ops)),
+        kvs_op_cursors(kvs_ops.empty() ? 0 : num_flows, 0, socket_allocator_t<uint32_t>(rte_socket_id())), probe_interval(0),
+        probe_countdown(0),
+        tx_seqs(config.track_flows ? get_stream_tx_seqs(_worker_config->worker_id) : nullptr),
+        tcp_conns(tcp_conns_enabled() ? num_flows : 0, tcp_conn_t{0, 0}, socket_allocator_t<tcp_conn_t>(rte_socket_id())),
+        tcp_conn_params{config.tcp_conn_pkts.value_or(0), config.tcp_flags,
+                        (uint8_t)((config.tcp_close_rst ? RTE_TCP_RST_FLAG : RTE_TCP_FIN_FLAG) | RTE_TCP_ACK_FLAG),
+                        _worker_config->worker_id, config.tx.num_cores} {}
+};
 
-  // (ticks/us * packets/burst) / (packets/us)
-  return (ticks_per_us * BURST_SIZE) / packets_per_us;
+// Pulls everything the TX loop will touch for this flow into the cache.
+static inline void prefetch_flow(const tx_worker_state_t &state, uint64_t flow_idx) {
+  if (!state.replica.flow6_slots.empty()) {
+    rte_prefetch0(&state.replica.flow6_slots[flow_idx]);
+  } else {
+    rte_prefetch0(&state.replica.flow_slots[flow_idx]);
+  }
+  if (!state.kvs_op_cursors.empty()) {
+    rte_prefetch0(&state.replica.kvs_flows[flow_idx]);
+    rte_prefetch0(&state.kvs_op_cursors[flow_idx]);
+  }
+  if (state.tx_seqs != nullptr) {
+    rte_prefetch0(&state.tx_seqs[flow_idx]);
+  }
+  if (!state.tcp_conns.empty()) {
+    rte_prefetch0(&state.tcp_conns[flow_idx]);
+  }
 }
 
-static int tx_worker_main(void *arg) {
-  worker_config_t *worker_config = (worker_config_t *)arg;
+// Takes the flow indexes of the next num_new packets, along with their templates and replay gaps (if given somewhere to put them), and
+// prefetches the flows of the burst after them.
+template <enum flow_idx_source_t source>
+static inline void next_flow_idxs(tx_worker_state_t &state, uint16_t num_new, uint64_t *flow_idxs, uint16_t *burst_tmpl_ids,
+                                  uint32_t *next_gaps) {
+  constexpr bool ahead = source == FLOW_IDX_STREAM || source == FLOW_IDX_PACKED;
+
+  const socket_vector_t<uint32_t> &seq = state.local_seq;
+  const size_t flow_idx_seq_size       = source == FLOW_IDX_PACKED ? state.packed_reader.seq->size : seq.size();
+  const uint16_t *tmpl_ids             = burst_tmpl_ids ? state.local_tmpls.data() : nullptr;
+  const uint32_t *replay_gaps          = next_gaps ? state.replay_timing->gaps.data() : nullptr;
+
+  uint64_t seq_idx = 0;
+  if constexpr (source == FLOW_IDX_SYNC) {
+    seq_idx = state.sync_stride.seq_idx;
+  } else if constexpr (source != FLOW_IDX_STREAM) {
+    seq_idx = state.local_flow_idx_counter;
+  }
+
+  for (uint16_t i = 0; i < num_new; i++) {
+    if constexpr (ahead) {
+      // Every index taken is replaced right away with the next one, which is fetched while the burst ahead of it goes out. Draws
+      // are independent of each other, so their own misses in the sampler table overlap too.
+      uint64_t &next = state.flow_idxs_ahead[state.ahead_pos];
+      flow_idxs[i]   = next;
+      if constexpr (source == FLOW_IDX_STREAM) {
+        next = state.replica.flow_sampler.sample(state.flow_stream);
+      } else {
+        next = state.packed_reader.next();
+      }
+      prefetch_flow(state, next);
+      if (++state.ahead_pos == BURST_SIZE) {
+        state.ahead_pos = 0;
+      }
+    } else {
+      flow_idxs[i] = seq[seq_idx];
+    }
+    if constexpr (source != FLOW_IDX_STREAM) {
+      if (tmpl_ids) {
+        burst_tmpl_ids[i] = tmpl_ids[seq_idx];
+      }
+      if constexpr (source == FLOW_IDX_SYNC) {
+        sync_stride_next(&state.sync_stride);
+        seq_idx = state.sync_stride.seq_idx;
+      } else if (++seq_idx == flow_idx_seq_size) {
+        seq_idx = 0;
+      }
+      if (replay_gaps) {
+        next_gaps[i] = replay_gaps[seq_idx];
+      }
+    }
+  }
 
-  const std::vector<flow_t> &flows                             = get_generated_flows();
-  const bytes_t pkt_size_without_crc                           = worker_config->pkt_size - RTE_ETHER_CRC_LEN;
-  const size_t num_total_flows                                 = flows.size();
-  const std::vector<std::vector<enum kvs_op>> kvs_ops_per_flow = generate_kvs_ops_per_flow();
-  const size_t total_kvs_ops_per_flow                          = kvs_ops_per_flow[0].size();
-  const std::vector<uint64_t> &local_seq                       = config.sync_cores ? flow_idx_seq : *worker_config->worker_flow_idx_seq;
-  const size_t flow_idx_seq_size                               = local_seq.size();
+  if constexpr (ahead) {
+    // Already fetched along with the indexes ahead.
+  } else if constexpr (source == FLOW_IDX_SYNC) {
+    // Our chunks are known ahead too, so the same goes for synced workers.
+    struct sync_stride_t next_stride = state.sync_stride;
+    for (int i = 0; i < BURST_SIZE; i++) {
+      prefetch_flow(state, seq[next_stride.seq_idx]);
+      sync_stride_next(&next_stride);
+    }
+  } else {
+    // The next burst is already known, so have its flows in cache by the time we get to it.
+    uint64_t next_seq_idx = seq_idx;
+    for (int i = 0; i < BURST_SIZE; i++) {
+      prefetch_flow(state, seq[next_seq_idx]);
+      if (++next_seq_idx == flow_idx_seq_size) {
+        next_seq_idx = 0;
+      }
+    }
+  }
 
-  struct rte_mbuf **mbufs = (struct rte_mbuf **)rte_malloc("mbufs", sizeof(rte_mbuf *) * NUM_SAMPLE_PACKETS, 0);
-  if (mbufs == NULL) {
-    rte_exit(EXIT_FAILURE, "Cannot allocate mbufs\n");
+  if constexpr (source == FLOW_IDX_SEQ || source == FLOW_IDX_PACKED) {
+    state.local_flow_idx_counter = seq_idx;
   }
+}
+
+// Sends bursts until the runtime configuration changes (or we are told to quit).
+template <uint32_t mode> static void tx_loop(tx_worker_state_t &state) {
+  constexpr bool kvs_mode      = (mode & TX_MODE_KVS);
+  constexpr bool cksum_offload = (mode & TX_MODE_CKSUM_OFFLOAD);
+  constexpr bool probe         = (mode & TX_MODE_PROBE);
+  constexpr bool ipv6          = (mode & TX_MODE_IPV6);
+  constexpr bool tcp_conns     = (mode & TX_MODE_TCP_CONNS);
+  constexpr bool encap         = (mode & TX_MODE_ENCAP);
+
+  const enum flow_idx_source_t source = get_flow_idx_source();
+  const bool sync_cores               = source == FLOW_IDX_SYNC;
+  const bool replay                   = state.replay_timing != nullptr;
+  const bool templates                = pcap_templates_enabled();
+  const bool churn                    = state.churn_ticks_inc > 0;
+  const bool latency                  = config.latency;
+  const bool track                    = state.tx_seqs != nullptr;
+
+  const runtime_config_t *runtime  = state.worker_config->runtime;
+  const size_t flow_idx_seq_size   = source == FLOW_IDX_PACKED ? state.packed_reader.seq->size : state.local_seq.size();
+  const uint16_t worker_id         = state.worker_config->worker_id;
+  const uint16_t port              = state.worker_config->port;
+  const uint16_t queue_id          = state.worker_config->queue_id;
+  const size_t total_kvs_ops       = state.kvs_ops.size();
+  const pkt_template_t *tmpls      = state.tmpls.data();
+  const uint32_t *replay_gaps      = replay ? state.replay_timing->gaps.data() : nullptr;
+  const bytes_t tcp_payload_len    = tcp_conns ? tmpls[0].size - (tmpls[0].l4_offset + sizeof(rte_tcp_hdr)) : 0;
+
+  uint64_t flow_idxs[BURST_SIZE];
+  uint32_t next_gaps[BURST_SIZE];
+  uint16_t burst_tmpl_ids[BURST_SIZE];
+
+  while (likely(!quit) && runtime->update_cnt == state.last_update_cnt) {
+    const ticks_t tick = now();
+
+    // Packets the NIC did not take last time go out first, they were already paid for. The rest of the burst is whatever the pacer
+    // says is due by now, so packets go out evenly spaced instead of in line rate bursts. Fresh buffers already hold the template
+    // packet: only the per-flow fields need rewriting.
+    rte_mbuf **new_mbufs = state.burst + state.num_pending;
+    uint16_t num_new;
+    if (replay) {
+      num_new = pacer_due_replay(&state.pacer, tick, BURST_SIZE - state.num_pending, replay_gaps, flow_idx_seq_size,
+                                 state.local_flow_idx_counter);
+    } else if (sync_cores) {
+      // Too far ahead of the others, wait for them. Whatever the pacer has due by then is still due once we may go on.
+      num_new = sync_stride_may_send(&state.sync_stride, worker_id) ? pacer_due(&state.pacer, tick, BURST_SIZE - state.num_pending) : 0;
+    } else {
+      num_new = pacer_due(&state.pacer, tick, BURST_SIZE - state.num_pending);
+    }
+
+    if (num_new == 0 && state.num_pending == 0) {
+      continue;
+    }
+
+    if (num_new > 0 && unlikely(rte_pktmbuf_alloc_bulk(state.pool, new_mbufs, num_new) != 0)) {
+      // Every buffer is still waiting for TX completion. Ask the driver to reclaim what it is done with, and try again next burst.
+      rte_eth_tx_done_cleanup(port, queue_id, 0);
+      state.stats->tx_nombuf++;
+      num_new = 0;
+    }
+
+    uint16_t *const tmpl_ids_out = templates ? burst_tmpl_ids : nullptr;
+    uint32_t *const gaps_out     = replay ? next_gaps : nullptr;
+    switch (source) {
+    case FLOW_IDX_SEQ:
+      next_flow_idxs<FLOW_IDX_SEQ>(state, num_new, flow_idxs, tmpl_ids_out, gaps_out);
+      break;
+    case FLOW_IDX_SYNC:
+      next_flow_idxs<FLOW_IDX_SYNC>(state, num_new, flow_idxs, tmpl_ids_out, gaps_out);
+      break;
+    case FLOW_IDX_STREAM:
+      next_flow_idxs<FLOW_IDX_STREAM>(state, num_new, flow_idxs, nullptr, nullptr);
+      break;
+    case FLOW_IDX_PACKED:
+      next_flow_idxs<FLOW_IDX_PACKED>(state, num_new, flow_idxs, tmpl_ids_out, gaps_out);
+      break;
+    }
+
+    // Generate a burst of packets
+    for (uint16_t i = 0; i < num_new; i++) {
+      rte_mbuf *mbuf          = new_mbufs[i];
+      byte_t *pkt             = rte_pktmbuf_mtod(mbuf, byte_t *);
+      const uint64_t flow_idx = flow_idxs[i];
+
+      // The buffer may have last carried a different template, so its headers are brought up to this one first.
+      const pkt_template_t &tmpl = templates ? tmpls[burst_tmpl_ids[i]] : tmpls[0];
+      if (templates) {
+        copy_template_hdrs(pkt, tmpl);
+      }
+
+      mbuf->data_len = tmpl.size;
+      mbuf->pkt_len  = tmpl.size;
+      set_mbuf_offloads<cksum_offload>(mbuf, tmpl);
+      if constexpr (encap) {
+        modify_encap(pkt, tmpl, flow_idx);
+      }
+      if (replay) {
+        pacer_charge_gap(&state.pacer, next_gaps[i]);
+      } else {
+        pacer_charge(&state.pacer, mbuf->pkt_len);
+      }
+
+      // Inducing churn by randomizing our own flows during run, evenly spaced in time.
+      if (churn && tick >= state.next_churn_tick) {
+        state.next_churn_tick += state.churn_ticks_inc;
+        churn_flow(state.churn_flow_idx);
+        if (++state.churn_flow_idx == state.shard.end) {
+          state.churn_flow_idx = state.shard.start;
+        }
+      }
+
+      enum kvs_op chosen_kvs_op = KVS_OP_GET;
+      if constexpr (kvs_mode) {
+        uint32_t &kvs_op_cursor = state.kvs_op_cursors[flow_idx];
+        chosen_kvs_op           = state.kvs_ops[kvs_op_cursor];
+        kvs_op_cursor           = (kvs_op_cursor + 1) % total_kvs_ops;
+      }
 
-  byte_t template_packet[MAX_PKT_SIZE];
-  generate_template_packet(template_packet, pkt_size_without_crc);
+      probe_hdr_t probe_hdr = {};
+      if constexpr (probe) {
+        if (latency && state.probe_interval > 0 && --state.probe_countdown == 0) {
+          state.probe_countdown = state.probe_interval;
+          probe_hdr.flags       = PROBE_FLAG_TSC;
+          probe_hdr.tx_tsc      = now();
+        }
+        if (track) {
+          probe_hdr.flags |= PROBE_FLAG_SEQ;
+
+          probe_hdr.flow_idx = flow_idx;
+          probe_hdr.seq      = state.tx_seqs[flow_idx]++;
+        }
+        if (probe_hdr.flags != 0) {
+          probe_hdr.magic     = PROBE_MAGIC;
+          probe_hdr.stream_id = worker_id;
+        }
+      }
 
-  // Prefill buffers with template packet.
-  for (uint32_t i = 0; i < NUM_SAMPLE_PACKETS; i++) {
-    mbufs[i] = rte_pktmbuf_alloc(worker_config->pool);
+      // Connections run on source ports of their own, so the port is only known along with the next segment.
+      tcp_conn_t *conn       = nullptr;
+      uint32_t tcp_seg_words = 0;
+      if constexpr (tcp_conns) {
+        conn = &state.tcp_conns[flow_idx];
+        if (conn->next_pkt == 0) {
+          state.stats->tx_conns++;
+        }
+      }
 
-    if (unlikely(mbufs[i] == nullptr)) {
-      rte_exit(EXIT_FAILURE, "Failed to create mbuf\n");
+      if constexpr (ipv6) {
+        flow6_t flow;
+        read_flow(state.replica, flow_idx, flow);
+        if constexpr (tcp_conns) {
+          tcp_seg_words = set_tcp_seg(pkt, tmpl, tcp_conn_next(state.tcp_conn_params, *conn, flow_idx, tcp_payload_len, flow.src_port));
+        }
+        modify_packet6<cksum_offload, probe>(pkt, tmpl, flow, probe_hdr, tcp_seg_words);
+      } else {
+        flow_t flow;
+        kvs_flow_t kvs_flow;
+        read_flow<kvs_mode>(state.replica, flow_idx, flow, kvs_flow);
+        if constexpr (tcp_conns) {
+          tcp_seg_words = set_tcp_seg(pkt, tmpl, tcp_conn_next(state.tcp_conn_params, *conn, flow_idx, tcp_payload_len, flow.src_port));
+        }
+        modify_packet<kvs_mode, cksum_offload, probe>(pkt, tmpl, flow, &kvs_flow, chosen_kvs_op, probe_hdr, tcp_seg_words);
+      }
     }
 
-    rte_pktmbuf_append(mbufs[i], pkt_size_without_crc);
-    rte_memcpy(rte_pktmbuf_mtod(mbufs[i], void *), template_packet, pkt_size_without_crc);
+    const uint16_t num_burst = state.num_pending + num_new;
+    const uint16_t num_tx    = rte_eth_tx_burst(port, queue_id, state.burst, num_burst);
+
+    // Whatever was not accepted is retried, in order, at the head of the next burst.
+    state.num_pending = num_burst - num_tx;
+    if (unlikely(state.num_pending > 0)) {
+      memmove(state.burst, state.burst + num_tx, state.num_pending * sizeof(rte_mbuf *));
+      state.stats->tx_backlog += state.num_pending;
+    }
   }
+}
 
-  // Triger clock scale calculation beforehand, as it pauses the execution for 1 second.
-  clock_scale();
+typedef void (*tx_loop_fn_t)(tx_worker_state_t &);
 
-  worker_config->ready = true;
-  wait_to_start();
+// Modes that can never be configured together get no loop, to keep the number of instantiations down.
+static constexpr bool tx_mode_valid(uint32_t mode) {
+  const bool ipv6_with_kvs      = (mode & TX_MODE_IPV6) && (mode & TX_MODE_KVS);
+  const bool tcp_conns_with_kvs = (mode & TX_MODE_TCP_CONNS) && (mode & TX_MODE_KVS);
+  const bool encap_with_kvs     = (mode & TX_MODE_ENCAP) && (mode & TX_MODE_KVS);
+  return !ipv6_with_kvs && !tcp_conns_with_kvs && !encap_with_kvs;
+}
 
-  uint64_t last_update_cnt = 0;
+template <uint32_t mode> static constexpr tx_loop_fn_t make_tx_loop() {
+  if constexpr (tx_mode_valid(mode)) {
+    return &tx_loop<mode>;
+  } else {
+    return nullptr;
+  }
+}
 
-  // Rate-limiting
-  ticks_t ticks_per_burst = compute_ticks_per_burst(worker_config->runtime->rate_per_core, (worker_config->pkt_size * 8));
+template <uint32_t... modes>
+static constexpr std::array<tx_loop_fn_t, sizeof...(modes)> make_tx_loops(std::integer_sequence<uint32_t, modes...>) {
+  return {{make_tx_loop<modes>()...}};
+}
 
-  // Rate control
-  ticks_t period_end_tick   = 0;
-  ticks_t first_tick        = now();
-  ticks_t period_start_tick = first_tick;
+// One TX loop per combination of mode flags, indexed by the mode itself.
+static constexpr std::array<tx_loop_fn_t, (1 << TX_MODE_NUM_FLAGS)> tx_loops =
+    make_tx_loops(std::make_integer_sequence<uint32_t, (1 << TX_MODE_NUM_FLAGS)>{});
 
-  ticks_t elapsed_ticks      = 0;
-  uint32_t mbuf_burst_offset = 0;
+// (Re)fills the ring of flow indexes ahead, from wherever the stream or the packed sequence is at.
+static void fill_flow_idxs_ahead(tx_worker_state_t &state) {
+  state.ahead_pos = 0;
+  for (uint64_t &next : state.flow_idxs_ahead) {
+    next = config.stream_dist ? state.replica.flow_sampler.sample(state.flow_stream) : state.packed_reader.next();
+  }
+}
 
-  bytes_t total_pkt_size          = 0;
-  uint64_t num_total_tx           = 0;
-  uint64_t local_flow_idx_counter = 0;
+static void init_mbuf_with_template(struct rte_mempool *pool, void *opaque, void *obj, unsigned obj_idx) {
+  (void)pool;
+  (void)obj_idx;
 
-  ticks_t flow_ticks            = worker_config->runtime->flow_ttl * clock_scale() / 1000;
-  ticks_t flow_ticks_offset_inc = flow_ticks / num_total_flows;
+  const pkt_template_t *tmpl = (const pkt_template_t *)opaque;
+  struct rte_mbuf *mbuf      = (struct rte_mbuf *)obj;
 
-  std::vector<ticks_t> flows_timers(num_total_flows);
-  std::vector<size_t> chosen_kvs_op_idxs(num_total_flows, 0);
+  // All of it, payload included: packets built later from larger templates only rewrite the headers.
+  rte_memcpy((byte_t *)mbuf->buf_addr + RTE_PKTMBUF_HEADROOM, tmpl->pkt, MAX_PKT_SIZE - RTE_ETHER_CRC_LEN);
+}
 
-  // Spreading out the churn, to avoid bursty churn.
-  for (uint32_t i = 0; i < num_total_flows; i++) {
-    flows_timers[i] = first_tick + i * flow_ticks_offset_inc;
+static int tx_worker_main(void *arg) {
+  worker_config_t *worker_config = (worker_config_t *)arg;
+
+  const socket_replica_t &replica             = get_socket_replica(rte_socket_id());
+  const bytes_t pkt_size_without_crc           = worker_config->pkt_size - RTE_ETHER_CRC_LEN;
+  const size_t num_total_flows                 = get_num_flows();
+  const socket_vector_t<uint32_t> &local_seq   = worker_config->worker_flow_idx_seq ? *worker_config->worker_flow_idx_seq
+                                                                                    : replica.flow_idx_seq;
+  const socket_vector_t<uint16_t> &local_tmpls = (config.sync_cores || !worker_config->worker_flow_idx_tmpls)
+                                                     ? replica.flow_idx_tmpls
+                                                     : *worker_config->worker_flow_idx_tmpls;
+  const flow_shard_t shard                     = get_flow_shard(worker_config->worker_id, config.tx.num_cores);
+  const size_t num_shard_flows                 = shard.end - shard.start;
+
+  const bool cksum_offload           = tx_cksum_offload[worker_config->port];
+  const bool outer_udp_cksum_offload = tx_outer_udp_cksum_offload[worker_config->port];
+
+  // Packets from pcaps keep their own protocol and size, everything else is built from a single template.
+  const bool templates = pcap_templates_enabled();
+  std::vector<pkt_template_t> tmpls(templates ? pkt_template_keys.size() : 1);
+  if (templates) {
+    for (size_t i = 0; i < tmpls.size(); i++) {
+      const pkt_template_key_t &key = pkt_template_keys[i];
+      generate_template_packet(tmpls[i], key.size - RTE_ETHER_CRC_LEN, key.proto, cksum_offload, outer_udp_cksum_offload);
+    }
+  } else {
+    generate_template_packet(tmpls[0], pkt_size_without_crc, config.proto, cksum_offload, outer_udp_cksum_offload);
+  }
+
+  // Write the template packet into every buffer of our pool. Buffers come back from TX completion with their contents untouched, so
+  // this only has to be done once.
+  rte_mempool_obj_iter(worker_config->pool, init_mbuf_with_template, (void *)&tmpls[0]);
+
+  tx_worker_state_t state(worker_config, num_total_flows, replica, local_seq, tmpls, local_tmpls, shard,
+                          config.kvs_mode ? generate_kvs_ops() : std::vector<enum kvs_op>{});
+
+  if (config.stream_dist || config.pack_seq) {
+    fill_flow_idxs_ahead(state);
+  }
+  if (config.sync_cores) {
+    sync_stride_init(&state.sync_stride, worker_config->worker_id, config.tx.num_cores, local_seq.size(), config.sync_tolerance);
+  }
+
+  // Rates are paced on actual sizes, but the pacer still needs to know what to expect.
+  bytes_t mean_pkt_size = worker_config->pkt_size;
+  if (templates) {
+    uint64_t total_size = 0;
+    for (uint16_t tmpl_id : local_tmpls) {
+      total_size += tmpls[tmpl_id].size + RTE_ETHER_CRC_LEN;
+    }
+    mean_pkt_size = total_size / local_tmpls.size();
+  }
+
+  // Our gaps add up to a whole lap of the trace.
+  time_ns_t replay_mean_gap = 0;
+  if (state.replay_timing) {
+    const socket_vector_t<uint32_t> &gaps = state.replay_timing->gaps;
+    replay_mean_gap                       = std::accumulate(gaps.begin(), gaps.end(), (time_ns_t)0) / gaps.size();
   }
 
-  uint16_t queue_id = worker_config->queue_id;
+  // Triger clock scale calculation beforehand, as it pauses the execution for 1 second.
+  clock_scale();
 
-  uint64_t churn_flow_idx = 0;
+  worker_config->ready = true;
 
   // Run until the application is killed
   while (likely(!quit)) {
-    // Check if the configuration was updated. We probably need to recompute some stuff before running again.
-    if (unlikely(worker_config->runtime->update_cnt > last_update_cnt)) {
-      elapsed_ticks += now() - first_tick;
-      wait_to_start();
-
-      last_update_cnt       = worker_config->runtime->update_cnt;
-      ticks_per_burst       = compute_ticks_per_burst(worker_config->runtime->rate_per_core, worker_config->pkt_size * 8);
-      flow_ticks            = worker_config->runtime->flow_ttl * clock_scale() / 1000;
-      flow_ticks_offset_inc = flow_ticks / num_total_flows;
-      first_tick            = now();
-
-      for (uint32_t i = 0; i < num_total_flows; i++) {
-        // Spreading out the churn, to avoid bursty churn.
-        flows_timers[i] = first_tick + i * flow_ticks_offset_inc;
+    // (Re)start after every configuration update, recomputing whatever depends on it.
+    wait_to_start();
+    if (unlikely(quit)) {
+      break;
+    }
+
+    const ticks_t flow_ticks = worker_config->runtime->flow_ttl * clock_scale() / 1000;
+    const ticks_t first_tick = now();
+
+    state.last_update_cnt = worker_config->runtime->update_cnt;
+
+    // Replays start over from the beginning of the trace, at the time base shared by all workers, so they stay aligned.
+    const bool replay = state.replay_timing != nullptr;
+    if (replay) {
+      state.local_flow_idx_counter = 0;
+      if (config.pack_seq) {
+        state.packed_reader.rewind();
+        fill_flow_idxs_ahead(state);
       }
+      pacer_init_replay(&state.pacer, config.replay_speed.value(), state.replay_timing->first_offset, replay_mean_gap,
+                        worker_config->runtime->start_tick);
+    } else {
+      const double rate_share = config.tx.core_rate_shares[worker_config->worker_id];
+      pacer_init(&state.pacer, worker_config->runtime->rate * rate_share, worker_config->runtime->mpps * rate_share, mean_pkt_size,
+                 first_tick);
     }
 
-    period_end_tick = (period_start_tick + ticks_per_burst);
+    // Every flow is churned once per TTL, by its owner. Spreading out the churn, to avoid bursty churn.
+    const bool churn      = flow_ticks > 0 && num_shard_flows > 0;
+    state.churn_ticks_inc = churn ? RTE_MAX(flow_ticks / num_shard_flows, (ticks_t)1) : 0;
+    state.next_churn_tick = first_tick + state.churn_ticks_inc;
+    state.probe_interval  = worker_config->runtime->probe_interval;
+    state.probe_countdown = state.probe_interval;
+
+    const bool probe    = config.latency || config.track_flows;
+    const uint32_t mode = (config.kvs_mode ? TX_MODE_KVS : 0) | (cksum_offload ? TX_MODE_CKSUM_OFFLOAD : 0) | (probe ? TX_MODE_PROBE : 0) |
+                          (config.ipv6 ? TX_MODE_IPV6 : 0) | (tcp_conns_enabled() ? TX_MODE_TCP_CONNS : 0) |
+                          (encap_per_flow(config.encap) ? TX_MODE_ENCAP : 0);
+    tx_loops[mode](state);
+  }
+
+  rte_pktmbuf_free_bulk(state.burst, state.num_pending);
 
-    rte_mbuf **mbuf_burst = mbufs + mbuf_burst_offset;
-    mbuf_burst_offset     = (mbuf_burst_offset + BURST_SIZE) % NUM_SAMPLE_PACKETS;
+  return 0;
+}
 
-    const uint64_t burst_base =
-        config.sync_cores ? shared_flow_idx_counter.fetch_add(BURST_SIZE, std::memory_order_relaxed) : local_flow_idx_counter;
+// Per RX worker configuration
+struct rx_worker_config_t {
+  bool ready;
 
-    // Generate a burst of packets
-    for (int i = 0; i < BURST_SIZE; i++) {
-      rte_mbuf *mbuf = mbuf_burst[i % NUM_SAMPLE_PACKETS];
-      total_pkt_size += mbuf->pkt_len;
-      byte_t *pkt = rte_pktmbuf_mtod(mbuf, byte_t *);
-
-      const uint64_t flow_idx   = local_seq[(burst_base + i) % flow_idx_seq_size];
-      ticks_t &flow_timer       = flows_timers[flow_idx];
-      size_t &chosen_kvs_op_idx = chosen_kvs_op_idxs[flow_idx];
-      enum kvs_op chosen_kvs_op = kvs_ops_per_flow[flow_idx][chosen_kvs_op_idx];
-      chosen_kvs_op_idx         = (chosen_kvs_op_idx + 1) % total_kvs_ops_per_flow;
-
-      // Inducing churn by randomizing flows during run.
-      if (flow_ticks > 0 && period_start_tick >= flow_timer) {
-        flow_timer += flow_ticks;
-        randomize_flow(churn_flow_idx);
-        churn_flow_idx = (churn_flow_idx + 1) % num_total_flows;
-      }
+  const uint16_t queue_id;
+  struct rx_worker_stats_t *stats;
+  struct latency_hist_t *latency_hist;
+  struct rx_seq_stats_t *seq_stats;
+
+  rx_worker_config_t(uint16_t _queue_id, struct rx_worker_stats_t *_stats, struct latency_hist_t *_latency_hist,
+                     struct rx_seq_stats_t *_seq_stats)
+      : ready(false), queue_id(_queue_id), stats(_stats), latency_hist(_latency_hist), seq_stats(_seq_stats) {}
+};
+
+// Times and/or tracks the packet, according to what its probe header carries.
+template <bool latency, bool track>
+static inline void process_probe(const struct rte_mbuf *mbuf, const rx_worker_config_t *worker_config, bytes_t ip_offset,
+                                 bytes_t udp_probe_offset, bytes_t tcp_probe_offset, ticks_t rx_tick, uint64_t ticks_per_us) {
+  if (unlikely(mbuf->data_len < udp_probe_offset + sizeof(probe_hdr_t))) {
+    return;
+  }
 
-      const flow_t &flow = flows[flow_idx];
-      modify_packet(pkt, flow, chosen_kvs_op);
+  // Packets replayed from a pcap may be TCP, with the probe after a longer L4 header. The offsets are those of IPv4 packets, IPv6
+  // ones have the probe further in. The IP version is read from the header itself, as it may be behind a tunnel.
+  const uint8_t *ip_hdr = rte_pktmbuf_mtod_offset(mbuf, const uint8_t *, ip_offset);
+  uint8_t proto;
+  bytes_t ip_hdr_growth = 0;
+  if ((ip_hdr[0] >> 4) == 6) {
+    proto         = ((const rte_ipv6_hdr *)ip_hdr)->proto;
+    ip_hdr_growth = sizeof(rte_ipv6_hdr) - sizeof(rte_ipv4_hdr);
+  } else {
+    proto = ((const rte_ipv4_hdr *)ip_hdr)->next_proto_id;
+  }
+  const bytes_t probe_offset = ((proto == IPPROTO_TCP) ? tcp_probe_offset : udp_probe_offset) + ip_hdr_growth;
+  if (unlikely(mbuf->data_len < probe_offset + sizeof(probe_hdr_t))) {
+    return;
+  }
+
+  const probe_hdr_t *probe_hdr = rte_pktmbuf_mtod_offset(mbuf, const probe_hdr_t *, probe_offset);
+  if (probe_hdr->magic != PROBE_MAGIC) {
+    return;
+  }
+
+  if constexpr (latency) {
+    if ((probe_hdr->flags & PROBE_FLAG_TSC) && probe_hdr->tx_tsc <= rx_tick) {
+      latency_record(worker_config->latency_hist, (rx_tick - probe_hdr->tx_tsc) * 1000 / ticks_per_us);
+    }
+  }
 
-      // HACK(sadok): Increase refcnt to avoid freeing.
-      mbuf->refcnt = MIN_NUM_MBUFS;
+  if constexpr (track) {
+    if (probe_hdr->flags & PROBE_FLAG_SEQ) {
+      flow_tracker_rx(worker_config->seq_stats, probe_hdr->stream_id, probe_hdr->flow_idx, probe_hdr->seq);
     }
+  }
+}
+
+// Polls a single RX queue, counting whatever comes in.
+template <bool latency, bool track> static void rx_loop(rx_worker_config_t *worker_config) {
+  constexpr bool probe = latency || track;
+
+  struct rx_worker_stats_t *stats = worker_config->stats;
+  const uint16_t queue_id         = worker_config->queue_id;
+  const bytes_t ip_offset         = sizeof(rte_ether_hdr) + get_encap_len(config.encap);
+  const bytes_t udp_probe_offset  = get_probe_offset(config.kvs_mode, IPPROTO_UDP, false);
+  const bytes_t tcp_probe_offset  = get_probe_offset(config.kvs_mode, IPPROTO_TCP, false);
+  const uint64_t ticks_per_us     = clock_scale();
 
-    num_total_tx += rte_eth_tx_burst(config.tx.port, queue_id, mbuf_burst, BURST_SIZE);
+  struct rte_mbuf *burst[BURST_SIZE];
 
-    if (!config.sync_cores) {
-      local_flow_idx_counter = (local_flow_idx_counter + BURST_SIZE) % flow_idx_seq_size;
+  while (likely(!quit)) {
+    const uint16_t num_rx = rte_eth_rx_burst(config.rx.port, queue_id, burst, BURST_SIZE);
+    if (num_rx == 0) {
+      continue;
+    }
+
+    ticks_t rx_tick = 0;
+    if constexpr (latency) {
+      rx_tick = now();
     }
 
-    while ((period_start_tick = now()) < period_end_tick) {
-      // prevent the compiler from removing this loop
-      __asm__ __volatile__("");
+    uint64_t rx_bytes = 0;
+    for (uint16_t i = 0; i < num_rx; i++) {
+      rx_bytes += burst[i]->pkt_len;
+      if constexpr (probe) {
+        if (i + 1 < num_rx) {
+          rte_prefetch0(rte_pktmbuf_mtod(burst[i + 1], void *));
+        }
+        process_probe<latency, track>(burst[i], worker_config, ip_offset, udp_probe_offset, tcp_probe_offset, rx_tick, ticks_per_us);
+      }
     }
+
+    stats->rx_pkts += num_rx;
+    stats->rx_bytes += rx_bytes;
+
+    rte_pktmbuf_free_bulk(burst, num_rx);
   }
+}
+
+typedef void (*rx_loop_fn_t)(rx_worker_config_t *);
+
+// Indexed by [latency][track].
+static constexpr rx_loop_fn_t rx_loops[2][2] = {
+    {&rx_loop<false, false>, &rx_loop<false, true>},
+    {&rx_loop<true, false>, &rx_loop<true, true>},
+};
+
+static int rx_worker_main(void *arg) {
+  rx_worker_config_t *worker_config = (rx_worker_config_t *)arg;
+
+  // Triger clock scale calculation beforehand, as it pauses the execution for 1 second.
+  clock_scale();
+
+  worker_config->ready = true;
 
-  rte_free(mbufs);
+  rx_loops[config.latency][config.track_flows](worker_config);
 
   return 0;
 }
@@ -473,7 +946,8 @@ static void test() {
 
   float loss = (float)(stats.tx_pkts - stats.rx_pkts) / stats.tx_pkts;
 
-  bits_t tx_bits = (config.pkt_size + 20) * 8 * stats.tx_pkts;
+  // Actual bytes sent, as sizes vary when replaying pcaps. Port counters leave out the CRC.
+  bits_t tx_bits = (stats.tx_bytes + (RTE_ETHER_CRC_LEN + WIRE_OVERHEAD_BYTES) * stats.tx_pkts) * 8;
 
   rate_mpps_t mpps = stats.tx_pkts / (duration * 1e6);
   rate_gbps_t gbps = tx_bits / (duration * 1e9);
@@ -485,6 +959,28 @@ static void test() {
   LOG("  Loss: %.2lf", 100 * loss);
   LOG("  Mpps: %.2lf", mpps);
   LOG("  Gbps: %.2lf", gbps);
+
+  if (config.latency) {
+    latency_summary_t latency = get_latency();
+    LOG("  p50:   %" PRIu64 " ns", latency.p50);
+    LOG("  p99:   %" PRIu64 " ns", latency.p99);
+    LOG("  p99.9: %" PRIu64 " ns", latency.p999);
+  }
+}
+
+// TX cores on another socket than their port's go through the interconnect for every descriptor and packet.
+static void warn_remote_tx_cores() {
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    const int port_socket = rte_eth_dev_socket_id(config.tx.core_ports[i]);
+    const int core_socket = get_lcore_socket(config.tx.cores[i]);
+    if (port_socket >= 0 && core_socket != port_socket) {
+      WARNING("*************************************************************************");
+      WARNING("TX core %" PRIu16 " is on socket %d, but port %" PRIu16 " is on socket %d.", config.tx.cores[i], core_socket,
+              config.tx.core_ports[i], port_socket);
+      WARNING("Its rate will suffer, prefer cores on the port's socket.");
+      WARNING("*************************************************************************");
+    }
+  }
 }
 
 int main(int argc, char *argv[]) {
@@ -506,50 +1002,123 @@ int main(int argc, char *argv[]) {
   config_init(argc, argv);
   config_print();
 
+  warn_remote_tx_cores();
+
   struct rte_mempool **mbufs_pools = (struct rte_mempool **)rte_malloc("mbufs pools", sizeof(rte_mempool *) * config.tx.num_cores, 0);
 
   for (unsigned i = 0; i < config.tx.num_cores; i++) {
     unsigned lcore_id = config.tx.cores[i];
-    mbufs_pools[i]    = create_mbuf_pool(lcore_id);
+    mbufs_pools[i]    = create_mbuf_pool("TX", lcore_id);
   }
 
-  if (port_init(config.tx.port, config.tx.num_cores, config.tx.num_cores, mbufs_pools)) {
-    rte_exit(EXIT_FAILURE, "Cannot init tx port %" PRIu16 "\n", 0);
+  // TX pools hold template packets, so received packets must never land on them. Each RX worker polls its own queue with its own
+  // pool, queues nobody polls share one.
+  struct rte_mempool *rx_mbuf_pool = create_mbuf_pool("RX", rte_get_main_lcore());
+  std::vector<struct rte_mempool *> unpolled_rx_pools(config.tx.num_cores, rx_mbuf_pool);
+  std::vector<struct rte_mempool *> rx_workers_pools(config.rx.num_cores);
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    rx_workers_pools[i] = create_mbuf_pool("RX", config.rx.cores[i]);
   }
 
-  if (config.rx.port != config.tx.port) {
-    if (port_init(config.rx.port, 1, 1, mbufs_pools)) {
-      rte_exit(EXIT_FAILURE, "Cannot init rx port %" PRIu16 "\n", 0);
+  // With RX workers, every queue of the RX port must be one of theirs, or RSS would hand packets to queues nobody polls.
+  const bool rx_workers                       = config.rx.num_cores > 0;
+  std::vector<struct rte_mempool *> &rx_pools = rx_workers ? rx_workers_pools : unpolled_rx_pools;
+
+  // Every TX port has a queue per core sending on it. The RX port may be one of them.
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    const uint16_t port       = config.tx.ports[i];
+    const uint16_t num_queues = get_tx_port_num_queues(port);
+    if (port == config.rx.port) {
+      if (port_init(port, rx_workers ? config.rx.num_cores : num_queues, num_queues, rx_pools.data())) {
+        rte_exit(EXIT_FAILURE, "Cannot init tx port %" PRIu16 "\n", port);
+      }
+    } else if (port_init(port, num_queues, num_queues, unpolled_rx_pools.data())) {
+      rte_exit(EXIT_FAILURE, "Cannot init tx port %" PRIu16 "\n", port);
     }
   }
 
+  if (!is_tx_port(config.rx.port) && port_init(config.rx.port, rx_workers ? config.rx.num_cores : 1, 1, rx_pools.data())) {
+    rte_exit(EXIT_FAILURE, "Cannot init rx port %" PRIu16 "\n", config.rx.port);
+  }
+
   generate_flows();
+  publish_flows();
+
+  if (config.track_flows) {
+    flow_tracker_init(config.tx.num_cores, get_num_flows());
+  }
 
   if (config.dump_flows_to_file) {
     dump_flows_to_file();
   }
 
   generate_flow_idx_sequence();
+  publish_flow_idx_sequence();
+
+  // Sequences are moved into the workers that walk them, never copied again. Synced workers walk the shared one, and streaming ones
+  // draw their own as they go.
+  std::vector<std::vector<uint32_t>> flow_idx_seq_per_worker = (config.sync_cores || config.stream_dist)
+                                                                   ? std::vector<std::vector<uint32_t>>{}
+                                                                   : generate_flow_idx_sequence_per_worker();
+  std::vector<std::vector<uint16_t>> flow_idx_tmpls_per_worker =
+      (config.sync_cores || !pcap_templates_enabled()) ? std::vector<std::vector<uint16_t>>{} : generate_flow_idx_tmpls_per_worker();
+  std::vector<replay_timing_t> replay_timing_per_worker =
+      config.replay_speed.has_value() ? generate_replay_timing_per_worker() : std::vector<replay_timing_t>{};
+
+  if (!config.save_workload_fname.empty()) {
+    save_workload(config.save_workload_fname, flow_idx_seq_per_worker);
+  }
+  release_flows();
 
-  const std::vector<std::vector<uint64_t>> flow_idx_seq_per_worker =
-      config.sync_cores ? std::vector<std::vector<uint64_t>>{} : generate_flow_idx_sequence_per_worker();
+  if (config.pack_seq) {
+    pack_flow_idx_sequence_per_worker(flow_idx_seq_per_worker);
+    flow_idx_seq_per_worker.clear();
+  }
 
   std::vector<std::unique_ptr<worker_config_t>> workers_configs(config.tx.num_cores);
 
   for (uint16_t i = 0; i < config.tx.num_cores; i++) {
     const uint16_t lcore_id = config.tx.cores[i];
-    const uint16_t queue_id = i;
 
-    std::optional<std::vector<uint64_t>> worker_seq = config.sync_cores ? std::nullopt : std::optional{flow_idx_seq_per_worker[i]};
+    // Copied to the worker's socket, and freed here right away.
+    const int socket_id = get_lcore_socket(lcore_id);
+    std::optional<socket_vector_t<uint32_t>> worker_seq =
+        flow_idx_seq_per_worker.empty() ? std::nullopt : std::optional{copy_to_socket(flow_idx_seq_per_worker[i], socket_id)};
+    std::optional<socket_vector_t<uint16_t>> worker_tmpls =
+        flow_idx_tmpls_per_worker.empty() ? std::nullopt : std::optional{copy_to_socket(flow_idx_tmpls_per_worker[i], socket_id)};
+    if (!flow_idx_seq_per_worker.empty()) {
+      std::vector<uint32_t>().swap(flow_idx_seq_per_worker[i]);
+    }
+    if (!flow_idx_tmpls_per_worker.empty()) {
+      std::vector<uint16_t>().swap(flow_idx_tmpls_per_worker[i]);
+    }
+    std::optional<replay_timing_t> worker_replay_timing =
+        replay_timing_per_worker.empty() ? std::nullopt : std::optional{std::move(replay_timing_per_worker[i])};
 
     workers_configs[i] =
-        std::make_unique<worker_config_t>(mbufs_pools[i], queue_id, config.pkt_size, std::move(worker_seq), &runtime_config);
+        std::make_unique<worker_config_t>(mbufs_pools[i], i, config.tx.core_ports[i], config.tx.core_queues[i], config.pkt_size,
+                                          std::move(worker_seq), std::move(worker_tmpls), std::move(worker_replay_timing),
+                                          &runtime_config, &tx_worker_stats[i]);
     rte_eal_remote_launch(tx_worker_main, static_cast<void *>(workers_configs[i].get()), lcore_id);
   }
 
-  // We no longer need the arrays. This doesn't free the mbufs themselves though, we still need them.
+  // We no longer need the arrays. This doesn't free the pools themselves though, we still need them.
   rte_free(mbufs_pools);
 
+  std::vector<std::unique_ptr<rx_worker_config_t>> rx_workers_configs(config.rx.num_cores);
+
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    const uint16_t lcore_id = config.rx.cores[i];
+    const uint16_t queue_id = i;
+
+    rx_workers_configs[i] = std::make_unique<rx_worker_config_t>(queue_id, &rx_worker_stats[i], &latency_hists[i],
+                                                                 &rx_seq_stats[i]);
+    rte_eal_remote_launch(rx_worker_main, static_cast<void *>(rx_workers_configs[i].get()), lcore_id);
+  }
+
+  // The main thread sets the shared time base, so it needs the clock scale too.
+  clock_scale();
+
   LOG("Waiting for workers...");
 
   for (std::unique_ptr<worker_config_t> &worker_config : workers_configs) {
@@ -558,8 +1127,16 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  for (std::unique_ptr<rx_worker_config_t> &worker_config : rx_workers_configs) {
+    while (!worker_config->ready) {
+      sleep_ms(100);
+    }
+  }
+
   wait_port_up(config.rx.port);
-  wait_port_up(config.tx.port);
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    wait_port_up(config.tx.ports[i]);
+  }
 
   if (config.test_and_exit) {
     test();
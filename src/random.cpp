@@ -0,0 +1,193 @@
+#include "random.h"
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "parallel.h"
+
+// Sequences are generated in chunks of this many entries, each from its own stream.
+#define RANDOM_CHUNK_SIZE (1 << 20)
+
+alias_table_t::alias_table_t(const std::vector<double> &weights) : thresholds(weights.size()), aliases(weights.size()) {
+  const size_t n     = weights.size();
+  const double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+  // Scaled so that the average column holds exactly 1. Columns short of it are topped up from those over it, one alias each.
+  std::vector<double> scaled(n);
+  std::vector<uint32_t> small;
+  std::vector<uint32_t> large;
+  for (size_t i = 0; i < n; i++) {
+    scaled[i] = weights[i] * n / total;
+    (scaled[i] < 1.0 ? small : large).push_back(i);
+  }
+
+  while (!small.empty() && !large.empty()) {
+    const uint32_t s = small.back();
+    const uint32_t l = large.back();
+    small.pop_back();
+
+    thresholds[s] = (uint32_t)std::min(scaled[s] * 4294967296.0, (double)UINT32_MAX);
+    aliases[s]    = l;
+
+    scaled[l] -= 1.0 - scaled[s];
+    if (scaled[l] < 1.0) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+
+  // Whatever is left is full, give or take rounding: it always keeps its own column.
+  for (const std::vector<uint32_t> *rest : {&small, &large}) {
+    for (uint32_t i : *rest) {
+      thresholds[i] = UINT32_MAX;
+      aliases[i]    = i;
+    }
+  }
+}
+
+std::vector<double> alias_table_t::probabilities() const {
+  const size_t n = thresholds.size();
+  std::vector<double> probs(n, 0.0);
+  for (size_t i = 0; i < n; i++) {
+    const double kept = (thresholds[i] == UINT32_MAX) ? 1.0 : thresholds[i] / 4294967296.0;
+    probs[i] += kept / n;
+    probs[aliases[i]] += (1.0 - kept) / n;
+  }
+  return probs;
+}
+
+// One stream per chunk of work, each 2^128 draws apart from the previous one.
+static std::vector<xoshiro256_t> make_streams(uint64_t seed, uint64_t num_streams) {
+  std::vector<xoshiro256_t> streams;
+  streams.reserve(num_streams);
+
+  xoshiro256_t stream(seed);
+  for (uint64_t i = 0; i < num_streams; i++) {
+    streams.push_back(stream);
+    stream.jump();
+  }
+  return streams;
+}
+
+static std::vector<double> zipf_weights(uint32_t n, double zipf_param, uint16_t num_threads) {
+  std::vector<double> weights(n);
+  const uint64_t num_chunks = (n + RANDOM_CHUNK_SIZE - 1) / RANDOM_CHUNK_SIZE;
+  parallel_for_chunks(num_chunks, num_threads, [&](uint64_t chunk) {
+    const uint64_t end = std::min<uint64_t>((chunk + 1) * RANDOM_CHUNK_SIZE, n);
+    for (uint64_t i = chunk * RANDOM_CHUNK_SIZE; i < end; i++) {
+      weights[i] = std::pow((double)(i + 1), -zipf_param);
+    }
+  });
+  return weights;
+}
+
+// Independent draws from the alias table, chunk by chunk.
+static std::vector<uint32_t> sample_zipf(const std::vector<double> &weights, uint64_t seq_len, uint64_t seed, uint16_t num_threads) {
+  const alias_table_t table(weights);
+
+  const uint64_t num_chunks = (seq_len + RANDOM_CHUNK_SIZE - 1) / RANDOM_CHUNK_SIZE;
+  std::vector<xoshiro256_t> streams = make_streams(seed, num_chunks);
+
+  std::vector<uint32_t> flow_idx_sequence(seq_len);
+  parallel_for_chunks(num_chunks, num_threads, [&](uint64_t chunk) {
+    xoshiro256_t &stream = streams[chunk];
+    const uint64_t end   = std::min<uint64_t>((chunk + 1) * RANDOM_CHUNK_SIZE, seq_len);
+    for (uint64_t i = chunk * RANDOM_CHUNK_SIZE; i < end; i++) {
+      flow_idx_sequence[i] = table.sample(stream.next());
+    }
+  });
+
+  return flow_idx_sequence;
+}
+
+// Every flow once, and the rest of the sequence split in proportion to the weights. What is left over from rounding down goes to the
+// most popular flows, where it makes the least difference. Then shuffled: every entry is sent to a random bucket, and every bucket
+// shuffled on its own, which is as good as a shuffle of the whole sequence and runs in parallel.
+static std::vector<uint32_t> cover_zipf(const std::vector<double> &weights, uint64_t seq_len, uint64_t seed, uint16_t num_threads) {
+  const uint64_t n     = weights.size();
+  const double total   = std::accumulate(weights.begin(), weights.end(), 0.0);
+  const uint64_t extra = seq_len - n;
+
+  // Entries of flow i are [starts[i], starts[i + 1]) of the sequence, before the shuffle.
+  std::vector<uint64_t> starts(n + 1);
+  uint64_t assigned = 0;
+  for (uint64_t i = 0; i < n; i++) {
+    starts[i] = 1 + (uint64_t)(extra * (weights[i] / total));
+    assigned += starts[i] - 1;
+  }
+  for (uint64_t i = 0; assigned < extra; i = (i + 1) % n) {
+    starts[i]++;
+    assigned++;
+  }
+  std::exclusive_scan(starts.begin(), starts.end(), starts.begin(), (uint64_t)0);
+
+  const uint64_t num_chunks         = (seq_len + RANDOM_CHUNK_SIZE - 1) / RANDOM_CHUNK_SIZE;
+  const uint64_t num_buckets        = num_chunks;
+  std::vector<xoshiro256_t> streams = make_streams(seed, num_chunks + num_buckets);
+
+  // How many entries of each chunk go to each bucket, and then where in the bucket they start. The bucket of every entry is drawn
+  // twice from the same stream: once to count, once to scatter.
+  std::vector<uint64_t> offsets(num_chunks * num_buckets, 0);
+  parallel_for_chunks(num_chunks, num_threads, [&](uint64_t chunk) {
+    xoshiro256_t stream = streams[chunk];
+    const uint64_t end  = std::min<uint64_t>((chunk + 1) * RANDOM_CHUNK_SIZE, seq_len);
+    for (uint64_t i = chunk * RANDOM_CHUNK_SIZE; i < end; i++) {
+      offsets[chunk * num_buckets + stream.next_below(num_buckets)]++;
+    }
+  });
+
+  std::vector<uint64_t> bucket_starts(num_buckets + 1, 0);
+  uint64_t offset = 0;
+  for (uint64_t bucket = 0; bucket < num_buckets; bucket++) {
+    bucket_starts[bucket] = offset;
+    for (uint64_t chunk = 0; chunk < num_chunks; chunk++) {
+      const uint64_t count                 = offsets[chunk * num_buckets + bucket];
+      offsets[chunk * num_buckets + bucket] = offset;
+      offset += count;
+    }
+  }
+  bucket_starts[num_buckets] = offset;
+
+  std::vector<uint32_t> flow_idx_sequence(seq_len);
+  parallel_for_chunks(num_chunks, num_threads, [&](uint64_t chunk) {
+    xoshiro256_t stream = streams[chunk];
+    const uint64_t end  = std::min<uint64_t>((chunk + 1) * RANDOM_CHUNK_SIZE, seq_len);
+    uint64_t flow_idx   = std::upper_bound(starts.begin(), starts.end(), chunk * RANDOM_CHUNK_SIZE) - starts.begin() - 1;
+    for (uint64_t i = chunk * RANDOM_CHUNK_SIZE; i < end; i++) {
+      while (i >= starts[flow_idx + 1]) {
+        flow_idx++;
+      }
+      flow_idx_sequence[offsets[chunk * num_buckets + stream.next_below(num_buckets)]++] = flow_idx;
+    }
+  });
+
+  parallel_for_chunks(num_buckets, num_threads, [&](uint64_t bucket) {
+    xoshiro256_t &stream = streams[num_chunks + bucket];
+    const uint64_t start = bucket_starts[bucket];
+    for (uint64_t i = bucket_starts[bucket + 1] - start; i > 1; i--) {
+      std::swap(flow_idx_sequence[start + i - 1], flow_idx_sequence[start + stream.next_below(i)]);
+    }
+  });
+
+  return flow_idx_sequence;
+}
+
+std::vector<uint32_t> generate_zipf_flow_idx_sequence(uint32_t n, double zipf_param, uint64_t seq_len, bool cover, uint64_t seed,
+                                                      uint16_t num_threads) {
+  LOG("Generating zipfian distribution: %" PRIu64 " entries over %" PRIu32 " flows%s, %" PRIu16 " threads...", seq_len, n,
+      cover ? " (all of them)" : "", num_threads);
+
+  const std::vector<double> weights = zipf_weights(n, zipf_param, num_threads);
+  std::vector<uint32_t> flow_idx_sequence =
+      cover ? cover_zipf(weights, seq_len, seed, num_threads) : sample_zipf(weights, seq_len, seed, num_threads);
+
+  return flow_idx_sequence;
+}
+
+alias_table_t generate_zipf_alias_table(uint32_t n, double zipf_param, uint16_t num_threads) {
+  LOG("Building zipfian sampler: %" PRIu32 " flows, %" PRIu16 " threads...", n, num_threads);
+  return alias_table_t(zipf_weights(n, zipf_param, num_threads));
+}
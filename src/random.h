@@ -1,107 +1,132 @@
 #pragma once
 
 #include <vector>
-#include <cmath>
-#include <cassert>
-#include <unordered_set>
-
-#include <rte_random.h>
+#include <cstring>
+#include <stdint.h>
 
 #include "log.h"
 
-// From Castan [SIGCOMM'18]
-// Source:
-// https://github.com/nal-epfl/castan/blob/master/scripts/pcap_tools/create_zipfian_distribution_pcap.py
-inline uint64_t zipf_random_number_generator(uint64_t total_flows, double zipf_param) {
-  assert(zipf_param != 1.0 && "Invalid zipf_param");
-
-  const double probability = (double)rte_rand() / (double)UINT64_MAX;
-  assert(probability >= 0 && probability <= 1 && "Invalid probability");
-
-  const double p         = probability;
-  const uint64_t N       = total_flows + 1;
-  const double s         = zipf_param;
-  const double tolerance = 0.01;
-  double x               = (double)N / 2.0;
-
-  const double D = p * (12.0 * (pow(N, 1.0 - s) - 1) / (1.0 - s) + 6.0 - 6.0 * pow(N, -s) + s - pow(N, -1.0 - s) * s);
-
-  while (true) {
-    const double m    = pow(x, -2 - s);
-    const double mx   = m * x;
-    const double mxx  = mx * x;
-    const double mxxx = mxx * x;
-
-    const double a    = 12.0 * (mxxx - 1) / (1.0 - s) + 6.0 * (1.0 - mxx) + (s - (mx * s)) - D;
-    const double b    = 12.0 * mxx + 6.0 * (s * mx) + (m * s * (s + 1.0));
-    const double newx = std::max(1.0, x - a / b);
-
-    if (std::abs(newx - x) <= tolerance) {
-      const uint64_t i = newx - 1;
-      assert(i < total_flows && "Invalid index");
-      return i;
+// xoshiro256** [Blackman, Vigna]. jump() advances it by 2^128 draws, which splits a single seed into as many non-overlapping streams
+// as there are chunks of work to generate in parallel.
+struct xoshiro256_t {
+  uint64_t s[4];
+
+  explicit xoshiro256_t(uint64_t seed) {
+    // Seeded through splitmix64, as the authors recommend, so that nearby seeds still give unrelated states.
+    for (uint64_t &word : s) {
+      seed += 0x9e3779b97f4a7c15ull;
+      uint64_t z = seed;
+      z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z          = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      word       = z ^ (z >> 31);
     }
-
-    x = newx;
   }
-}
 
-inline std::vector<uint64_t> generate_uniform_flow_idx_sequence(uint64_t n) {
-  std::vector<uint64_t> flow_idx_sequence(n);
+  static inline uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
 
-  int progress      = 0;
-  int last_progress = 0;
+  inline uint64_t next() {
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t      = s[1] << 17;
 
-  for (uint64_t i = 0; i < n; i++) {
-    flow_idx_sequence[i] = i;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
 
-    progress = 100 * (i + 1) / n;
-    if (progress != last_progress) {
-      last_progress = progress;
-      LOG_REWRITE("Generating uniform distribution: %d%%", progress);
-    }
+    return result;
   }
 
-  LOG();
+  // Uniform in [0, n), for n < 2^32.
+  inline uint32_t next_below(uint32_t n) { return (uint32_t)(((next() >> 32) * n) >> 32); }
+
+  void jump() {
+    static const uint64_t jump_poly[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+
+    uint64_t t[4] = {0, 0, 0, 0};
+    for (uint64_t poly : jump_poly) {
+      for (int b = 0; b < 64; b++) {
+        if (poly & (1ull << b)) {
+          for (int i = 0; i < 4; i++) {
+            t[i] ^= s[i];
+          }
+        }
+        next();
+      }
+    }
+    memcpy(s, t, sizeof(s));
+  }
+};
 
-  return flow_idx_sequence;
+// The stream_id-th of the streams a seed is split into by jump().
+inline xoshiro256_t make_stream(uint64_t seed, uint64_t stream_id) {
+  xoshiro256_t stream(seed);
+  for (uint64_t i = 0; i < stream_id; i++) {
+    stream.jump();
+  }
+  return stream;
 }
 
-inline std::vector<uint64_t> generate_zipf_flow_idx_sequence(uint64_t n, double zipf_param) {
-  std::unordered_set<uint64_t> used_flow_idxs;
-  std::vector<uint64_t> flow_idx_sequence;
+// Walker's alias method, with Vose's construction: exact O(1) sampling from any discrete distribution of less than 2^32 outcomes. A
+// random column is kept with the probability of its threshold, or else gives way to its alias.
+struct alias_table_t {
+  std::vector<uint32_t> thresholds; // Out of 2^32
+  std::vector<uint32_t> aliases;
 
-  if (zipf_param == 0 || zipf_param == 1) {
-    const double epsilon = 1e-6;
-    LOG("WARNING: Incompatible zipf parameter of %lf, adding epsilon=%le", zipf_param, epsilon);
-    zipf_param += epsilon;
+  alias_table_t() = default;
+  explicit alias_table_t(const std::vector<double> &weights);
+
+  // Probability of every outcome, as the table actually gives it: its own share of its column, plus what other columns leave to it.
+  std::vector<double> probabilities() const;
+
+  inline uint32_t sample(uint64_t r) const { return sample(thresholds.data(), aliases.data(), thresholds.size(), r); }
+
+  // The top 32 bits of the random word pick the column, the bottom ones decide between it and its alias.
+  static inline uint32_t sample(const uint32_t *thresholds, const uint32_t *aliases, uint32_t num_cols, uint64_t r) {
+    const uint32_t col = (uint32_t)(((r >> 32) * num_cols) >> 32);
+    return ((uint32_t)r < thresholds[col]) ? col : aliases[col];
+  }
+};
+
+// Draws flow indexes on the fly, one random word each: uniformly, or from the columns of an alias table (one per flow) if there are
+// any. Takes O(flows) memory instead of the O(sequence) of a materialized sequence. The columns are wherever the caller keeps them.
+struct flow_sampler_t {
+  uint32_t num_flows;
+  const uint32_t *thresholds;
+  const uint32_t *aliases;
+
+  inline uint64_t sample(xoshiro256_t &stream) const {
+    return thresholds == nullptr ? stream.next_below(num_flows) : alias_table_t::sample(thresholds, aliases, num_flows, stream.next());
   }
+};
+
+inline std::vector<uint32_t> generate_uniform_flow_idx_sequence(uint32_t n) {
+  std::vector<uint32_t> flow_idx_sequence(n);
 
   int progress      = 0;
   int last_progress = 0;
 
-  while (used_flow_idxs.size() < n) {
-    const uint64_t flow_idx = zipf_random_number_generator(n, zipf_param);
-    used_flow_idxs.insert(flow_idx);
-    flow_idx_sequence.push_back(flow_idx);
+  for (uint64_t i = 0; i < n; i++) {
+    flow_idx_sequence[i] = i;
 
-    progress = 100 * used_flow_idxs.size() / n;
+    progress = 100 * (i + 1) / n;
     if (progress != last_progress) {
       last_progress = progress;
-      LOG_REWRITE("Generating zipfian distribution: %d%%", progress);
-    }
-
-    if (flow_idx_sequence.size() >= 1000 * n) {
-      break;
+      LOG_REWRITE("Generating uniform distribution: %d%%", progress);
     }
   }
 
   LOG();
-  if (used_flow_idxs.size() != n) {
-    LOG("WARNING: Zipfian distribution is taking too long to generate. Using just %lu flows (%.2f%%).", used_flow_idxs.size(),
-        100.0 * used_flow_idxs.size() / n);
-    return flow_idx_sequence;
-  }
 
   return flow_idx_sequence;
 }
+
+// Sequence of seq_len flow indexes, drawn from a Zipf distribution of parameter zipf_param over n flows (flow 0 being the most popular
+// one). With cover, every flow shows up at least once, and the rest of the sequence is split among them in exact proportion to their
+// probabilities, in random order. Generated over num_threads threads, with the same result for any number of them.
+std::vector<uint32_t> generate_zipf_flow_idx_sequence(uint32_t n, double zipf_param, uint64_t seq_len, bool cover, uint64_t seed,
+                                                      uint16_t num_threads);
+
+// Alias table of the Zipf distribution of parameter zipf_param over n flows, for drawing from on the fly.
+alias_table_t generate_zipf_alias_table(uint32_t n, double zipf_param, uint16_t num_threads);
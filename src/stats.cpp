@@ -4,6 +4,15 @@
 #include "log.h"
 #include "config.h"
 #include "stats.h"
+#include "latency.h"
+#include "tracker.h"
+
+struct tx_worker_stats_t tx_worker_stats[RTE_MAX_LCORE];
+struct rx_worker_stats_t rx_worker_stats[RTE_MAX_LCORE];
+
+// Worker counters are never written by the main thread, resetting them just moves the baseline.
+static struct tx_worker_stats_t tx_worker_stats_baseline[RTE_MAX_LCORE];
+static struct rx_worker_stats_t rx_worker_stats_baseline[RTE_MAX_LCORE];
 
 static void cmd_stats_display_port(uint16_t port_id) {
   struct rte_eth_stats stats;
@@ -59,38 +68,68 @@ static uint64_t get_port_xstat(uint16_t port, const char *name) {
 }
 
 stats_t get_stats() {
-  uint64_t tx_pkts  = get_port_xstat(config.tx.port, "tx_good_packets");
-  uint64_t tx_bytes = get_port_xstat(config.tx.port, "tx_good_bytes");
-
-  uint64_t rx_good_pkts   = get_port_xstat(config.rx.port, "rx_good_packets");
-  uint64_t rx_good_bytes  = get_port_xstat(config.rx.port, "rx_good_bytes");
-  uint64_t rx_missed_pkts = get_port_xstat(config.rx.port, "rx_missed_errors");
-  uint64_t rx_error_bytes = get_port_xstat(config.rx.port, "rx_error_bytes");
+  // All TX ports together.
+  uint64_t tx_pkts  = 0;
+  uint64_t tx_bytes = 0;
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    tx_pkts += get_port_xstat(config.tx.ports[i], "tx_good_packets");
+    tx_bytes += get_port_xstat(config.tx.ports[i], "tx_good_bytes");
+  }
 
-  // We don't care if we missed them, the fact that we've received them back is good enough.
-  uint64_t rx_pkts  = rx_good_pkts + rx_missed_pkts;
-  uint64_t rx_bytes = rx_good_bytes + rx_error_bytes;
+  uint64_t rx_pkts  = 0;
+  uint64_t rx_bytes = 0;
+
+  if (config.rx.num_cores > 0) {
+    // Only what the RX workers actually polled counts.
+    for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+      rx_pkts += rx_worker_stats[i].rx_pkts - rx_worker_stats_baseline[i].rx_pkts;
+      rx_bytes += rx_worker_stats[i].rx_bytes - rx_worker_stats_baseline[i].rx_bytes;
+    }
+  } else {
+    uint64_t rx_good_pkts   = get_port_xstat(config.rx.port, "rx_good_packets");
+    uint64_t rx_good_bytes  = get_port_xstat(config.rx.port, "rx_good_bytes");
+    uint64_t rx_missed_pkts = get_port_xstat(config.rx.port, "rx_missed_errors");
+    uint64_t rx_error_bytes = get_port_xstat(config.rx.port, "rx_error_bytes");
+
+    // We don't care if we missed them, the fact that we've received them back is good enough.
+    rx_pkts  = rx_good_pkts + rx_missed_pkts;
+    rx_bytes = rx_good_bytes + rx_error_bytes;
+  }
 
   // Reseting stats is not atomic, so there's a chance we detect more packets received that sent.
   // It's not that problematic, but let's take that into consideration.
   rx_pkts  = RTE_MIN(rx_pkts, tx_pkts);
   rx_bytes = RTE_MIN(rx_bytes, tx_bytes);
 
+  uint64_t tx_backlog = 0;
+  uint64_t tx_nombuf  = 0;
+  uint64_t tx_conns   = 0;
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    tx_backlog += tx_worker_stats[i].tx_backlog - tx_worker_stats_baseline[i].tx_backlog;
+    tx_nombuf += tx_worker_stats[i].tx_nombuf - tx_worker_stats_baseline[i].tx_nombuf;
+    tx_conns += tx_worker_stats[i].tx_conns - tx_worker_stats_baseline[i].tx_conns;
+  }
+
   stats_t stats = {
-      .rx_pkts  = rx_pkts,
-      .rx_bytes = rx_bytes,
-      .tx_pkts  = tx_pkts,
-      .tx_bytes = tx_bytes,
+      .rx_pkts    = rx_pkts,
+      .rx_bytes   = rx_bytes,
+      .tx_pkts    = tx_pkts,
+      .tx_bytes   = tx_bytes,
+      .tx_backlog = tx_backlog,
+      .tx_nombuf  = tx_nombuf,
+      .tx_conns   = tx_conns,
   };
 
   return stats;
 }
 
 void cmd_stats_display() {
-  LOG("~~~~ TX port %u ~~~~", config.tx.port);
-  cmd_stats_display_port(config.tx.port);
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    LOG("~~~~ TX port %u ~~~~", config.tx.ports[i]);
+    cmd_stats_display_port(config.tx.ports[i]);
+    LOG();
+  }
 
-  LOG();
   LOG("~~~~ RX port %u ~~~~", config.rx.port);
   cmd_stats_display_port(config.rx.port);
 
@@ -105,8 +144,25 @@ void cmd_stats_display_compact() {
   LOG();
   LOG("~~~~~~ Pktgen ~~~~~~");
   LOG("  TX:   %" PRIu64 " pkts %" PRIu64 " bytes", stats.tx_pkts, stats.tx_bytes);
+  if (config.tx.num_ports > 1) {
+    for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+      const uint16_t port = config.tx.ports[i];
+      LOG("    port %" PRIu16 ": %" PRIu64 " pkts %" PRIu64 " bytes", port, get_port_xstat(port, "tx_good_packets"),
+          get_port_xstat(port, "tx_good_bytes"));
+    }
+  }
   LOG("  RX:   %" PRIu64 " pkts %" PRIu64 " bytes", stats.rx_pkts, stats.rx_bytes);
   LOG("  Loss: %.2f%%", 100 * loss);
+  LOG("  TX backlog: %" PRIu64 " pkts retried, %" PRIu64 " bursts out of buffers", stats.tx_backlog, stats.tx_nombuf);
+  if (tcp_conns_enabled()) {
+    LOG("  TCP connections: %" PRIu64 " opened", stats.tx_conns);
+  }
+
+  if (config.latency) {
+    latency_summary_t latency = get_latency();
+    LOG("  Latency: %" PRIu64 " probes, p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, p99.9 %" PRIu64 " ns, max %" PRIu64 " ns",
+        latency.samples, latency.p50, latency.p99, latency.p999, latency.max);
+  }
 }
 
 static void reset_stats(uint16_t port) {
@@ -124,6 +180,21 @@ static void reset_stats(uint16_t port) {
 }
 
 void cmd_stats_reset() {
-  reset_stats(config.tx.port);
-  reset_stats(config.rx.port);
+  for (uint16_t i = 0; i < config.tx.num_ports; i++) {
+    reset_stats(config.tx.ports[i]);
+  }
+  if (!is_tx_port(config.rx.port)) {
+    reset_stats(config.rx.port);
+  }
+
+  for (uint16_t i = 0; i < config.tx.num_cores; i++) {
+    tx_worker_stats_baseline[i] = tx_worker_stats[i];
+  }
+
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    rx_worker_stats_baseline[i] = rx_worker_stats[i];
+  }
+
+  latency_reset();
+  flow_tracker_reset();
 }
\ No newline at end of file
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include <rte_common.h>
+
 void cmd_stats_display();
 void cmd_stats_display_compact();
 void cmd_stats_reset();
@@ -11,6 +13,30 @@ struct stats_t {
   uint64_t rx_bytes;
   uint64_t tx_pkts;
   uint64_t tx_bytes;
+  uint64_t tx_backlog;
+  uint64_t tx_nombuf;
+  uint64_t tx_conns;
 };
 
+// Per TX worker counters. Each worker only ever writes to its own entry, the main thread only reads them. Packets and bytes sent
+// come from the TX ports' own counters instead (see get_stats()).
+struct tx_worker_stats_t {
+  // Packets the NIC did not accept on the first try, and had to be retried.
+  uint64_t tx_backlog;
+  // Bursts delayed because every buffer was still waiting for TX completion.
+  uint64_t tx_nombuf;
+  // Stateful TCP connections opened (SYNs sent).
+  uint64_t tx_conns;
+} __rte_cache_aligned;
+
+extern struct tx_worker_stats_t tx_worker_stats[RTE_MAX_LCORE];
+
+// Per RX worker counters, same ownership rules as the TX ones.
+struct rx_worker_stats_t {
+  uint64_t rx_pkts;
+  uint64_t rx_bytes;
+} __rte_cache_aligned;
+
+extern struct rx_worker_stats_t rx_worker_stats[RTE_MAX_LCORE];
+
 struct stats_t get_stats();
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <rte_branch_prediction.h>
+#include <rte_common.h>
+#include <rte_lcore.h>
+
+#include "types.h"
+
+// Synced workers (see config.sync_cores) walk the shared sequence together, without a shared counter. The sequence is cut in chunks of
+// SYNC_CHUNK_SIZE entries, dealt round robin to the workers: worker w sends chunks w, w + num_workers, w + 2 * num_workers, and so on.
+// Together they send it in order, give or take how far apart they drift, which is bounded by holding back any worker that gets more
+// than a tolerance of entries ahead of the slowest one. Workers only check between bursts, so they may overshoot it by a burst (and
+// the chunks of the others it jumps over).
+//
+// Positions are global and never wrap (entry pos of the walk is pos % seq_size of the sequence). Every worker publishes its own, on a
+// cache line of its own, and only reads the others' when it is about to outrun the slowest one it last saw.
+
+#define SYNC_CHUNK_SIZE BURST_SIZE
+// Default tolerance, in chunks per worker.
+#define SYNC_DEFAULT_TOLERANCE_CHUNKS 4
+
+struct sync_pos_t {
+  std::atomic<uint64_t> pos;
+} __rte_cache_aligned;
+
+// Next position of every worker, indexed by worker id.
+extern struct sync_pos_t sync_positions[RTE_MAX_LCORE];
+
+struct sync_stride_t {
+  uint64_t pos;
+  uint64_t seq_idx;
+  uint32_t chunk_left;
+
+  // Entries of the other workers between two of our chunks.
+  uint64_t skip;
+  uint64_t seq_size;
+  uint16_t num_workers;
+
+  uint64_t tolerance;
+  // Position of the slowest worker, when last looked at. It only ever lags behind the actual one.
+  uint64_t slowest;
+};
+
+static inline void sync_stride_init(struct sync_stride_t *stride, uint16_t worker_id, uint16_t num_workers, uint64_t seq_size,
+                                    uint64_t tolerance) {
+  stride->pos         = (uint64_t)worker_id * SYNC_CHUNK_SIZE;
+  stride->seq_idx     = stride->pos % seq_size;
+  stride->chunk_left  = SYNC_CHUNK_SIZE;
+  stride->skip        = (uint64_t)(num_workers - 1) * SYNC_CHUNK_SIZE;
+  stride->seq_size    = seq_size;
+  stride->num_workers = num_workers;
+  stride->tolerance   = tolerance;
+  stride->slowest     = 0;
+}
+
+// Moves on to our next entry, jumping over the chunks of the other workers at the end of ours.
+static inline void sync_stride_next(struct sync_stride_t *stride) {
+  stride->pos++;
+  if (++stride->seq_idx == stride->seq_size) {
+    stride->seq_idx = 0;
+  }
+
+  if (unlikely(--stride->chunk_left == 0)) {
+    stride->pos += stride->skip;
+    stride->seq_idx    = (stride->seq_idx + stride->skip) % stride->seq_size;
+    stride->chunk_left = SYNC_CHUNK_SIZE;
+  }
+}
+
+// Whether we are within the tolerance of the slowest worker, and may send more. Also publishes where we are.
+static inline bool sync_stride_may_send(struct sync_stride_t *stride, uint16_t worker_id) {
+  sync_positions[worker_id].pos.store(stride->pos, std::memory_order_relaxed);
+
+  if (likely(stride->pos - stride->slowest <= stride->tolerance)) {
+    return true;
+  }
+
+  uint64_t slowest = stride->pos;
+  for (uint16_t i = 0; i < stride->num_workers; i++) {
+    slowest = RTE_MIN(slowest, sync_positions[i].pos.load(std::memory_order_relaxed));
+  }
+  stride->slowest = slowest;
+
+  return stride->pos - slowest <= stride->tolerance;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <rte_byteorder.h>
+#include <rte_tcp.h>
+
+#include "packet.h"
+
+// Stateful TCP: every flow carries connections one after the other, each a SYN, a set number of data packets and a FIN (or RST),
+// in the order a real connection would send them. Nothing is ever received back, so the other end of the connection is made up.
+//
+// Each TX worker runs connections of its own on the flows it sends, on source ports of its own, so that workers sharing a flow never
+// interleave their segments. Flows churned mid-connection simply carry the rest of it on their new 5-tuple.
+
+// Where a TX worker is in the connection it runs on a flow. Kept this small so that millions of them fit in a per-worker array.
+struct tcp_conn_t {
+  uint16_t next_pkt; // 0 for the SYN, then the data packets, then the FIN/RST
+  uint16_t gen;      // Connections the worker has opened on the flow so far
+};
+
+static_assert(sizeof(tcp_conn_t) == 4, "tcp_conn_t is expected to be a packed 4-byte record");
+
+// How a TX worker runs its connections.
+struct tcp_conn_params_t {
+  uint16_t data_pkts;
+  uint8_t data_flags;
+  uint8_t close_flags;
+  uint16_t worker_id;
+  uint16_t num_workers;
+};
+
+// What tells a connection apart from the others on the same flow: its own source port, and its own initial sequence numbers.
+static inline uint32_t tcp_conn_id(const tcp_conn_params_t &params, const tcp_conn_t &conn) {
+  return (uint32_t)conn.gen * params.num_workers + params.worker_id;
+}
+
+static inline uint32_t tcp_conn_isn(uint64_t flow_idx, uint32_t conn_id, uint64_t salt) {
+  return (uint32_t)((((flow_idx << 32) | conn_id) ^ salt) * 0x9e3779b97f4a7c15ull >> 32);
+}
+
+// Segment fields of the next packet of the connection on this flow, advancing it (and opening the next connection after the last
+// packet). Every packet carries the template's payload, the SYN and FIN included, and takes up its share of the sequence space.
+static inline tcp_seg_t tcp_conn_next(const tcp_conn_params_t &params, tcp_conn_t &conn, uint64_t flow_idx, bytes_t payload_len,
+                                      rte_be16_t &src_port) {
+  const uint32_t conn_id = tcp_conn_id(params, conn);
+  const uint32_t isn     = tcp_conn_isn(flow_idx, conn_id, 0);
+  const uint32_t peer    = tcp_conn_isn(flow_idx, conn_id, ~0ull);
+  const uint32_t pkt     = conn.next_pkt;
+
+  tcp_seg_t seg;
+  if (pkt == 0) {
+    seg.flags = RTE_TCP_SYN_FLAG;
+    seg.seq   = rte_cpu_to_be_32(isn);
+    seg.ack   = 0;
+  } else {
+    // The SYN takes up one more sequence number than its payload.
+    seg.flags = (pkt <= params.data_pkts) ? params.data_flags : params.close_flags;
+    seg.seq   = rte_cpu_to_be_32(isn + pkt * payload_len + 1);
+    seg.ack   = rte_cpu_to_be_32(peer + 1);
+  }
+
+  src_port = rte_cpu_to_be_16((uint16_t)(rte_be_to_cpu_16(src_port) + conn_id));
+
+  if (++conn.next_pkt == params.data_pkts + 2) {
+    conn.next_pkt = 0;
+    conn.gen++;
+  }
+
+  return seg;
+}
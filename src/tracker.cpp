@@ -0,0 +1,142 @@
+#include <rte_malloc.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "tracker.h"
+#include "config.h"
+#include "flows.h"
+#include "log.h"
+#include "numa.h"
+
+#define TRACKER_TOP_FLOWS 10
+
+struct flow_tracker_t flow_tracker;
+struct rx_seq_stats_t rx_seq_stats[RTE_MAX_LCORE];
+
+// Resetting only moves the baselines, as everywhere else. The maximum reorder depth is started over by the RX workers instead.
+static std::vector<uint32_t> tx_seqs_baseline;
+static std::vector<uint32_t> rx_counts_baseline;
+static struct rx_seq_stats_t rx_seq_stats_baseline[RTE_MAX_LCORE];
+
+template <typename T> static T *tracker_alloc(const char *name, size_t num_entries, int socket_id = SOCKET_ID_ANY) {
+  T *entries = (T *)socket_malloc(name, num_entries * sizeof(T), socket_id);
+  if (entries == NULL) {
+    rte_exit(EXIT_FAILURE, "Failed to allocate flow tracker (%s)\n", name);
+  }
+  memset(entries, 0, num_entries * sizeof(T));
+  return entries;
+}
+
+void flow_tracker_init(uint32_t num_streams, uint32_t num_flows) {
+  const size_t num_entries = (size_t)num_streams * num_flows;
+
+  flow_tracker.num_streams  = num_streams;
+  flow_tracker.num_flows    = num_flows;
+  flow_tracker.rx_next_seqs = tracker_alloc<uint32_t>("tracker rx seqs", num_entries);
+  flow_tracker.rx_counts    = tracker_alloc<uint32_t>("tracker rx counts", num_entries);
+  flow_tracker.rx_windows   = tracker_alloc<uint64_t>("tracker rx windows", num_entries);
+
+  // Streams are TX workers.
+  for (uint32_t stream = 0; stream < num_streams; stream++) {
+    flow_tracker.tx_seqs[stream] = tracker_alloc<uint32_t>("tracker tx seqs", num_flows, get_lcore_socket(config.tx.cores[stream]));
+  }
+
+  tx_seqs_baseline.assign(num_entries, 0);
+  rx_counts_baseline.assign(num_entries, 0);
+}
+
+void flow_tracker_reset() {
+  if (!config.track_flows) {
+    return;
+  }
+
+  const size_t num_entries = (size_t)flow_tracker.num_streams * flow_tracker.num_flows;
+  for (size_t i = 0; i < num_entries; i++) {
+    tx_seqs_baseline[i]   = flow_tracker.tx_seqs[i / flow_tracker.num_flows][i % flow_tracker.num_flows];
+    rx_counts_baseline[i] = flow_tracker.rx_counts[i];
+  }
+
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    rx_seq_stats_baseline[i] = rx_seq_stats[i];
+  }
+  flow_tracker.reset_epoch.fetch_add(1, std::memory_order_relaxed);
+}
+
+void cmd_loss_display() {
+  if (!config.track_flows) {
+    WARNING("Flow tracking is disabled (run with --track-flows).");
+    return;
+  }
+
+  // Whatever is still in flight counts as lost, so this is only exact once traffic has stopped.
+  std::vector<int64_t> flow_loss(flow_tracker.num_flows, 0);
+  uint64_t tx_pkts = 0;
+  uint64_t rx_pkts = 0;
+
+  for (uint32_t stream = 0; stream < flow_tracker.num_streams; stream++) {
+    const size_t base = (size_t)stream * flow_tracker.num_flows;
+    for (uint32_t flow_idx = 0; flow_idx < flow_tracker.num_flows; flow_idx++) {
+      const uint32_t tx = flow_tracker.tx_seqs[stream][flow_idx] - tx_seqs_baseline[base + flow_idx];
+      const uint32_t rx = flow_tracker.rx_counts[base + flow_idx] - rx_counts_baseline[base + flow_idx];
+      tx_pkts += tx;
+      rx_pkts += rx;
+      flow_loss[flow_idx] += (int64_t)tx - (int64_t)rx;
+    }
+  }
+
+  // Workers that saw no reordered packet since the last reset still hold the maximum from before it.
+  const uint64_t reset_epoch      = flow_tracker.reset_epoch.load(std::memory_order_relaxed);
+  struct rx_seq_stats_t seq_stats = {.duplicates = 0, .reordered = 0, .late = 0, .max_reorder_depth = 0, .reset_epoch = reset_epoch};
+  for (uint16_t i = 0; i < config.rx.num_cores; i++) {
+    seq_stats.duplicates += rx_seq_stats[i].duplicates - rx_seq_stats_baseline[i].duplicates;
+    seq_stats.reordered += rx_seq_stats[i].reordered - rx_seq_stats_baseline[i].reordered;
+    seq_stats.late += rx_seq_stats[i].late - rx_seq_stats_baseline[i].late;
+    if (rx_seq_stats[i].reset_epoch == reset_epoch) {
+      seq_stats.max_reorder_depth = RTE_MAX(seq_stats.max_reorder_depth, rx_seq_stats[i].max_reorder_depth);
+    }
+  }
+
+  std::vector<uint32_t> lossy_flows;
+  for (uint32_t flow_idx = 0; flow_idx < flow_tracker.num_flows; flow_idx++) {
+    if (flow_loss[flow_idx] > 0) {
+      lossy_flows.push_back(flow_idx);
+    }
+  }
+
+  const size_t num_top = std::min(lossy_flows.size(), (size_t)TRACKER_TOP_FLOWS);
+  std::partial_sort(lossy_flows.begin(), lossy_flows.begin() + num_top, lossy_flows.end(),
+                    [&flow_loss](uint32_t a, uint32_t b) { return flow_loss[a] > flow_loss[b]; });
+
+  LOG();
+  LOG("~~~~~~ Flow tracking ~~~~~~");
+  LOG("  Sequenced TX:  %" PRIu64 " pkts", tx_pkts);
+  LOG("  Sequenced RX:  %" PRIu64 " pkts", rx_pkts);
+  LOG("  Lost:          %" PRId64 " pkts", (int64_t)tx_pkts - (int64_t)rx_pkts);
+  LOG("  Lossy flows:   %zu/%" PRIu32, lossy_flows.size(), flow_tracker.num_flows);
+  LOG("  Reordered:     %" PRIu64 " pkts (max depth %" PRIu64 ")", seq_stats.reordered, seq_stats.max_reorder_depth);
+  LOG("  Late:          %" PRIu64 " pkts", seq_stats.late);
+  LOG("  Duplicates:    %" PRIu64 " pkts", seq_stats.duplicates);
+
+  if (num_top > 0) {
+    LOG("  Top lossy flows:");
+  }
+
+  for (size_t i = 0; i < num_top; i++) {
+    const uint32_t flow_idx = lossy_flows[i];
+    flow_t flow;
+    kvs_flow_t kvs_flow;
+
+    if (config.ipv6) {
+      flow6_t flow6;
+      read_flow(flow_idx, flow6);
+      LOG("    #%" PRIu32 " lost %" PRId64 " %s", flow_idx, flow_loss[flow_idx], flow_to_string(flow6).c_str());
+    } else if (config.kvs_mode) {
+      read_flow<true>(flow_idx, flow, kvs_flow);
+      LOG("    #%" PRIu32 " lost %" PRId64 " %s", flow_idx, flow_loss[flow_idx], flow_to_string(kvs_flow).c_str());
+    } else {
+      read_flow<false>(flow_idx, flow, kvs_flow);
+      LOG("    #%" PRIu32 " lost %" PRId64 " %s", flow_idx, flow_loss[flow_idx], flow_to_string(flow).c_str());
+    }
+  }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include <rte_branch_prediction.h>
+#include <rte_common.h>
+
+#include "types.h"
+
+// Sequence window kept per tracked flow, in packets.
+#define TRACKER_WINDOW_SIZE 64
+
+// Per (TX stream, flow) sequence tracking, as flat arrays indexed by stream * num_flows + flow_idx. TX sequence numbers are only
+// written by the TX worker owning the stream, so they are kept per stream instead, on its socket. RX state is only written by the RX
+// worker RSS steers the flow to, which only holds as long as flows keep their 5-tuple: churning one would move it to another RX queue
+// while packets under the old one are still in flight, so churn is refused while tracking flows (see cmd_churn).
+struct flow_tracker_t {
+  uint32_t num_streams;
+  uint32_t num_flows;
+
+  // Next sequence number each stream sends on each flow, indexed by flow_idx.
+  uint32_t *tx_seqs[RTE_MAX_LCORE];
+
+  // One past the highest sequence number received.
+  uint32_t *rx_next_seqs;
+  // Distinct sequence numbers received.
+  uint32_t *rx_counts;
+  // Bit i is set if rx_next_seqs - 1 - i was received.
+  uint64_t *rx_windows;
+
+  // Bumped on every reset, for RX workers to start their max_reorder_depth over (a maximum cannot be baselined).
+  std::atomic<uint64_t> reset_epoch;
+};
+
+extern struct flow_tracker_t flow_tracker;
+
+// Per RX worker sequence counters, written only by their owner.
+struct rx_seq_stats_t {
+  uint64_t duplicates;
+  // Packets arriving after a higher sequence number of the same flow.
+  uint64_t reordered;
+  // Reordered packets too old for the window, which cannot be told apart from duplicates.
+  uint64_t late;
+  // Deepest reorder since the reset_epoch-th reset (see flow_tracker_t::reset_epoch).
+  uint64_t max_reorder_depth;
+  uint64_t reset_epoch;
+} __rte_cache_aligned;
+
+extern struct rx_seq_stats_t rx_seq_stats[RTE_MAX_LCORE];
+
+void flow_tracker_init(uint32_t num_streams, uint32_t num_flows);
+void flow_tracker_reset();
+void cmd_loss_display();
+
+static inline uint32_t *get_stream_tx_seqs(uint32_t stream) { return flow_tracker.tx_seqs[stream]; }
+
+static inline void flow_tracker_rx(struct rx_seq_stats_t *stats, uint32_t stream, uint32_t flow_idx, uint32_t seq) {
+  if (unlikely(stream >= flow_tracker.num_streams || flow_idx >= flow_tracker.num_flows)) {
+    return;
+  }
+
+  const size_t idx    = (size_t)stream * flow_tracker.num_flows + flow_idx;
+  const uint32_t next = flow_tracker.rx_next_seqs[idx];
+  uint64_t window     = flow_tracker.rx_windows[idx];
+
+  // Serial number arithmetic, sequences wrap around.
+  const int32_t ahead = (int32_t)(seq - next);
+
+  if (ahead >= 0) {
+    const uint32_t shift           = (uint32_t)ahead + 1;
+    window                         = (shift >= TRACKER_WINDOW_SIZE) ? 0 : (window << shift);
+    flow_tracker.rx_windows[idx]   = window | 1;
+    flow_tracker.rx_next_seqs[idx] = seq + 1;
+    flow_tracker.rx_counts[idx]++;
+    return;
+  }
+
+  const uint64_t depth = (uint64_t)(-(int64_t)ahead) - 1;
+  if (depth >= TRACKER_WINDOW_SIZE) {
+    stats->late++;
+    return;
+  }
+
+  const uint64_t bit = 1ull << depth;
+  if (window & bit) {
+    stats->duplicates++;
+    return;
+  }
+
+  flow_tracker.rx_windows[idx] = window | bit;
+  flow_tracker.rx_counts[idx]++;
+  stats->reordered++;
+
+  const uint64_t reset_epoch = flow_tracker.reset_epoch.load(std::memory_order_relaxed);
+  if (unlikely(stats->reset_epoch != reset_epoch)) {
+    stats->reset_epoch       = reset_epoch;
+    stats->max_reorder_depth = 0;
+  }
+  stats->max_reorder_depth = RTE_MAX(stats->max_reorder_depth, depth + 1);
+}
@@ -7,7 +7,6 @@
 #define MBUF_CACHE_SIZE 512
 #define MIN_NUM_MBUFS 8192
 #define DESC_RING_SIZE 1024
-#define NUM_SAMPLE_PACKETS (2 * DESC_RING_SIZE)
 #define DEFAULT_FLOWS_FILE "flows.pcap"
 
 // To induce churn, flows are changed from time to time, alternating between an
@@ -65,6 +64,22 @@ struct kvs_hdr_t {
 #define KVS_PKT_SIZE_BYTES                                                                                                                 \
   (RTE_ETHER_CRC_LEN + sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) + sizeof(struct kvs_hdr_t))
 
+#define PROBE_MAGIC 0x50524f42
+#define DEFAULT_PROBE_INTERVAL 1024
+
+#define PROBE_FLAG_TSC (1 << 0) // Latency probe, tx_tsc is valid
+#define PROBE_FLAG_SEQ (1 << 1) // Sequenced, flow_idx and seq are valid
+
+// Probe header, right after the UDP (or KVS) header. Packets carrying nothing in it have it zeroed out.
+struct probe_hdr_t {
+  uint32_t magic;
+  uint16_t stream_id;
+  uint16_t flags;
+  uint32_t flow_idx;
+  uint32_t seq;
+  uint64_t tx_tsc;
+} __attribute__((__packed__));
+
 typedef uint64_t churn_fpm_t;
 typedef uint64_t churn_fps_t;
 
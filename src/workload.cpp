@@ -0,0 +1,341 @@
+#include "workload.h"
+#include "config.h"
+#include "flows.h"
+#include "log.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <rte_common.h>
+#include <rte_hash_crc.h>
+
+// Sections start on cache line boundaries, so a mapping of the file can be used in place.
+#define WORKLOAD_SECTION_ALIGN 64
+
+// rte_hash_crc() takes 32-bit lengths, larger sections are checksummed in pieces.
+#define WORKLOAD_CRC_CHUNK_SIZE (1u << 30)
+
+namespace {
+
+enum workload_section_id_t {
+  WORKLOAD_FLOWS,
+  WORKLOAD_FLOWS6,
+  WORKLOAD_KVS_FLOWS,
+  WORKLOAD_FLOW_IDX_SEQ,
+  WORKLOAD_FLOW_IDX_GAPS,
+  WORKLOAD_FLOW_IDX_TMPLS,
+  WORKLOAD_PKT_TEMPLATE_KEYS,
+  WORKLOAD_WORKER_SEQ_SIZES, // Entries of each worker's sequence
+  WORKLOAD_WORKER_SEQS,      // Sequences of all workers, one after the other
+  WORKLOAD_NUM_SECTIONS,
+};
+
+struct workload_section_t {
+  uint64_t offset;
+  uint64_t count;
+  uint32_t elem_size;
+  uint32_t reserved;
+};
+
+// The file is this header followed by its sections. The checksum covers everything after the header.
+struct workload_file_hdr_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  crc32_t checksum;
+  uint32_t hdr_size;
+  workload_params_t params;
+  workload_section_t sections[WORKLOAD_NUM_SECTIONS];
+};
+
+static_assert(sizeof(workload_params_t) == 296, "workload_params_t must have no padding");
+static_assert(sizeof(workload_file_hdr_t) == 544, "workload_file_hdr_t must have no padding");
+
+// pkt_template_key_t, without its padding.
+struct workload_tmpl_key_t {
+  uint16_t proto;
+  uint16_t size;
+};
+
+typedef std::chrono::steady_clock workload_clock_t;
+
+crc32_t workload_crc(const uint8_t *data, size_t size, crc32_t crc) {
+  while (size > 0) {
+    const uint32_t len = std::min(size, (size_t)WORKLOAD_CRC_CHUNK_SIZE);
+    crc                = rte_hash_crc(data, len, crc);
+    data += len;
+    size -= len;
+  }
+  return crc;
+}
+
+void check_workload_hdr(const workload_file_hdr_t &hdr, uint64_t file_size) {
+  if (memcmp(hdr.magic, WORKLOAD_MAGIC, sizeof(hdr.magic)) != 0) {
+    panic("Not a workload file");
+  }
+  if (hdr.byte_order != WORKLOAD_BYTE_ORDER) {
+    panic("Workload saved on a machine with a different byte order");
+  }
+  if (hdr.version != WORKLOAD_VERSION || hdr.hdr_size != sizeof(workload_file_hdr_t)) {
+    panic("Workload file version %u is not supported (expected version %u)", hdr.version, WORKLOAD_VERSION);
+  }
+  if (hdr.file_size != file_size) {
+    panic("Truncated workload file: %lu bytes, expected %lu", file_size, hdr.file_size);
+  }
+}
+
+struct workload_writer_t {
+  FILE *file;
+  uint64_t offset;
+  crc32_t crc;
+
+  void write(const void *data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+      panic("Failed to write workload file");
+    }
+    crc = workload_crc(static_cast<const uint8_t *>(data), size, crc);
+    offset += size;
+  }
+
+  void align() {
+    static const uint8_t zeros[WORKLOAD_SECTION_ALIGN] = {};
+    write(zeros, RTE_ALIGN_CEIL(offset, WORKLOAD_SECTION_ALIGN) - offset);
+  }
+
+  // Starts a section, whose elements are then written out by the caller.
+  template <typename T> void begin_section(workload_file_hdr_t &hdr, workload_section_id_t id, uint64_t count) {
+    align();
+    hdr.sections[id] = {offset, count, sizeof(T), 0};
+  }
+
+  template <typename T> void section(workload_file_hdr_t &hdr, workload_section_id_t id, const std::vector<T> &elems) {
+    begin_section<T>(hdr, id, elems.size());
+    write(elems.data(), elems.size() * sizeof(T));
+  }
+};
+
+template <typename T>
+const T *get_section(const uint8_t *data, const workload_file_hdr_t &hdr, workload_section_id_t id, uint64_t &count) {
+  const workload_section_t &section = hdr.sections[id];
+  if (section.count > 0 && section.elem_size != sizeof(T)) {
+    panic("Workload section %d has %u-byte elements, expected %zu", id, section.elem_size, sizeof(T));
+  }
+  if (section.offset > hdr.file_size || section.count > (hdr.file_size - section.offset) / sizeof(T)) {
+    panic("Workload section %d is out of bounds", id);
+  }
+  count = section.count;
+  return reinterpret_cast<const T *>(data + section.offset);
+}
+
+template <typename T>
+void load_section(const uint8_t *data, const workload_file_hdr_t &hdr, workload_section_id_t id, std::vector<T> &out) {
+  uint64_t count;
+  const T *elems = get_section<T>(data, hdr, id, count);
+  out.assign(elems, elems + count);
+}
+
+// Whether every entry is a valid index into something with this many elements.
+template <typename T> bool all_below(const T *entries, uint64_t count, uint64_t limit) {
+  return std::all_of(entries, entries + count, [limit](T entry) { return entry < limit; });
+}
+
+} // namespace
+
+workload_params_t read_workload_params(const std::string &file) {
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    panic("Failed to open workload file %s", file.c_str());
+  }
+
+  struct stat file_stat;
+  workload_file_hdr_t hdr;
+  if (fstat(fd, &file_stat) != 0 || pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+    panic("Invalid workload file %s", file.c_str());
+  }
+  close(fd);
+
+  check_workload_hdr(hdr, file_stat.st_size);
+  hdr.params.pcap_fname[WORKLOAD_MAX_PATH - 1] = '\0';
+
+  return hdr.params;
+}
+
+void load_workload(const std::string &file) {
+  LOG("Loading workload from %s...", file.c_str());
+  const workload_clock_t::time_point start = workload_clock_t::now();
+
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    perror("open");
+    panic("Failed to open workload file %s", file.c_str());
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (off_t)sizeof(workload_file_hdr_t)) {
+    panic("Invalid workload file %s", file.c_str());
+  }
+
+  const size_t file_size = file_stat.st_size;
+  const uint8_t *data    = (const uint8_t *)mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    perror("mmap");
+    panic("Failed to map workload file");
+  }
+  madvise((void *)data, file_size, MADV_SEQUENTIAL);
+
+  workload_file_hdr_t hdr;
+  memcpy(&hdr, data, sizeof(hdr));
+  check_workload_hdr(hdr, file_size);
+
+  const crc32_t crc = workload_crc(data + sizeof(hdr), file_size - sizeof(hdr), 0);
+  if (crc != hdr.checksum) {
+    panic("Corrupted workload file: checksum 0x%08x, expected 0x%08x", crc, hdr.checksum);
+  }
+
+  load_section(data, hdr, WORKLOAD_FLOWS, flows);
+  load_section(data, hdr, WORKLOAD_FLOWS6, flows6);
+  load_section(data, hdr, WORKLOAD_KVS_FLOWS, kvs_flows);
+  load_section(data, hdr, WORKLOAD_FLOW_IDX_SEQ, flow_idx_seq);
+  load_section(data, hdr, WORKLOAD_FLOW_IDX_GAPS, flow_idx_gaps);
+  load_section(data, hdr, WORKLOAD_FLOW_IDX_TMPLS, flow_idx_tmpls);
+
+  uint64_t num_tmpl_keys;
+  const workload_tmpl_key_t *tmpl_keys = get_section<workload_tmpl_key_t>(data, hdr, WORKLOAD_PKT_TEMPLATE_KEYS, num_tmpl_keys);
+  pkt_template_keys.clear();
+  for (uint64_t i = 0; i < num_tmpl_keys; i++) {
+    pkt_template_keys.push_back({(uint8_t)tmpl_keys[i].proto, tmpl_keys[i].size});
+  }
+
+  if (get_num_flows() == 0 || flow_idx_seq.empty() || (config.kvs_mode && kvs_flows.size() != flows.size()) ||
+      (!flow_idx_gaps.empty() && flow_idx_gaps.size() != flow_idx_seq.size()) ||
+      (!flow_idx_tmpls.empty() && flow_idx_tmpls.size() != flow_idx_seq.size())) {
+    panic("Inconsistent workload file");
+  }
+  if (!all_below(flow_idx_seq.data(), flow_idx_seq.size(), get_num_flows()) ||
+      !all_below(flow_idx_tmpls.data(), flow_idx_tmpls.size(), pkt_template_keys.size())) {
+    panic("Inconsistent workload file: flow indexes or template ids out of range");
+  }
+
+  // Per-worker sequences are only of use with as many workers as when they were saved, and as long as they are not split by port
+  // anew.
+  uint64_t num_workers;
+  uint64_t num_worker_entries;
+  const uint64_t *worker_seq_sizes = get_section<uint64_t>(data, hdr, WORKLOAD_WORKER_SEQ_SIZES, num_workers);
+  const uint32_t *worker_seqs      = get_section<uint32_t>(data, hdr, WORKLOAD_WORKER_SEQS, num_worker_entries);
+  if (!all_below(worker_seqs, num_worker_entries, get_num_flows())) {
+    panic("Inconsistent workload file: per-worker flow indexes out of range");
+  }
+
+  loaded_flow_idx_seq_per_worker.clear();
+  if (num_workers == config.tx.num_cores && !config.sync_cores && !config.tx.split_flows) {
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < num_workers; i++) {
+      if (worker_seq_sizes[i] > num_worker_entries - offset) {
+        panic("Inconsistent workload file");
+      }
+      loaded_flow_idx_seq_per_worker.emplace_back(worker_seqs + offset, worker_seqs + offset + worker_seq_sizes[i]);
+      offset += worker_seq_sizes[i];
+    }
+  } else if (num_workers > 0 && !config.sync_cores) {
+    LOG("Workload was saved for %lu TX workers, its sequence will be distributed again.", num_workers);
+  }
+
+  munmap((void *)data, file_size);
+
+  const double elapsed = std::chrono::duration<double>(workload_clock_t::now() - start).count();
+  LOG("Loaded workload in %.2f s: %zu flows, %zu index entries (%.1f MB).", elapsed, get_num_flows(), flow_idx_seq.size(),
+      file_size / 1e6);
+}
+
+void save_workload(const std::string &file, const std::vector<std::vector<uint32_t>> &flow_idx_seq_per_worker) {
+  LOG("Saving workload to %s...", file.c_str());
+
+  // Written next to its final location and only then renamed, so a half-written file never takes the place of a good one.
+  const std::string tmp_file = file + ".tmp";
+  workload_writer_t writer{fopen(tmp_file.c_str(), "wb"), 0, 0};
+  if (writer.file == nullptr) {
+    perror("fopen");
+    panic("Failed to create workload file %s", tmp_file.c_str());
+  }
+
+  workload_file_hdr_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, WORKLOAD_MAGIC, sizeof(hdr.magic));
+  hdr.version    = WORKLOAD_VERSION;
+  hdr.byte_order = WORKLOAD_BYTE_ORDER;
+  hdr.hdr_size   = sizeof(hdr);
+
+  workload_params_t &params = hdr.params;
+  params.seed               = config.seed;
+  params.num_flows          = config.num_flows;
+  params.dist               = config.dist;
+  params.zipf_param         = config.zipf_param;
+  params.logical_batch_size = config.logical_batch_size.value_or(0);
+  params.force_unique_flows = config.force_unique_flows;
+  params.kvs_mode           = config.kvs_mode;
+  params.ipv6               = config.ipv6;
+  params.zipf_seq_len       = config.zipf_seq_len;
+  params.zipf_cover         = config.zipf_cover;
+  params.num_tx_workers     = flow_idx_seq_per_worker.size();
+  if (config.pcap_fname.size() >= WORKLOAD_MAX_PATH) {
+    WARNING("Pcap file name is too long, it is saved truncated to %d characters.", WORKLOAD_MAX_PATH - 1);
+  }
+  strncpy(params.pcap_fname, config.pcap_fname.c_str(), WORKLOAD_MAX_PATH - 1);
+
+  // The header is rewritten once the sections are in place.
+  if (fwrite(&hdr, 1, sizeof(hdr), writer.file) != sizeof(hdr)) {
+    panic("Failed to write workload file");
+  }
+  writer.offset = sizeof(hdr);
+
+  std::vector<workload_tmpl_key_t> tmpl_keys;
+  for (const pkt_template_key_t &key : pkt_template_keys) {
+    tmpl_keys.push_back({key.proto, (uint16_t)key.size});
+  }
+
+  std::vector<uint64_t> worker_seq_sizes;
+  for (const std::vector<uint32_t> &worker_seq : flow_idx_seq_per_worker) {
+    worker_seq_sizes.push_back(worker_seq.size());
+  }
+
+  writer.section(hdr, WORKLOAD_FLOWS, flows);
+  writer.section(hdr, WORKLOAD_FLOWS6, flows6);
+  writer.section(hdr, WORKLOAD_KVS_FLOWS, kvs_flows);
+  writer.section(hdr, WORKLOAD_FLOW_IDX_SEQ, flow_idx_seq);
+  writer.section(hdr, WORKLOAD_FLOW_IDX_GAPS, flow_idx_gaps);
+  writer.section(hdr, WORKLOAD_FLOW_IDX_TMPLS, flow_idx_tmpls);
+  writer.section(hdr, WORKLOAD_PKT_TEMPLATE_KEYS, tmpl_keys);
+  writer.section(hdr, WORKLOAD_WORKER_SEQ_SIZES, worker_seq_sizes);
+
+  uint64_t num_worker_entries = 0;
+  for (uint64_t size : worker_seq_sizes) {
+    num_worker_entries += size;
+  }
+  writer.begin_section<uint32_t>(hdr, WORKLOAD_WORKER_SEQS, num_worker_entries);
+  for (const std::vector<uint32_t> &worker_seq : flow_idx_seq_per_worker) {
+    writer.write(worker_seq.data(), worker_seq.size() * sizeof(uint32_t));
+  }
+
+  hdr.file_size = writer.offset;
+  hdr.checksum  = writer.crc;
+  if (fseek(writer.file, 0, SEEK_SET) != 0 || fwrite(&hdr, 1, sizeof(hdr), writer.file) != sizeof(hdr) || fclose(writer.file) != 0) {
+    panic("Failed to write workload file");
+  }
+
+  if (rename(tmp_file.c_str(), file.c_str()) != 0) {
+    perror("rename");
+    panic("Failed to move workload file into place");
+  }
+
+  LOG("Saved workload: %zu flows, %zu index entries (%.1f MB).", get_num_flows(), flow_idx_seq.size(), hdr.file_size / 1e6);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+
+// Precompiled workloads: everything generate_flows() and generate_flow_idx_sequence() produce, saved to a binary file that is loaded
+// back without generating or parsing anything. Only the generation parameters are taken from it, runtime options (rate, cores, probes,
+// etc.) still come from the command line.
+#define WORKLOAD_MAGIC "PKTGWKLD"
+#define WORKLOAD_VERSION 3
+#define WORKLOAD_BYTE_ORDER 0x01020304
+#define WORKLOAD_MAX_PATH 256
+
+// What the workload was generated from. It replaces the matching options of the command line when loading it.
+struct workload_params_t {
+  uint64_t seed;
+  uint32_t num_flows;
+  uint32_t dist;
+  double zipf_param;
+  uint32_t logical_batch_size; // 0 if disabled
+  uint8_t force_unique_flows;
+  uint8_t kvs_mode;
+  uint16_t num_tx_workers; // Per-worker sequences were saved for this many workers (0 if none)
+  char pcap_fname[WORKLOAD_MAX_PATH];
+  uint8_t ipv6; // Flows are in the IPv6 section instead of the IPv4 one
+  uint8_t zipf_cover;
+  uint8_t reserved[2];
+  uint32_t zipf_seq_len; // 0 if unknown (saved before it was recorded)
+};
+
+// Panics if the file is not a workload this build can load.
+workload_params_t read_workload_params(const std::string &file);
+
+// Fills in the flows, the flow index sequence and everything that comes with it (gaps and templates of a pcap, per-worker sequences),
+// after checking the file against its checksum.
+void load_workload(const std::string &file);
+
+// Saves the current workload, along with its per-worker sequences (if any).
+void save_workload(const std::string &file, const std::vector<std::vector<uint32_t>> &flow_idx_seq_per_worker);